@@ -19,6 +19,31 @@ extern "C" {
  */
 int usr_sqlite_open(qd_context* ctx);
 
+/**
+ * Open SQLite database with SQLITE_OPEN_* flags.
+ * Stack: (path:str flags:i64 -- db:ptr)!
+ */
+int usr_sqlite_open_v2(qd_context* ctx);
+
+/**
+ * Open SQLite database with flags through a named VFS ("" for default).
+ * Stack: (path:str flags:i64 vfs:str -- db:ptr)!
+ */
+int usr_sqlite_open_vfs(qd_context* ctx);
+
+/**
+ * Open SQLite database with flags and apply a tuning preset.
+ * Presets: "throughput", "durable", "readonly", "default".
+ * Stack: (path:str flags:i64 preset:str -- db:ptr)!
+ */
+int usr_sqlite_open_preset(qd_context* ctx);
+
+/**
+ * Apply a tuning preset to an open connection.
+ * Stack: (preset:str db:ptr -- )!
+ */
+int usr_sqlite_apply_preset(qd_context* ctx);
+
 /**
  * Close database.
  * Stack: (db:ptr -- )
@@ -37,6 +62,19 @@ int usr_sqlite_exec(qd_context* ctx);
  */
 int usr_sqlite_prepare(qd_context* ctx);
 
+/**
+ * Prepare a SQL statement through the connection's statement cache.
+ * Returns an idle cached statement when the SQL text matches.
+ * Stack: (sql:str db:ptr -- stmt:ptr)!
+ */
+int usr_sqlite_prepare_cached(qd_context* ctx);
+
+/**
+ * Reset statement and return it to its connection's cache.
+ * Stack: (stmt:ptr -- )
+ */
+int usr_sqlite_release(qd_context* ctx);
+
 /**
  * Bind string parameter to statement.
  * Stack: (value:str index:i64 stmt:ptr -- )!
@@ -61,6 +99,18 @@ int usr_sqlite_bind_float(qd_context* ctx);
  */
 int usr_sqlite_bind_null(qd_context* ctx);
 
+/**
+ * Bind BLOB parameter to statement (bytes are copied).
+ * Stack: (data:ptr len:i64 index:i64 stmt:ptr -- )!
+ */
+int usr_sqlite_bind_blob(qd_context* ctx);
+
+/**
+ * Bind zero-filled BLOB of the given size to statement.
+ * Stack: (size:i64 index:i64 stmt:ptr -- )!
+ */
+int usr_sqlite_bind_zeroblob(qd_context* ctx);
+
 /**
  * Execute prepared statement and step to next row.
  * Returns 1 if row available, 0 if done.
@@ -69,11 +119,17 @@ int usr_sqlite_bind_null(qd_context* ctx);
 int usr_sqlite_step(qd_context* ctx);
 
 /**
- * Reset statement for re-execution.
+ * Reset statement for re-execution, keeping its bindings.
  * Stack: (stmt:ptr -- )!
  */
 int usr_sqlite_reset(qd_context* ctx);
 
+/**
+ * Set all parameters of a statement back to NULL.
+ * Stack: (stmt:ptr -- )
+ */
+int usr_sqlite_clear_bindings(qd_context* ctx);
+
 /**
  * Finalize (free) prepared statement.
  * Stack: (stmt:ptr -- )
@@ -117,6 +173,26 @@ int usr_sqlite_column_float(qd_context* ctx);
  */
 int usr_sqlite_column_text(qd_context* ctx);
 
+/**
+ * Borrow text column value without copying.
+ * The view is valid until the next step, reset or finalize.
+ * Stack: (index:i64 stmt:ptr -- data:ptr len:i64)
+ */
+int usr_sqlite_column_text_view(qd_context* ctx);
+
+/**
+ * Borrow BLOB column value without copying.
+ * The view is valid until the next step, reset or finalize.
+ * Stack: (index:i64 stmt:ptr -- data:ptr len:i64)
+ */
+int usr_sqlite_column_blob(qd_context* ctx);
+
+/**
+ * Read the monotonic clock in nanoseconds.
+ * Stack: ( -- ns:i64)
+ */
+int usr_sqlite_monotonic_ns(qd_context* ctx);
+
 /**
  * Get last insert rowid.
  * Stack: (db:ptr -- rowid:i64)
@@ -147,6 +223,802 @@ int usr_sqlite_commit(qd_context* ctx);
  */
 int usr_sqlite_rollback(qd_context* ctx);
 
+/**
+ * Begin transaction taking the write lock up front.
+ * Stack: (db:ptr -- )!
+ */
+int usr_sqlite_begin_immediate(qd_context* ctx);
+
+/**
+ * Begin exclusive transaction.
+ * Stack: (db:ptr -- )!
+ */
+int usr_sqlite_begin_exclusive(qd_context* ctx);
+
+/**
+ * Open a named savepoint (nests inside transactions and other savepoints).
+ * Stack: (name:str db:ptr -- )!
+ */
+int usr_sqlite_savepoint(qd_context* ctx);
+
+/**
+ * Release a savepoint, keeping its changes.
+ * Stack: (name:str db:ptr -- )!
+ */
+int usr_sqlite_release_savepoint(qd_context* ctx);
+
+/**
+ * Undo changes made since a savepoint; the savepoint stays open.
+ * Stack: (name:str db:ptr -- )!
+ */
+int usr_sqlite_rollback_to(qd_context* ctx);
+
+/**
+ * Set maximum number of idle statements kept in the cache.
+ * Stack: (capacity:i64 db:ptr -- )!
+ */
+int usr_sqlite_set_stmt_cache(qd_context* ctx);
+
+/**
+ * Get statement cache hit, miss and eviction counters.
+ * Stack: (db:ptr -- hits:i64 misses:i64 evictions:i64)
+ */
+int usr_sqlite_stmt_cache_stats(qd_context* ctx);
+
+/**
+ * Step up to n rows into a new columnar batch.
+ * Returns 0 rows once the statement is exhausted.
+ * Stack: (n:i64 stmt:ptr -- batch:ptr rows:i64)!
+ */
+int usr_sqlite_fetch_batch(qd_context* ctx);
+
+/**
+ * Step the next rows into an existing batch, reusing its buffers.
+ * Stack: (batch:ptr stmt:ptr -- rows:i64)!
+ */
+int usr_sqlite_refill_batch(qd_context* ctx);
+
+/**
+ * Free a batch.
+ * Stack: (batch:ptr -- )
+ */
+int usr_sqlite_batch_free(qd_context* ctx);
+
+/**
+ * Get number of rows held in a batch.
+ * Stack: (batch:ptr -- rows:i64)
+ */
+int usr_sqlite_batch_rows(qd_context* ctx);
+
+/**
+ * Get batch cell type.
+ * Stack: (row:i64 col:i64 batch:ptr -- type:i64)
+ */
+int usr_sqlite_batch_type(qd_context* ctx);
+
+/**
+ * Get batch cell as integer.
+ * Stack: (row:i64 col:i64 batch:ptr -- value:i64)
+ */
+int usr_sqlite_batch_int(qd_context* ctx);
+
+/**
+ * Get batch cell as float.
+ * Stack: (row:i64 col:i64 batch:ptr -- value:f64)
+ */
+int usr_sqlite_batch_float(qd_context* ctx);
+
+/**
+ * Get batch cell as text.
+ * Stack: (row:i64 col:i64 batch:ptr -- value:str)
+ */
+int usr_sqlite_batch_text(qd_context* ctx);
+
+/**
+ * Create an empty batch for building parameter rows.
+ * Grows past capacity as cells are added.
+ * Stack: (ncols:i64 capacity:i64 -- batch:ptr)!
+ */
+int usr_sqlite_batch_new(qd_context* ctx);
+
+/**
+ * Remove all rows from a batch, keeping its buffers.
+ * Stack: (batch:ptr -- )
+ */
+int usr_sqlite_batch_clear(qd_context* ctx);
+
+/**
+ * Append integer cell to a batch (row-major order).
+ * Stack: (value:i64 batch:ptr -- )!
+ */
+int usr_sqlite_batch_add_int(qd_context* ctx);
+
+/**
+ * Append float cell to a batch (row-major order).
+ * Stack: (value:f64 batch:ptr -- )!
+ */
+int usr_sqlite_batch_add_float(qd_context* ctx);
+
+/**
+ * Append text cell to a batch (row-major order).
+ * Stack: (value:str batch:ptr -- )!
+ */
+int usr_sqlite_batch_add_text(qd_context* ctx);
+
+/**
+ * Append NULL cell to a batch (row-major order).
+ * Stack: (batch:ptr -- )!
+ */
+int usr_sqlite_batch_add_null(qd_context* ctx);
+
+/**
+ * Bind and run statement once per batch row.
+ * Stack: (batch:ptr stmt:ptr -- rows:i64)!
+ */
+int usr_sqlite_execute_batch(qd_context* ctx);
+
+/**
+ * Bind and run statement once per batch row inside one transaction.
+ * Stack: (batch:ptr stmt:ptr -- rows:i64)!
+ */
+int usr_sqlite_execute_batch_tx(qd_context* ctx);
+
+/**
+ * Borrow batch text cell without copying.
+ * The view is valid until the batch is refilled or freed.
+ * Stack: (row:i64 col:i64 batch:ptr -- data:ptr len:i64)
+ */
+int usr_sqlite_batch_text_view(qd_context* ctx);
+
+/**
+ * Compare string with a text view (-1, 0 or 1).
+ * Stack: (value:str data:ptr len:i64 -- order:i64)
+ */
+int usr_sqlite_text_view_compare(qd_context* ctx);
+
+/**
+ * Check whether a text view equals a string.
+ * Stack: (value:str data:ptr len:i64 -- equal:i64)
+ */
+int usr_sqlite_text_view_equals(qd_context* ctx);
+
+/**
+ * Hash a text view (64-bit FNV-1a).
+ * Stack: (data:ptr len:i64 -- hash:i64)
+ */
+int usr_sqlite_text_view_hash(qd_context* ctx);
+
+/**
+ * Copy a text view into a new string.
+ * Stack: (data:ptr len:i64 -- value:str)
+ */
+int usr_sqlite_text_view_copy(qd_context* ctx);
+
+/**
+ * Open a BLOB for incremental I/O; schema "" means main.
+ * Stack: (schema:str table:str column:str rowid:i64 writable:i64 db:ptr -- blob:ptr)!
+ */
+int usr_sqlite_blob_open(qd_context* ctx);
+
+/**
+ * Move an open BLOB handle to another row of the same table.
+ * Stack: (rowid:i64 blob:ptr -- )!
+ */
+int usr_sqlite_blob_reopen(qd_context* ctx);
+
+/**
+ * Get size of an open BLOB in bytes.
+ * Stack: (blob:ptr -- size:i64)
+ */
+int usr_sqlite_blob_bytes(qd_context* ctx);
+
+/**
+ * Read up to n bytes at offset into the handle's chunk buffer.
+ * The returned view is valid until the next read or close.
+ * Stack: (n:i64 offset:i64 blob:ptr -- data:ptr len:i64)!
+ */
+int usr_sqlite_blob_read(qd_context* ctx);
+
+/**
+ * Write bytes at offset into an open BLOB.
+ * Stack: (data:ptr len:i64 offset:i64 blob:ptr -- )!
+ */
+int usr_sqlite_blob_write(qd_context* ctx);
+
+/**
+ * Close an open BLOB.
+ * Stack: (blob:ptr -- )
+ */
+int usr_sqlite_blob_close(qd_context* ctx);
+
+/**
+ * Open a pool of one writer and N read-only connections over a WAL database.
+ * Stack: (path:str readers:i64 -- pool:ptr)!
+ */
+int usr_sqlite_pool_open(qd_context* ctx);
+
+/**
+ * Take an idle reader connection, blocking until one is free.
+ * Stack: (pool:ptr -- db:ptr)!
+ */
+int usr_sqlite_pool_acquire_read(qd_context* ctx);
+
+/**
+ * Take the writer connection, blocking until it is free.
+ * Stack: (pool:ptr -- db:ptr)!
+ */
+int usr_sqlite_pool_acquire_write(qd_context* ctx);
+
+/**
+ * Return a connection to its pool.
+ * Stack: (db:ptr pool:ptr -- )!
+ */
+int usr_sqlite_pool_release(qd_context* ctx);
+
+/**
+ * Close every connection in a pool.
+ * Stack: (pool:ptr -- )
+ */
+int usr_sqlite_pool_close(qd_context* ctx);
+
+/**
+ * Retry on SQLITE_BUSY for up to ms milliseconds (0 disables).
+ * Replaces any busy handler.
+ * Stack: (ms:i64 db:ptr -- )!
+ */
+int usr_sqlite_set_busy_timeout(qd_context* ctx);
+
+/**
+ * Retry on SQLITE_BUSY with jittered, capped exponential backoff.
+ * Replaces any busy handler or timeout.
+ * Stack: (base_ms:i64 max_ms:i64 retries:i64 db:ptr -- )!
+ */
+int usr_sqlite_set_busy_backoff(qd_context* ctx);
+
+/**
+ * Run a multi-statement script, recording per-statement results.
+ * Stack: (sql:str stop_on_error:i64 db:ptr -- result:ptr failed:i64)!
+ */
+int usr_sqlite_exec_script(qd_context* ctx);
+
+/**
+ * Get number of statements run by a script.
+ * Stack: (result:ptr -- count:i64)
+ */
+int usr_sqlite_script_count(qd_context* ctx);
+
+/**
+ * Get SQL text of a script statement.
+ * Stack: (index:i64 result:ptr -- sql:str)
+ */
+int usr_sqlite_script_sql(qd_context* ctx);
+
+/**
+ * Get rows changed by a script statement.
+ * Stack: (index:i64 result:ptr -- changes:i64)
+ */
+int usr_sqlite_script_changes(qd_context* ctx);
+
+/**
+ * Get wall time of a script statement in microseconds.
+ * Stack: (index:i64 result:ptr -- us:i64)
+ */
+int usr_sqlite_script_elapsed_us(qd_context* ctx);
+
+/**
+ * Get error code of a script statement (0 on success).
+ * Stack: (index:i64 result:ptr -- code:i64)
+ */
+int usr_sqlite_script_error(qd_context* ctx);
+
+/**
+ * Get error message of a script statement ("" on success).
+ * Stack: (index:i64 result:ptr -- message:str)
+ */
+int usr_sqlite_script_message(qd_context* ctx);
+
+/**
+ * Free script results.
+ * Stack: (result:ptr -- )
+ */
+int usr_sqlite_script_free(qd_context* ctx);
+
+/**
+ * Read a sqlite3_stmt_status counter (Stmt* constants).
+ * Stack: (op:i64 reset:i64 stmt:ptr -- value:i64)
+ */
+int usr_sqlite_stmt_status(qd_context* ctx);
+
+/**
+ * Get wall time and step count accumulated while step timing is enabled.
+ * Stack: (reset:i64 stmt:ptr -- ns:i64 steps:i64)
+ */
+int usr_sqlite_stmt_elapsed(qd_context* ctx);
+
+/**
+ * Enable or disable per-statement step timing on a connection.
+ * Stack: (enabled:i64 db:ptr -- )
+ */
+int usr_sqlite_set_step_timing(qd_context* ctx);
+
+/**
+ * Read a sqlite3_db_status counter (Db* constants).
+ * Stack: (op:i64 reset:i64 db:ptr -- current:i64 highwater:i64)
+ */
+int usr_sqlite_db_status(qd_context* ctx);
+
+/**
+ * Log statements slower than threshold_us via sqlite3_trace_v2
+ * (negative disables).
+ * Stack: (threshold_us:i64 db:ptr -- )!
+ */
+int usr_sqlite_trace_slow(qd_context* ctx);
+
+/**
+ * Get number of logged slow statements.
+ * Stack: (db:ptr -- count:i64)
+ */
+int usr_sqlite_slow_count(qd_context* ctx);
+
+/**
+ * Get SQL of a logged slow statement (0 is oldest).
+ * Stack: (index:i64 db:ptr -- sql:str)
+ */
+int usr_sqlite_slow_sql(qd_context* ctx);
+
+/**
+ * Get run time of a logged slow statement in microseconds.
+ * Stack: (index:i64 db:ptr -- us:i64)
+ */
+int usr_sqlite_slow_elapsed_us(qd_context* ctx);
+
+/**
+ * Empty the slow statement log.
+ * Stack: (db:ptr -- )
+ */
+int usr_sqlite_slow_clear(qd_context* ctx);
+
+/**
+ * Column readers without runtime argument checks; the module signatures
+ * already fix the argument types.
+ * Stack: (index:i64 stmt:ptr -- value)
+ */
+int usr_sqlite_column_type_unchecked(qd_context* ctx);
+int usr_sqlite_column_int_unchecked(qd_context* ctx);
+int usr_sqlite_column_float_unchecked(qd_context* ctx);
+int usr_sqlite_column_text_unchecked(qd_context* ctx);
+
+/**
+ * Parameter binds without runtime argument checks; the module signatures
+ * already fix the argument types.
+ * Stack: (value index:i64 stmt:ptr -- )!
+ */
+int usr_sqlite_bind_int_unchecked(qd_context* ctx);
+int usr_sqlite_bind_float_unchecked(qd_context* ctx);
+int usr_sqlite_bind_text_unchecked(qd_context* ctx);
+
+/**
+ * Step and read one integer column in a single call.
+ * Stack: (index:i64 stmt:ptr -- value:i64 has_row:i64)!
+ */
+int usr_sqlite_step_int(qd_context* ctx);
+
+/**
+ * Hand a connection to a background writer that commits queued writes in
+ * groups of up to max_ops, at most interval_ms apart.
+ * Stack: (interval_ms:i64 max_ops:i64 db:ptr -- queue:ptr)!
+ */
+int usr_sqlite_write_queue_start(qd_context* ctx);
+
+/**
+ * Queue a statement for the next group commit (thread-safe).
+ * Stack: (sql:str queue:ptr -- ticket:ptr)!
+ */
+int usr_sqlite_write_submit(qd_context* ctx);
+
+/**
+ * Queue a statement with parameter rows; the queue takes the batch.
+ * Stack: (sql:str batch:ptr queue:ptr -- ticket:ptr)!
+ */
+int usr_sqlite_write_submit_batch(qd_context* ctx);
+
+/**
+ * Wait for a queued write to commit; frees the ticket.
+ * Stack: (ticket:ptr queue:ptr -- changes:i64)!
+ */
+int usr_sqlite_write_wait(qd_context* ctx);
+
+/**
+ * Commit pending writes, stop the writer and free the queue.
+ * Stack: (queue:ptr -- )
+ */
+int usr_sqlite_write_queue_stop(qd_context* ctx);
+
+/**
+ * Run a query on a native worker thread, delivering chunk-row batches.
+ * Stack: (sql:str chunk:i64 db:ptr -- handle:ptr)!
+ */
+int usr_sqlite_query_async(qd_context* ctx);
+
+/**
+ * Like query_async, binding the first row of params (takes ownership).
+ * Stack: (sql:str params:ptr chunk:i64 db:ptr -- handle:ptr)!
+ */
+int usr_sqlite_query_async_params(qd_context* ctx);
+
+/**
+ * Check whether async_await would return without blocking.
+ * Stack: (handle:ptr -- ready:i64)
+ */
+int usr_sqlite_async_poll(qd_context* ctx);
+
+/**
+ * Wait for the next result batch; rows is 0 once the query is done.
+ * Stack: (handle:ptr -- batch:ptr rows:i64)!
+ */
+int usr_sqlite_async_await(qd_context* ctx);
+
+/**
+ * Interrupt an asynchronous query via sqlite3_interrupt.
+ * Stack: (handle:ptr -- )
+ */
+int usr_sqlite_async_cancel(qd_context* ctx);
+
+/**
+ * Cancel if still running, wait for the worker and free the handle.
+ * Stack: (handle:ptr -- )
+ */
+int usr_sqlite_async_free(qd_context* ctx);
+
+/**
+ * Bulk load a CSV file into a table, committing every commit_rows rows
+ * (0 for one transaction). Flags: ImportSyncOff, ImportNoHeader.
+ * Stack: (path:str table:str commit_rows:i64 flags:i64 db:ptr -- rows:i64)!
+ */
+int usr_sqlite_import_csv(qd_context* ctx);
+
+/**
+ * Bulk load newline-delimited JSON objects, mapping keys to the table's
+ * columns by name. Flags: ImportSyncOff.
+ * Stack: (path:str table:str commit_rows:i64 flags:i64 db:ptr -- rows:i64)!
+ */
+int usr_sqlite_import_ndjson(qd_context* ctx);
+
+/**
+ * Step a statement to completion, writing rows to fd as CSV or NDJSON.
+ * Stack: (format:i64 fd:i64 stmt:ptr -- rows:i64)!
+ */
+int usr_sqlite_export(qd_context* ctx);
+
+/**
+ * Like export, creating or truncating the file at path.
+ * Stack: (path:str format:i64 stmt:ptr -- rows:i64)!
+ */
+int usr_sqlite_export_file(qd_context* ctx);
+
+/**
+ * Start an online backup of src's main database into dest.
+ * Stack: (dest:ptr src:ptr -- backup:ptr)!
+ */
+int usr_sqlite_backup_init(qd_context* ctx);
+
+/**
+ * Copy up to pages pages (-1 for all); done is 1 when complete.
+ * Stack: (pages:i64 backup:ptr -- done:i64)!
+ */
+int usr_sqlite_backup_step(qd_context* ctx);
+
+/**
+ * Pages still to copy as of the last step.
+ * Stack: (backup:ptr -- pages:i64)
+ */
+int usr_sqlite_backup_remaining(qd_context* ctx);
+
+/**
+ * Total source pages as of the last step.
+ * Stack: (backup:ptr -- pages:i64)
+ */
+int usr_sqlite_backup_pagecount(qd_context* ctx);
+
+/**
+ * Release a backup.
+ * Stack: (backup:ptr -- )!
+ */
+int usr_sqlite_backup_finish(qd_context* ctx);
+
+/**
+ * Copy src into dest in steps of pages, sleeping sleep_ms between steps.
+ * Stack: (pages:i64 sleep_ms:i64 dest:ptr src:ptr -- )!
+ */
+int usr_sqlite_backup_run(qd_context* ctx);
+
+/**
+ * Find a result column by name (ASCII case-insensitive); -1 if absent.
+ * Stack: (name:str stmt:ptr -- index:i64)
+ */
+int usr_sqlite_column_index(qd_context* ctx);
+
+/**
+ * Get the declared type of a result column ("" for expressions).
+ * Stack: (index:i64 stmt:ptr -- decltype:str)
+ */
+int usr_sqlite_column_decltype(qd_context* ctx);
+
+/**
+ * Get the source table of a result column ("" for expressions).
+ * Stack: (index:i64 stmt:ptr -- table:str)
+ */
+int usr_sqlite_column_table(qd_context* ctx);
+
+/**
+ * Get the source table column of a result column ("" for expressions).
+ * Stack: (index:i64 stmt:ptr -- column:str)
+ */
+int usr_sqlite_column_origin(qd_context* ctx);
+
+/**
+ * Get the 1-based index of a named parameter (":id" or "id"); 0 if absent.
+ * Stack: (name:str stmt:ptr -- index:i64)
+ */
+int usr_sqlite_param_index(qd_context* ctx);
+
+/**
+ * Get the number of parameters of a statement.
+ * Stack: (stmt:ptr -- count:i64)
+ */
+int usr_sqlite_bind_count(qd_context* ctx);
+
+/**
+ * Bind parameters by name, resolved through a per-statement index.
+ * Stack: (value name:str stmt:ptr -- )!
+ */
+int usr_sqlite_bind_text_named(qd_context* ctx);
+int usr_sqlite_bind_int_named(qd_context* ctx);
+int usr_sqlite_bind_float_named(qd_context* ctx);
+int usr_sqlite_bind_null_named(qd_context* ctx);
+int usr_sqlite_bind_blob_named(qd_context* ctx);
+
+/**
+ * Run a query and copy every row into one arena-backed result.
+ * Stack: (sql:str params:ptr db:ptr -- result:ptr)!
+ */
+int usr_sqlite_query_all(qd_context* ctx);
+
+/**
+ * Free a result from query_all.
+ * Stack: (result:ptr -- )
+ */
+int usr_sqlite_result_free(qd_context* ctx);
+
+/**
+ * Get result dimensions and column names.
+ * Stack: (result:ptr -- rows:i64), (result:ptr -- cols:i64), (col:i64 result:ptr -- name:str)
+ */
+int usr_sqlite_result_rows(qd_context* ctx);
+int usr_sqlite_result_cols(qd_context* ctx);
+int usr_sqlite_result_column_name(qd_context* ctx);
+
+/**
+ * Get result cell values.
+ * Stack: (row:i64 col:i64 result:ptr -- value)
+ */
+int usr_sqlite_result_type(qd_context* ctx);
+int usr_sqlite_result_int(qd_context* ctx);
+int usr_sqlite_result_float(qd_context* ctx);
+int usr_sqlite_result_text(qd_context* ctx);
+int usr_sqlite_result_text_view(qd_context* ctx);
+
+/**
+ * Register vec_dot, vec_l2, vec_cosine, vec_norm, vec_dims, vec_sum and
+ * vec_avg on a connection. Vectors are BLOBs of float32 values.
+ * Stack: (db:ptr -- )!
+ */
+int usr_sqlite_vector_functions(qd_context* ctx);
+
+/**
+ * Register native SQL functions from C entry points with sqlite3's
+ * xFunc, xStep, xFinal, xValue and xInverse signatures.
+ * Stack: (name:str nargs:i64 flags:i64 func:ptr db:ptr -- )!
+ *        (name:str nargs:i64 flags:i64 step:ptr final:ptr db:ptr -- )!
+ *        (name:str nargs:i64 flags:i64 step:ptr final:ptr value:ptr inverse:ptr db:ptr -- )!
+ */
+int usr_sqlite_create_function(qd_context* ctx);
+int usr_sqlite_create_aggregate(qd_context* ctx);
+int usr_sqlite_create_window(qd_context* ctx);
+
+/**
+ * Find the k rows of table whose float32 vector column is closest to a
+ * query vector. Results are a two-column batch of rowid and score, best
+ * first.
+ * Stack: (query:ptr len:i64 k:i64 metric:i64 table:str column:str db:ptr -- batch:ptr rows:i64)!
+ */
+int usr_sqlite_knn(qd_context* ctx);
+
+/**
+ * Start a cursor whose producer thread steps stmt ahead into a ring of
+ * depth batches of chunk rows.
+ * Stack: (chunk:i64 depth:i64 stmt:ptr -- cursor:ptr)!
+ */
+int usr_sqlite_cursor_open(qd_context* ctx);
+
+/**
+ * Take the next batch; it stays valid until the next cursor_next or
+ * cursor_close. 0 rows when the result is exhausted.
+ * Stack: (cursor:ptr -- batch:ptr rows:i64)!
+ */
+int usr_sqlite_cursor_next(qd_context* ctx);
+
+/**
+ * Stop the producer and free the cursor and its batches.
+ * Stack: (cursor:ptr -- )
+ */
+int usr_sqlite_cursor_close(qd_context* ctx);
+
+/**
+ * Run sql, which must take the inclusive key bounds ?1 and ?2, once per
+ * partition of partition_col's range in table, each on its own
+ * read-only connection to db_path.
+ * Stack: (sql:str table:str partition_col:str workers:i64 db_path:str -- handle:ptr)!
+ */
+int usr_sqlite_parallel_scan(qd_context* ctx);
+
+/**
+ * Take the next batch from whichever partition has one ready; the
+ * caller frees it with batch_free. 0 rows when every partition is done.
+ * Stack: (handle:ptr -- batch:ptr rows:i64)!
+ */
+int usr_sqlite_parallel_next(qd_context* ctx);
+
+/**
+ * Cancel running partitions and free the scan and its connections.
+ * Stack: (handle:ptr -- )
+ */
+int usr_sqlite_parallel_free(qd_context* ctx);
+
+/**
+ * Configure SQLite before the first connection is opened: a preallocated
+ * page cache slab, default lookaside size, native sqlite3_mem_methods
+ * and global memory statistics.
+ * Stack: (page_size:i64 pages:i64 -- )!, (slot_size:i64 slots:i64 -- )!,
+ *        (methods:ptr -- )!, (enabled:i64 -- )!
+ */
+int usr_sqlite_config_pagecache(qd_context* ctx);
+int usr_sqlite_config_lookaside(qd_context* ctx);
+int usr_sqlite_config_malloc(qd_context* ctx);
+int usr_sqlite_config_memstatus(qd_context* ctx);
+
+/**
+ * Resize a connection's lookaside allocator.
+ * Stack: (slot_size:i64 slots:i64 db:ptr -- )!
+ */
+int usr_sqlite_db_lookaside(qd_context* ctx);
+
+/**
+ * Set the soft or hard heap limit in bytes (0 for none, negative to
+ * query); returns the previous limit.
+ * Stack: (bytes:i64 -- previous:i64)
+ */
+int usr_sqlite_soft_heap_limit(qd_context* ctx);
+int usr_sqlite_hard_heap_limit(qd_context* ctx);
+
+/**
+ * Get bytes currently allocated by SQLite and the high-water mark.
+ * Stack: (reset:i64 -- current:i64 highwater:i64)
+ */
+int usr_sqlite_memory_used(qd_context* ctx);
+
+/**
+ * Reset a statement keeping its bindings, bind one parameter and step.
+ * Stack: (value index:i64 stmt:ptr -- has_row:i64)!
+ */
+int usr_sqlite_rebind_step_int(qd_context* ctx);
+int usr_sqlite_rebind_step_float(qd_context* ctx);
+int usr_sqlite_rebind_step_text(qd_context* ctx);
+
+/**
+ * Reset a statement, bind the first row of params to parameters
+ * 1..ncols (others keep their values) and step.
+ * Stack: (params:ptr stmt:ptr -- has_row:i64)!
+ */
+int usr_sqlite_rebind_step(qd_context* ctx);
+
+/**
+ * Build "file:NAME?mode=memory&cache=shared" for a named shared in-memory database.
+ * Stack: (name:str -- uri:str)!
+ */
+int usr_sqlite_shared_memory_uri(qd_context* ctx);
+
+/**
+ * Open a named in-memory database shared by every connection using the name.
+ * Stack: (name:str -- db:ptr)!
+ */
+int usr_sqlite_open_shared_memory(qd_context* ctx);
+
+/**
+ * Attach a database file or URI under an alias.
+ * Stack: (path:str alias:str db:ptr -- )!
+ */
+int usr_sqlite_attach(qd_context* ctx);
+
+/**
+ * Detach an attached database.
+ * Stack: (alias:str db:ptr -- )!
+ */
+int usr_sqlite_detach(qd_context* ctx);
+
+/**
+ * Check whether an alias names an attached database.
+ * Stack: (alias:str db:ptr -- attached:i64)
+ */
+int usr_sqlite_attached(qd_context* ctx);
+
+/**
+ * Attach a database to every connection in a pool once all are idle.
+ * Stack: (path:str alias:str pool:ptr -- )!
+ */
+int usr_sqlite_pool_attach(qd_context* ctx);
+
+/**
+ * Detach a database from every connection in a pool once all are idle.
+ * Stack: (alias:str pool:ptr -- )!
+ */
+int usr_sqlite_pool_detach(qd_context* ctx);
+
+/**
+ * Install update/commit/rollback/WAL hooks feeding a ring of change events.
+ * Stack: (capacity:i64 db:ptr -- )!
+ */
+int usr_sqlite_change_feed_start(qd_context* ctx);
+
+/**
+ * Remove the change hooks and discard undrained events.
+ * Stack: (db:ptr -- )
+ */
+int usr_sqlite_change_feed_stop(qd_context* ctx);
+
+/**
+ * Move up to max change events into a new batch (kind, schema, table, value).
+ * Stack: (max:i64 db:ptr -- batch:ptr rows:i64)!
+ */
+int usr_sqlite_change_feed_drain(qd_context* ctx);
+
+/**
+ * Number of change events lost to a full ring since the last call.
+ * Stack: (db:ptr -- dropped:i64)
+ */
+int usr_sqlite_change_feed_dropped(qd_context* ctx);
+
+/**
+ * Checkpoint the WAL of one schema, or every attached one with "".
+ * Stack: (mode:i64 schema:str db:ptr -- log_frames:i64 checkpointed:i64)!
+ */
+int usr_sqlite_wal_checkpoint(qd_context* ctx);
+
+/**
+ * Set the WAL size in pages that triggers a checkpoint on commit (0 disables).
+ * Stack: (pages:i64 db:ptr -- )!
+ */
+int usr_sqlite_wal_autocheckpoint(qd_context* ctx);
+
+/**
+ * Checkpoint from a background thread on its own connection, after pages
+ * new WAL frames or idle_ms without commits.
+ * Stack: (mode:i64 pages:i64 idle_ms:i64 db:ptr -- )!
+ */
+int usr_sqlite_checkpointer_start(qd_context* ctx);
+
+/**
+ * Stop the background checkpointer and restore auto-checkpoint.
+ * Stack: (db:ptr -- )
+ */
+int usr_sqlite_checkpointer_stop(qd_context* ctx);
+
+/**
+ * Background checkpoint counters and the frame counts of the last run.
+ * Stack: (db:ptr -- runs:i64 busy:i64 log_frames:i64 checkpointed:i64)
+ */
+int usr_sqlite_checkpointer_stats(qd_context* ctx);
+
 #ifdef __cplusplus
 }
 #endif
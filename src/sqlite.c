@@ -8,10 +8,21 @@
 #include <qdrt/qd_string.h>
 #include <qdrt/runtime.h>
 #include <qdrt/stack.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
 #include <sqlite3.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 
 /* Error codes matching module.qd */
 #define SQLITE_ERR_OK 1
@@ -21,6 +32,9 @@
 #define SQLITE_ERR_BIND 5
 #define SQLITE_ERR_STEP 6
 #define SQLITE_ERR_INVALID_ARG 7
+#define SQLITE_ERR_BLOB 8
+#define SQLITE_ERR_BUSY 9
+#define SQLITE_ERR_LOCKED 10
 
 /** Helper to safely set error message */
 static void set_error_msg(qd_context* ctx, const char* msg) {
@@ -28,15 +42,387 @@ static void set_error_msg(qd_context* ctx, const char* msg) {
 	ctx->error_msg = strdup(msg);
 }
 
-/** Helper to set error with SQLite message */
-static void set_sqlite_error(qd_context* ctx, const char* prefix, sqlite3* db) {
+/** Helper to set "prefix: message"; message may be NULL, e.g. after a failed strdup */
+static void set_prefixed_error(qd_context* ctx, const char* prefix, const char* message) {
 	if (ctx->error_msg) free(ctx->error_msg);
-	const char* sqlite_msg = db ? sqlite3_errmsg(db) : "unknown error";
-	size_t len = strlen(prefix) + strlen(sqlite_msg) + 3;
+	if (!message) message = "failed";
+	size_t len = strlen(prefix) + strlen(message) + 3;
 	ctx->error_msg = malloc(len);
 	if (ctx->error_msg) {
-		snprintf(ctx->error_msg, len, "%s: %s", prefix, sqlite_msg);
+		snprintf(ctx->error_msg, len, "%s: %s", prefix, message);
+	}
+}
+
+/** Helper to set error with SQLite message */
+static void set_sqlite_error(qd_context* ctx, const char* prefix, sqlite3* db) {
+	set_prefixed_error(ctx, prefix, db ? sqlite3_errmsg(db) : "unknown error");
+}
+
+/* ------------------------------------------------------------------------
+ * Connection and statement handles
+ *
+ * open returns a qdsqlite_db wrapping the sqlite3 connection, prepare
+ * returns a qdsqlite_stmt wrapping the sqlite3_stmt. The wrappers carry
+ * per-connection and per-statement driver state such as the statement
+ * cache. A connection and its statements must be used by one thread at
+ * a time.
+ * ------------------------------------------------------------------------ */
+
+/** Transaction control statements held on every connection */
+enum {
+	TX_BEGIN,
+	TX_BEGIN_IMMEDIATE,
+	TX_BEGIN_EXCLUSIVE,
+	TX_COMMIT,
+	TX_ROLLBACK,
+	TX_SAVEPOINT,
+	TX_RELEASE,
+	TX_ROLLBACK_TO,
+	TX_COUNT
+};
+
+static const char* const tx_sql[TX_COUNT] = {
+	"BEGIN",
+	"BEGIN IMMEDIATE",
+	"BEGIN EXCLUSIVE",
+	"COMMIT",
+	"ROLLBACK",
+	"SAVEPOINT qd_op",
+	"RELEASE qd_op",
+	"ROLLBACK TO qd_op",
+};
+
+/** Default number of idle statements kept in a connection's cache */
+#define SQLITE_STMT_CACHE_DEFAULT 16
+
+typedef struct qdsqlite_stmt qdsqlite_stmt;
+
+typedef struct qdsqlite_db {
+	sqlite3* handle;
+
+	/* Statement cache: idle statements keyed by SQL text, in LRU order */
+	qdsqlite_stmt** buckets;
+	size_t nbuckets;
+	qdsqlite_stmt* lru_head;  /* most recently released */
+	qdsqlite_stmt* lru_tail;  /* next to be evicted */
+	size_t cache_size;
+	size_t cache_capacity;
+	int64_t cache_hits;
+	int64_t cache_misses;
+	int64_t cache_evictions;
+
+	/* Busy backoff (set_busy_backoff); delays in milliseconds */
+	int busy_base_ms;
+	int busy_max_ms;
+	int busy_max_retries;
+	uint32_t busy_rng;
+
+	/* Profiling: step wall time (set_step_timing) and slow statement log */
+	int step_timing;
+	int64_t slow_threshold_ns;
+	struct slow_entry* slow_log;
+	int slow_head;   /* next slot to write */
+	int slow_count;
+
+	/* Transaction control statements, prepared on first use (tx_run) */
+	sqlite3_stmt* tx_stmts[TX_COUNT];
+
+	/* Change feed (change_feed_start); NULL when no hooks are installed */
+	struct change_feed* feed;
+
+	/* Background checkpointer (checkpointer_start) */
+	struct checkpointer* checkpointer;
+
+	/* Set while the driver's WAL hook replaces SQLite's auto-checkpoint,
+	 * which then runs at autocheckpoint pages unless a checkpointer does */
+	int wal_hooked;
+	int autocheckpoint;
+} qdsqlite_db;
+
+/** Number of slow statements kept per connection */
+#define SQLITE_SLOW_LOG_SIZE 256
+
+typedef struct slow_entry {
+	char* sql;
+	int64_t elapsed_ns;
+} slow_entry;
+
+struct qdsqlite_stmt {
+	sqlite3_stmt* handle;
+	qdsqlite_db* db;
+
+	/* Cache key; NULL until the statement is first released */
+	char* sql;
+	size_t sql_len;
+	uint64_t hash;
+	qdsqlite_stmt* bucket_next;
+	qdsqlite_stmt* lru_prev;
+	qdsqlite_stmt* lru_next;
+
+	/* Set when a batch fetch ran the statement to SQLITE_DONE, so the
+	 * next fetch does not step into SQLite's automatic reset */
+	int exhausted;
+
+	/* Wall time spent in sqlite3_step while step timing is enabled */
+	int64_t step_ns;
+	int64_t steps;
+
+	/* Column metadata, built on first use by stmt_meta_get and rebuilt after a re-prepare */
+	struct stmt_meta* meta;
+
+	/* Named parameter index, built on first use by param_lookup */
+	int* param_slots;  /* open addressing: parameter index, 0 if empty */
+	size_t param_nslots;
+};
+
+/** Result column metadata snapshot with a case-insensitive name index */
+typedef struct stmt_meta {
+	int ncols;
+	int reprepares;  /* SQLITE_STMTSTATUS_REPREPARE when built */
+	qd_string_t** names;
+	qd_string_t** decltypes;
+	qd_string_t** tables;
+	qd_string_t** origins;
+	int* slots;  /* open addressing: column + 1, 0 if empty */
+	size_t nslots;
+} stmt_meta;
+
+/** FNV-1a hash, used for SQL cache keys and text views */
+static uint64_t hash_bytes(const char* data, size_t len) {
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; i++) {
+		h ^= (unsigned char)data[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+/** Smallest power of two bucket count that keeps chains short */
+static size_t cache_bucket_count(size_t capacity) {
+	size_t n = 16;
+	while (n < capacity * 2) n <<= 1;
+	return n;
+}
+
+/** Monotonic clock in nanoseconds */
+static int64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Map a failed result code to a driver error code.
+ * Busy and locked get their own codes so callers can retry the same
+ * statement instead of treating contention as a hard failure.
+ */
+static int error_code_for(int rc, int fallback) {
+	switch (rc & 0xff) {
+	case SQLITE_BUSY:
+		return SQLITE_ERR_BUSY;
+	case SQLITE_LOCKED:
+		return SQLITE_ERR_LOCKED;
+	default:
+		return fallback;
+	}
+}
+
+static qdsqlite_db* db_wrap(sqlite3* handle) {
+	qdsqlite_db* conn = calloc(1, sizeof(qdsqlite_db));
+	if (!conn) return NULL;
+
+	conn->handle = handle;
+	conn->cache_capacity = SQLITE_STMT_CACHE_DEFAULT;
+	conn->nbuckets = cache_bucket_count(conn->cache_capacity);
+	conn->buckets = calloc(conn->nbuckets, sizeof(qdsqlite_stmt*));
+	if (!conn->buckets) {
+		free(conn);
+		return NULL;
+	}
+	return conn;
+}
+
+static qdsqlite_stmt* stmt_wrap(sqlite3_stmt* handle, qdsqlite_db* conn) {
+	qdsqlite_stmt* s = calloc(1, sizeof(qdsqlite_stmt));
+	if (!s) return NULL;
+
+	s->handle = handle;
+	s->db = conn;
+	return s;
+}
+
+static void stmt_meta_free(stmt_meta* m) {
+	if (!m) return;
+	for (int i = 0; i < m->ncols; i++) {
+		if (m->names[i]) qd_string_release(m->names[i]);
+		if (m->decltypes[i]) qd_string_release(m->decltypes[i]);
+		if (m->tables[i]) qd_string_release(m->tables[i]);
+		if (m->origins[i]) qd_string_release(m->origins[i]);
+	}
+	free(m->names);
+	free(m->slots);
+	free(m);
+}
+
+static void stmt_destroy(qdsqlite_stmt* s) {
+	stmt_meta_free(s->meta);
+	free(s->param_slots);
+	sqlite3_finalize(s->handle);
+	free(s->sql);
+	free(s);
+}
+
+/** Remove an idle statement from the cache without finalizing it */
+static void cache_unlink(qdsqlite_db* conn, qdsqlite_stmt* s) {
+	qdsqlite_stmt** link = &conn->buckets[s->hash & (conn->nbuckets - 1)];
+	while (*link != s) link = &(*link)->bucket_next;
+	*link = s->bucket_next;
+	s->bucket_next = NULL;
+
+	if (s->lru_prev) s->lru_prev->lru_next = s->lru_next;
+	else conn->lru_head = s->lru_next;
+	if (s->lru_next) s->lru_next->lru_prev = s->lru_prev;
+	else conn->lru_tail = s->lru_prev;
+	s->lru_prev = NULL;
+	s->lru_next = NULL;
+
+	conn->cache_size--;
+}
+
+/** Finalize least recently used statements until the cache fits */
+static void cache_trim(qdsqlite_db* conn, size_t capacity) {
+	while (conn->cache_size > capacity) {
+		qdsqlite_stmt* victim = conn->lru_tail;
+		cache_unlink(conn, victim);
+		stmt_destroy(victim);
+		conn->cache_evictions++;
+	}
+}
+
+/** Take an idle statement for this SQL out of the cache, or NULL */
+static qdsqlite_stmt* cache_take(qdsqlite_db* conn, const char* sql, size_t len) {
+	uint64_t hash = hash_bytes(sql, len);
+	qdsqlite_stmt* s = conn->buckets[hash & (conn->nbuckets - 1)];
+	while (s) {
+		if (s->hash == hash && s->sql_len == len && memcmp(s->sql, sql, len) == 0) {
+			cache_unlink(conn, s);
+			return s;
+		}
+		s = s->bucket_next;
+	}
+	return NULL;
+}
+
+/** Add a reset statement to the cache as most recently used */
+static void cache_put(qdsqlite_db* conn, qdsqlite_stmt* s) {
+	qdsqlite_stmt** bucket = &conn->buckets[s->hash & (conn->nbuckets - 1)];
+	s->bucket_next = *bucket;
+	*bucket = s;
+
+	s->lru_prev = NULL;
+	s->lru_next = conn->lru_head;
+	if (conn->lru_head) conn->lru_head->lru_prev = s;
+	conn->lru_head = s;
+	if (!conn->lru_tail) conn->lru_tail = s;
+
+	conn->cache_size++;
+	cache_trim(conn, conn->cache_capacity);
+}
+
+/**
+ * Run a transaction control statement from the connection's prepared copy.
+ * Returns SQLITE_OK or the failing result code; sqlite3_errmsg holds the
+ * message.
+ */
+static int tx_run(qdsqlite_db* conn, int op) {
+	sqlite3_stmt** stmt = &conn->tx_stmts[op];
+	if (!*stmt) {
+		int rc = sqlite3_prepare_v2(conn->handle, tx_sql[op], -1, stmt, NULL);
+		if (rc != SQLITE_OK) return rc;
+	}
+
+	int rc = sqlite3_step(*stmt);
+	sqlite3_reset(*stmt);
+	return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+/**
+ * Take the statement for sql from the connection's cache, or prepare it
+ * keyed for cache_return. Returns an SQLite result code.
+ */
+static int cache_prepare(qdsqlite_db* conn, const char* sql, size_t len, qdsqlite_stmt** out) {
+	qdsqlite_stmt* s = cache_take(conn, sql, len);
+	if (s) {
+		conn->cache_hits++;
+		*out = s;
+		return SQLITE_OK;
+	}
+	conn->cache_misses++;
+
+	sqlite3_stmt* stmt = NULL;
+	int rc = sqlite3_prepare_v2(conn->handle, sql, (int)len, &stmt, NULL);
+	if (rc != SQLITE_OK) return rc;
+
+	s = stmt_wrap(stmt, conn);
+	char* copy = malloc(len + 1);
+	if (!s || !copy) {
+		free(s);
+		free(copy);
+		sqlite3_finalize(stmt);
+		return SQLITE_NOMEM;
+	}
+	memcpy(copy, sql, len);
+	copy[len] = '\0';
+	s->sql = copy;
+	s->sql_len = len;
+	s->hash = hash_bytes(sql, len);
+	*out = s;
+	return SQLITE_OK;
+}
+
+/** Give back a statement from cache_prepare, finalizing it if caching is off */
+static void cache_return(qdsqlite_db* conn, qdsqlite_stmt* s) {
+	if (conn->cache_capacity == 0) {
+		stmt_destroy(s);
+		return;
+	}
+	s->exhausted = 0;
+	sqlite3_reset(s->handle);
+	sqlite3_clear_bindings(s->handle);
+	cache_put(conn, s);
+}
+
+static void change_feed_destroy(struct change_feed* feed);
+static void checkpointer_stop(qdsqlite_db* conn);
+static void wal_hook_refresh(qdsqlite_db* conn);
+
+static void db_destroy(qdsqlite_db* conn) {
+	checkpointer_stop(conn);
+	for (int i = 0; i < TX_COUNT; i++) sqlite3_finalize(conn->tx_stmts[i]);
+	while (conn->lru_head) {
+		qdsqlite_stmt* s = conn->lru_head;
+		cache_unlink(conn, s);
+		stmt_destroy(s);
 	}
+	free(conn->buckets);
+	if (conn->slow_log) {
+		for (int i = 0; i < SQLITE_SLOW_LOG_SIZE; i++) free(conn->slow_log[i].sql);
+		free(conn->slow_log);
+	}
+	sqlite3_close(conn->handle);
+	if (conn->feed) change_feed_destroy(conn->feed);
+	free(conn);
+}
+
+/** sqlite3_step, accumulating wall time on the statement when enabled */
+static int stmt_step(qdsqlite_stmt* s) {
+	if (!s->db->step_timing) return sqlite3_step(s->handle);
+
+	int64_t start = now_ns();
+	int rc = sqlite3_step(s->handle);
+	s->step_ns += now_ns() - start;
+	s->steps++;
+	return rc;
 }
 
 /**
@@ -66,7 +452,278 @@ int usr_sqlite_open(qd_context* ctx) {
 		return (int){SQLITE_ERR_OPEN};
 	}
 
-	qd_push_p(ctx, db);
+	qdsqlite_db* conn = db_wrap(db);
+	if (!conn) {
+		set_error_msg(ctx, "sqlite::open: out of memory");
+		ctx->error_code = SQLITE_ERR_OPEN;
+		sqlite3_close(db);
+		return (int){SQLITE_ERR_OPEN};
+	}
+
+	qd_push_p(ctx, conn);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Extended open and connection presets
+ * ------------------------------------------------------------------------ */
+
+/** Connection tuning applied by name after open */
+typedef struct qdsqlite_preset {
+	const char* name;
+	const char* journal_mode;  /* NULL leaves the journal mode alone */
+	const char* synchronous;
+	int64_t mmap_size;         /* bytes */
+	int64_t cache_size;        /* pages if positive, KiB if negative */
+	const char* temp_store;
+	int query_only;
+} qdsqlite_preset;
+
+static const qdsqlite_preset presets[] = {
+	/* WAL with relaxed sync: durable across app crashes, fast commits */
+	{"throughput", "WAL", "NORMAL", 268435456, -65536, "MEMORY", 0},
+	/* WAL with fsync on every commit */
+	{"durable", "WAL", "FULL", 0, -16384, "DEFAULT", 0},
+	/* Read replicas: large mmap and cache, writes rejected */
+	{"readonly", NULL, NULL, 268435456, -65536, "MEMORY", 1},
+	/* SQLite defaults */
+	{"default", NULL, NULL, 0, -2000, "DEFAULT", 0},
+};
+
+static const qdsqlite_preset* find_preset(const char* name) {
+	for (size_t i = 0; i < sizeof(presets) / sizeof(presets[0]); i++) {
+		if (strcmp(presets[i].name, name) == 0) return &presets[i];
+	}
+	return NULL;
+}
+
+/** Apply a preset's pragmas in one exec; journal settings are skipped on read-only connections */
+static int apply_preset(sqlite3* db, const qdsqlite_preset* preset, char** errmsg) {
+	char sql[512];
+	int writable = sqlite3_db_readonly(db, "main") == 0;
+	int n = 0;
+
+	if (preset->journal_mode && writable) {
+		n += snprintf(sql + n, sizeof(sql) - (size_t)n, "PRAGMA journal_mode=%s;", preset->journal_mode);
+	}
+	if (preset->synchronous && writable) {
+		n += snprintf(sql + n, sizeof(sql) - (size_t)n, "PRAGMA synchronous=%s;", preset->synchronous);
+	}
+	n += snprintf(sql + n, sizeof(sql) - (size_t)n,
+		"PRAGMA mmap_size=%lld;PRAGMA cache_size=%lld;PRAGMA temp_store=%s;PRAGMA query_only=%d;",
+		(long long)preset->mmap_size, (long long)preset->cache_size, preset->temp_store, preset->query_only);
+
+	return sqlite3_exec(db, sql, NULL, NULL, errmsg);
+}
+
+/** Set error from an exec errmsg, freeing it */
+static void set_exec_error(qd_context* ctx, const char* prefix, char* errmsg) {
+	if (ctx->error_msg) free(ctx->error_msg);
+	const char* msg = errmsg ? errmsg : "failed";
+	size_t len = strlen(prefix) + strlen(msg) + 3;
+	ctx->error_msg = malloc(len);
+	if (ctx->error_msg) {
+		snprintf(ctx->error_msg, len, "%s: %s", prefix, msg);
+	}
+	if (errmsg) sqlite3_free(errmsg);
+}
+
+/**
+ * Open a connection with sqlite3_open_v2 and optionally apply a preset.
+ * Returns 0 with *out set, or the error code after setting the error.
+ */
+static int open_handle(qd_context* ctx, const char* prefix, const char* path, int flags,
+	const char* vfs, const qdsqlite_preset* preset, qdsqlite_db** out) {
+	sqlite3* db = NULL;
+	int rc = sqlite3_open_v2(path, &db, flags, vfs && vfs[0] ? vfs : NULL);
+
+	if (rc != SQLITE_OK) {
+		set_sqlite_error(ctx, prefix, db);
+		ctx->error_code = SQLITE_ERR_OPEN;
+		if (db) sqlite3_close(db);
+		return (int){SQLITE_ERR_OPEN};
+	}
+
+	if (preset) {
+		char* errmsg = NULL;
+		if (apply_preset(db, preset, &errmsg) != SQLITE_OK) {
+			set_exec_error(ctx, prefix, errmsg);
+			ctx->error_code = SQLITE_ERR_EXEC;
+			sqlite3_close(db);
+			return (int){SQLITE_ERR_EXEC};
+		}
+	}
+
+	qdsqlite_db* conn = db_wrap(db);
+	if (!conn) {
+		char msg[96];
+		snprintf(msg, sizeof(msg), "%s: out of memory", prefix);
+		set_error_msg(ctx, msg);
+		ctx->error_code = SQLITE_ERR_OPEN;
+		sqlite3_close(db);
+		return (int){SQLITE_ERR_OPEN};
+	}
+
+	*out = conn;
+	return 0;
+}
+
+/** open_handle, pushing the wrapped handle on success */
+static int open_connection(qd_context* ctx, const char* prefix, const char* path, int flags,
+	const char* vfs, const qdsqlite_preset* preset) {
+	qdsqlite_db* conn = NULL;
+	int code = open_handle(ctx, prefix, path, flags, vfs, preset, &conn);
+	if (code) return code;
+
+	qd_push_p(ctx, conn);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * open_v2 - Open SQLite database with flags
+ * Stack: (path:str flags:i64 -- db:ptr)!
+ */
+int usr_sqlite_open_v2(qd_context* ctx) {
+	qd_stack_element_t flags_elem, path_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &flags_elem);
+	if (err != QD_STACK_OK || flags_elem.type != QD_STACK_TYPE_INT) {
+		set_error_msg(ctx, "sqlite::open_v2: expected integer flags");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &path_elem);
+	if (err != QD_STACK_OK || path_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::open_v2: expected string path");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	int rc = open_connection(ctx, "sqlite::open_v2", qd_string_data(path_elem.value.s),
+		(int)flags_elem.value.i, NULL, NULL);
+	qd_string_release(path_elem.value.s);
+	return rc;
+}
+
+/**
+ * open_vfs - Open SQLite database with flags and a named VFS
+ * Stack: (path:str flags:i64 vfs:str -- db:ptr)!
+ */
+int usr_sqlite_open_vfs(qd_context* ctx) {
+	qd_stack_element_t vfs_elem, flags_elem, path_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &vfs_elem);
+	if (err != QD_STACK_OK || vfs_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::open_vfs: expected VFS name");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &flags_elem);
+	if (err != QD_STACK_OK || flags_elem.type != QD_STACK_TYPE_INT) {
+		qd_string_release(vfs_elem.value.s);
+		set_error_msg(ctx, "sqlite::open_vfs: expected integer flags");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &path_elem);
+	if (err != QD_STACK_OK || path_elem.type != QD_STACK_TYPE_STR) {
+		qd_string_release(vfs_elem.value.s);
+		set_error_msg(ctx, "sqlite::open_vfs: expected string path");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	int rc = open_connection(ctx, "sqlite::open_vfs", qd_string_data(path_elem.value.s),
+		(int)flags_elem.value.i, qd_string_data(vfs_elem.value.s), NULL);
+	qd_string_release(path_elem.value.s);
+	qd_string_release(vfs_elem.value.s);
+	return rc;
+}
+
+/**
+ * open_preset - Open SQLite database with flags and apply a tuning preset
+ * Stack: (path:str flags:i64 preset:str -- db:ptr)!
+ */
+int usr_sqlite_open_preset(qd_context* ctx) {
+	qd_stack_element_t preset_elem, flags_elem, path_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &preset_elem);
+	if (err != QD_STACK_OK || preset_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::open_preset: expected preset name");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	const qdsqlite_preset* preset = find_preset(qd_string_data(preset_elem.value.s));
+	qd_string_release(preset_elem.value.s);
+	if (!preset) {
+		set_error_msg(ctx, "sqlite::open_preset: unknown preset");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &flags_elem);
+	if (err != QD_STACK_OK || flags_elem.type != QD_STACK_TYPE_INT) {
+		set_error_msg(ctx, "sqlite::open_preset: expected integer flags");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &path_elem);
+	if (err != QD_STACK_OK || path_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::open_preset: expected string path");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	int rc = open_connection(ctx, "sqlite::open_preset", qd_string_data(path_elem.value.s),
+		(int)flags_elem.value.i, NULL, preset);
+	qd_string_release(path_elem.value.s);
+	return rc;
+}
+
+/**
+ * apply_preset - Apply a tuning preset to an open connection
+ * Stack: (preset:str db:ptr -- )!
+ */
+int usr_sqlite_apply_preset(qd_context* ctx) {
+	qd_stack_element_t db_elem, preset_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::apply_preset: expected database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &preset_elem);
+	if (err != QD_STACK_OK || preset_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::apply_preset: expected preset name");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	const qdsqlite_preset* preset = find_preset(qd_string_data(preset_elem.value.s));
+	qd_string_release(preset_elem.value.s);
+	if (!preset) {
+		set_error_msg(ctx, "sqlite::apply_preset: unknown preset");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	sqlite3* db = ((qdsqlite_db*)db_elem.value.p)->handle;
+	char* errmsg = NULL;
+	if (apply_preset(db, preset, &errmsg) != SQLITE_OK) {
+		set_exec_error(ctx, "sqlite::apply_preset", errmsg);
+		ctx->error_code = SQLITE_ERR_EXEC;
+		return (int){SQLITE_ERR_EXEC};
+	}
+
 	qd_push_i(ctx, SQLITE_ERR_OK);
 	return 0;
 }
@@ -84,9 +741,9 @@ int usr_sqlite_close(qd_context* ctx) {
 		return 0;
 	}
 
-	sqlite3* db = (sqlite3*)db_elem.value.p;
-	if (db) {
-		sqlite3_close(db);
+	qdsqlite_db* conn = (qdsqlite_db*)db_elem.value.p;
+	if (conn) {
+		db_destroy(conn);
 	}
 
 	return 0;
@@ -113,7 +770,7 @@ int usr_sqlite_exec(qd_context* ctx) {
 		return (int){SQLITE_ERR_INVALID_ARG};
 	}
 
-	sqlite3* db = (sqlite3*)db_elem.value.p;
+	sqlite3* db = ((qdsqlite_db*)db_elem.value.p)->handle;
 	const char* sql = qd_string_data(sql_elem.value.s);
 
 	char* errmsg = NULL;
@@ -132,8 +789,9 @@ int usr_sqlite_exec(qd_context* ctx) {
 		} else {
 			ctx->error_msg = strdup("sqlite::exec: execution failed");
 		}
-		ctx->error_code = SQLITE_ERR_EXEC;
-		return (int){SQLITE_ERR_EXEC};
+		int code = error_code_for(rc, SQLITE_ERR_EXEC);
+		ctx->error_code = code;
+		return code;
 	}
 
 	qd_push_i(ctx, SQLITE_ERR_OK);
@@ -161,53 +819,146 @@ int usr_sqlite_prepare(qd_context* ctx) {
 		return (int){SQLITE_ERR_INVALID_ARG};
 	}
 
-	sqlite3* db = (sqlite3*)db_elem.value.p;
+	qdsqlite_db* conn = (qdsqlite_db*)db_elem.value.p;
 	const char* sql = qd_string_data(sql_elem.value.s);
 
 	sqlite3_stmt* stmt = NULL;
-	int rc = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+	int rc = sqlite3_prepare_v2(conn->handle, sql, -1, &stmt, NULL);
 	qd_string_release(sql_elem.value.s);
 
 	if (rc != SQLITE_OK) {
-		set_sqlite_error(ctx, "sqlite::prepare", db);
+		set_sqlite_error(ctx, "sqlite::prepare", conn->handle);
+		ctx->error_code = SQLITE_ERR_PREPARE;
+		return (int){SQLITE_ERR_PREPARE};
+	}
+
+	qdsqlite_stmt* s = stmt_wrap(stmt, conn);
+	if (!s) {
+		sqlite3_finalize(stmt);
+		set_error_msg(ctx, "sqlite::prepare: out of memory");
 		ctx->error_code = SQLITE_ERR_PREPARE;
 		return (int){SQLITE_ERR_PREPARE};
 	}
 
-	qd_push_p(ctx, stmt);
+	qd_push_p(ctx, s);
 	qd_push_i(ctx, SQLITE_ERR_OK);
 	return 0;
 }
 
 /**
- * bind_text - Bind string parameter
- * Stack: (value:str index:i64 stmt:ptr -- )!
+ * prepare_cached - Prepare a SQL statement through the connection cache
+ * Stack: (sql:str db:ptr -- stmt:ptr)!
  */
-int usr_sqlite_bind_text(qd_context* ctx) {
-	qd_stack_element_t stmt_elem, index_elem, value_elem;
+int usr_sqlite_prepare_cached(qd_context* ctx) {
+	qd_stack_element_t db_elem, sql_elem;
 
-	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
-	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
-		set_error_msg(ctx, "sqlite::bind_text: expected statement pointer");
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::prepare_cached: expected database pointer");
 		ctx->error_code = SQLITE_ERR_INVALID_ARG;
 		return (int){SQLITE_ERR_INVALID_ARG};
 	}
 
-	err = qd_stack_pop(ctx->st, &index_elem);
-	if (err != QD_STACK_OK || index_elem.type != QD_STACK_TYPE_INT) {
-		set_error_msg(ctx, "sqlite::bind_text: expected integer index");
+	err = qd_stack_pop(ctx->st, &sql_elem);
+	if (err != QD_STACK_OK || sql_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::prepare_cached: expected SQL string");
 		ctx->error_code = SQLITE_ERR_INVALID_ARG;
 		return (int){SQLITE_ERR_INVALID_ARG};
 	}
 
-	err = qd_stack_pop(ctx->st, &value_elem);
-	if (err != QD_STACK_OK || value_elem.type != QD_STACK_TYPE_STR) {
-		set_error_msg(ctx, "sqlite::bind_text: expected string value");
-		ctx->error_code = SQLITE_ERR_INVALID_ARG;
-		return (int){SQLITE_ERR_INVALID_ARG};
-	}
+	qdsqlite_db* conn = (qdsqlite_db*)db_elem.value.p;
+	qdsqlite_stmt* s = NULL;
+	int rc = cache_prepare(conn, qd_string_data(sql_elem.value.s), qd_string_length(sql_elem.value.s), &s);
+	qd_string_release(sql_elem.value.s);
+
+	if (rc == SQLITE_NOMEM && sqlite3_errcode(conn->handle) != SQLITE_NOMEM) {
+		set_error_msg(ctx, "sqlite::prepare_cached: out of memory");
+		ctx->error_code = SQLITE_ERR_PREPARE;
+		return (int){SQLITE_ERR_PREPARE};
+	}
+	if (rc != SQLITE_OK) {
+		set_sqlite_error(ctx, "sqlite::prepare_cached", conn->handle);
+		ctx->error_code = SQLITE_ERR_PREPARE;
+		return (int){SQLITE_ERR_PREPARE};
+	}
+
+	qd_push_p(ctx, s);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * release - Return statement to its connection's cache
+ * Stack: (stmt:ptr -- )
+ */
+int usr_sqlite_release(qd_context* ctx) {
+	qd_stack_element_t stmt_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		return 0;
+	}
+
+	qdsqlite_stmt* s = (qdsqlite_stmt*)stmt_elem.value.p;
+	if (!s) return 0;
+
+	qdsqlite_db* conn = s->db;
+	if (conn->cache_capacity == 0) {
+		stmt_destroy(s);
+		return 0;
+	}
+
+	/* Statements from plain prepare are keyed by their original SQL */
+	if (!s->sql) {
+		const char* sql = sqlite3_sql(s->handle);
+		size_t len = sql ? strlen(sql) : 0;
+		s->sql = malloc(len + 1);
+		if (!s->sql) {
+			stmt_destroy(s);
+			return 0;
+		}
+		memcpy(s->sql, sql ? sql : "", len);
+		s->sql[len] = '\0';
+		s->sql_len = len;
+		s->hash = hash_bytes(s->sql, len);
+	}
+
+	s->exhausted = 0;
+	sqlite3_reset(s->handle);
+	sqlite3_clear_bindings(s->handle);
+	cache_put(conn, s);
+	return 0;
+}
+
+/**
+ * bind_text - Bind string parameter
+ * Stack: (value:str index:i64 stmt:ptr -- )!
+ */
+int usr_sqlite_bind_text(qd_context* ctx) {
+	qd_stack_element_t stmt_elem, index_elem, value_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::bind_text: expected statement pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &index_elem);
+	if (err != QD_STACK_OK || index_elem.type != QD_STACK_TYPE_INT) {
+		set_error_msg(ctx, "sqlite::bind_text: expected integer index");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &value_elem);
+	if (err != QD_STACK_OK || value_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::bind_text: expected string value");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
 
-	sqlite3_stmt* stmt = (sqlite3_stmt*)stmt_elem.value.p;
+	sqlite3_stmt* stmt = ((qdsqlite_stmt*)stmt_elem.value.p)->handle;
 	int index = (int)index_elem.value.i;
 	const char* value = qd_string_data(value_elem.value.s);
 	size_t len = qd_string_length(value_elem.value.s);
@@ -253,7 +1004,7 @@ int usr_sqlite_bind_int(qd_context* ctx) {
 		return (int){SQLITE_ERR_INVALID_ARG};
 	}
 
-	sqlite3_stmt* stmt = (sqlite3_stmt*)stmt_elem.value.p;
+	sqlite3_stmt* stmt = ((qdsqlite_stmt*)stmt_elem.value.p)->handle;
 	int index = (int)index_elem.value.i;
 	int64_t value = value_elem.value.i;
 
@@ -297,7 +1048,7 @@ int usr_sqlite_bind_float(qd_context* ctx) {
 		return (int){SQLITE_ERR_INVALID_ARG};
 	}
 
-	sqlite3_stmt* stmt = (sqlite3_stmt*)stmt_elem.value.p;
+	sqlite3_stmt* stmt = ((qdsqlite_stmt*)stmt_elem.value.p)->handle;
 	int index = (int)index_elem.value.i;
 	double value = value_elem.value.f;
 
@@ -334,7 +1085,7 @@ int usr_sqlite_bind_null(qd_context* ctx) {
 		return (int){SQLITE_ERR_INVALID_ARG};
 	}
 
-	sqlite3_stmt* stmt = (sqlite3_stmt*)stmt_elem.value.p;
+	sqlite3_stmt* stmt = ((qdsqlite_stmt*)stmt_elem.value.p)->handle;
 	int index = (int)index_elem.value.i;
 
 	int rc = sqlite3_bind_null(stmt, index);
@@ -349,6 +1100,104 @@ int usr_sqlite_bind_null(qd_context* ctx) {
 	return 0;
 }
 
+/**
+ * bind_blob - Bind BLOB parameter
+ * Stack: (data:ptr len:i64 index:i64 stmt:ptr -- )!
+ */
+int usr_sqlite_bind_blob(qd_context* ctx) {
+	qd_stack_element_t stmt_elem, index_elem, len_elem, data_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::bind_blob: expected statement pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &index_elem);
+	if (err != QD_STACK_OK || index_elem.type != QD_STACK_TYPE_INT) {
+		set_error_msg(ctx, "sqlite::bind_blob: expected integer index");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &len_elem);
+	if (err != QD_STACK_OK || len_elem.type != QD_STACK_TYPE_INT || len_elem.value.i < 0 || len_elem.value.i > INT32_MAX) {
+		set_error_msg(ctx, "sqlite::bind_blob: expected valid length");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &data_elem);
+	if (err != QD_STACK_OK || data_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::bind_blob: expected data pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	sqlite3_stmt* stmt = ((qdsqlite_stmt*)stmt_elem.value.p)->handle;
+	int index = (int)index_elem.value.i;
+	int len = (int)len_elem.value.i;
+	const void* data = data_elem.value.p;
+
+	/* A null pointer would bind SQL NULL; bind an empty blob instead */
+	int rc = data
+		? sqlite3_bind_blob(stmt, index, data, len, SQLITE_TRANSIENT)
+		: sqlite3_bind_zeroblob(stmt, index, 0);
+
+	if (rc != SQLITE_OK) {
+		set_error_msg(ctx, "sqlite::bind_blob: bind failed");
+		ctx->error_code = SQLITE_ERR_BIND;
+		return (int){SQLITE_ERR_BIND};
+	}
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * bind_zeroblob - Bind zero-filled BLOB of given size
+ * Stack: (size:i64 index:i64 stmt:ptr -- )!
+ */
+int usr_sqlite_bind_zeroblob(qd_context* ctx) {
+	qd_stack_element_t stmt_elem, index_elem, size_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::bind_zeroblob: expected statement pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &index_elem);
+	if (err != QD_STACK_OK || index_elem.type != QD_STACK_TYPE_INT) {
+		set_error_msg(ctx, "sqlite::bind_zeroblob: expected integer index");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &size_elem);
+	if (err != QD_STACK_OK || size_elem.type != QD_STACK_TYPE_INT || size_elem.value.i < 0) {
+		set_error_msg(ctx, "sqlite::bind_zeroblob: expected non-negative size");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	sqlite3_stmt* stmt = ((qdsqlite_stmt*)stmt_elem.value.p)->handle;
+	int index = (int)index_elem.value.i;
+
+	int rc = sqlite3_bind_zeroblob64(stmt, index, (sqlite3_uint64)size_elem.value.i);
+
+	if (rc != SQLITE_OK) {
+		set_error_msg(ctx, "sqlite::bind_zeroblob: bind failed");
+		ctx->error_code = SQLITE_ERR_BIND;
+		return (int){SQLITE_ERR_BIND};
+	}
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
 /**
  * step - Execute and step to next row
  * Stack: (stmt:ptr -- has_row:i64)!
@@ -363,8 +1212,9 @@ int usr_sqlite_step(qd_context* ctx) {
 		return (int){SQLITE_ERR_INVALID_ARG};
 	}
 
-	sqlite3_stmt* stmt = (sqlite3_stmt*)stmt_elem.value.p;
-	int rc = sqlite3_step(stmt);
+	qdsqlite_stmt* s = (qdsqlite_stmt*)stmt_elem.value.p;
+	s->exhausted = 0;
+	int rc = stmt_step(s);
 
 	if (rc == SQLITE_ROW) {
 		qd_push_i(ctx, 1);  /* has row */
@@ -375,9 +1225,10 @@ int usr_sqlite_step(qd_context* ctx) {
 		qd_push_i(ctx, SQLITE_ERR_OK);
 		return 0;
 	} else {
-		set_error_msg(ctx, "sqlite::step: execution failed");
-		ctx->error_code = SQLITE_ERR_STEP;
-		return (int){SQLITE_ERR_STEP};
+		set_sqlite_error(ctx, "sqlite::step", sqlite3_db_handle(s->handle));
+		int code = error_code_for(rc, SQLITE_ERR_STEP);
+		ctx->error_code = code;
+		return code;
 	}
 }
 
@@ -395,14 +1246,37 @@ int usr_sqlite_reset(qd_context* ctx) {
 		return (int){SQLITE_ERR_INVALID_ARG};
 	}
 
-	sqlite3_stmt* stmt = (sqlite3_stmt*)stmt_elem.value.p;
-	sqlite3_reset(stmt);
-	sqlite3_clear_bindings(stmt);
+	/* Bindings are kept; sqlite3_reset reports the last failed step, if any */
+	qdsqlite_stmt* s = (qdsqlite_stmt*)stmt_elem.value.p;
+	s->exhausted = 0;
+	int rc = sqlite3_reset(s->handle);
+	if (rc != SQLITE_OK) {
+		set_sqlite_error(ctx, "sqlite::reset", sqlite3_db_handle(s->handle));
+		int code = error_code_for(rc, SQLITE_ERR_STEP);
+		ctx->error_code = code;
+		return code;
+	}
 
 	qd_push_i(ctx, SQLITE_ERR_OK);
 	return 0;
 }
 
+/**
+ * clear_bindings - Set all parameters back to NULL
+ * Stack: (stmt:ptr -- )
+ */
+int usr_sqlite_clear_bindings(qd_context* ctx) {
+	qd_stack_element_t stmt_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		return 0;
+	}
+
+	sqlite3_clear_bindings(((qdsqlite_stmt*)stmt_elem.value.p)->handle);
+	return 0;
+}
+
 /**
  * finalize - Free prepared statement
  * Stack: (stmt:ptr -- )
@@ -415,9 +1289,9 @@ int usr_sqlite_finalize(qd_context* ctx) {
 		return 0;
 	}
 
-	sqlite3_stmt* stmt = (sqlite3_stmt*)stmt_elem.value.p;
-	if (stmt) {
-		sqlite3_finalize(stmt);
+	qdsqlite_stmt* s = (qdsqlite_stmt*)stmt_elem.value.p;
+	if (s) {
+		stmt_destroy(s);
 	}
 
 	return 0;
@@ -436,12 +1310,95 @@ int usr_sqlite_column_count(qd_context* ctx) {
 		return 0;
 	}
 
-	sqlite3_stmt* stmt = (sqlite3_stmt*)stmt_elem.value.p;
+	sqlite3_stmt* stmt = ((qdsqlite_stmt*)stmt_elem.value.p)->handle;
 	int count = sqlite3_column_count(stmt);
 	qd_push_i(ctx, count);
 	return 0;
 }
 
+/** Case-insensitive (ASCII) FNV-1a hash of a column name */
+static uint64_t meta_hash(const char* name, size_t len) {
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = (unsigned char)name[i];
+		if (c >= 'A' && c <= 'Z') c = (unsigned char)(c + 32);
+		h ^= c;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static qd_string_t* meta_string(const char* text) {
+	if (!text) text = "";
+	return qd_string_create_with_length(text, strlen(text));
+}
+
+/**
+ * Get the statement's column metadata, building it on first use. Cached
+ * statements keep it across reuse until a schema change re-prepares them,
+ * which can change the columns. Returns NULL on allocation failure.
+ */
+static stmt_meta* stmt_meta_get(qdsqlite_stmt* s) {
+	sqlite3_stmt* stmt = s->handle;
+	int ncols = sqlite3_column_count(stmt);
+	int reprepares = sqlite3_stmt_status(stmt, SQLITE_STMTSTATUS_REPREPARE, 0);
+	if (s->meta) {
+		if (s->meta->ncols == ncols && s->meta->reprepares == reprepares) return s->meta;
+		stmt_meta_free(s->meta);
+		s->meta = NULL;
+	}
+
+	stmt_meta* m = calloc(1, sizeof(stmt_meta));
+	if (!m) return NULL;
+
+	size_t n = ncols > 0 ? (size_t)ncols : 1;
+	m->nslots = 8;
+	while (m->nslots < 2 * n) m->nslots *= 2;
+	m->names = calloc(4 * n, sizeof(qd_string_t*));
+	m->slots = calloc(m->nslots, sizeof(int));
+	if (!m->names || !m->slots) {
+		free(m->names);
+		free(m->slots);
+		free(m);
+		return NULL;
+	}
+	m->decltypes = m->names + n;
+	m->tables = m->names + 2 * n;
+	m->origins = m->names + 3 * n;
+	m->ncols = ncols;
+	m->reprepares = reprepares;
+
+	for (int i = 0; i < ncols; i++) {
+		m->names[i] = meta_string(sqlite3_column_name(stmt, i));
+		m->decltypes[i] = meta_string(sqlite3_column_decltype(stmt, i));
+		m->tables[i] = meta_string(sqlite3_column_table_name(stmt, i));
+		m->origins[i] = meta_string(sqlite3_column_origin_name(stmt, i));
+		if (!m->names[i] || !m->decltypes[i] || !m->tables[i] || !m->origins[i]) {
+			m->ncols = i + 1;
+			stmt_meta_free(m);
+			return NULL;
+		}
+
+		/* First column wins for duplicate names */
+		const char* name = qd_string_data(m->names[i]);
+		size_t len = qd_string_length(m->names[i]);
+		size_t slot = meta_hash(name, len) & (m->nslots - 1);
+		int dup = 0;
+		while (m->slots[slot]) {
+			qd_string_t* other = m->names[m->slots[slot] - 1];
+			if (qd_string_length(other) == len && sqlite3_strnicmp(qd_string_data(other), name, (int)len) == 0) {
+				dup = 1;
+				break;
+			}
+			slot = (slot + 1) & (m->nslots - 1);
+		}
+		if (!dup) m->slots[slot] = i + 1;
+	}
+
+	s->meta = m;
+	return m;
+}
+
 /**
  * column_name - Get column name
  * Stack: (index:i64 stmt:ptr -- name:str)
@@ -461,11 +1418,13 @@ int usr_sqlite_column_name(qd_context* ctx) {
 		return 0;
 	}
 
-	sqlite3_stmt* stmt = (sqlite3_stmt*)stmt_elem.value.p;
-	int index = (int)index_elem.value.i;
-
-	const char* name = sqlite3_column_name(stmt, index);
-	qd_push_s(ctx, name ? name : "");
+	stmt_meta* m = stmt_meta_get((qdsqlite_stmt*)stmt_elem.value.p);
+	int64_t index = index_elem.value.i;
+	if (m && index >= 0 && index < m->ncols) {
+		qd_push_s_ref(ctx, m->names[index]);
+	} else {
+		qd_push_s(ctx, "");
+	}
 	return 0;
 }
 
@@ -488,7 +1447,7 @@ int usr_sqlite_column_type(qd_context* ctx) {
 		return 0;
 	}
 
-	sqlite3_stmt* stmt = (sqlite3_stmt*)stmt_elem.value.p;
+	sqlite3_stmt* stmt = ((qdsqlite_stmt*)stmt_elem.value.p)->handle;
 	int index = (int)index_elem.value.i;
 
 	int type = sqlite3_column_type(stmt, index);
@@ -515,7 +1474,7 @@ int usr_sqlite_column_int(qd_context* ctx) {
 		return 0;
 	}
 
-	sqlite3_stmt* stmt = (sqlite3_stmt*)stmt_elem.value.p;
+	sqlite3_stmt* stmt = ((qdsqlite_stmt*)stmt_elem.value.p)->handle;
 	int index = (int)index_elem.value.i;
 
 	int64_t value = sqlite3_column_int64(stmt, index);
@@ -542,7 +1501,7 @@ int usr_sqlite_column_float(qd_context* ctx) {
 		return 0;
 	}
 
-	sqlite3_stmt* stmt = (sqlite3_stmt*)stmt_elem.value.p;
+	sqlite3_stmt* stmt = ((qdsqlite_stmt*)stmt_elem.value.p)->handle;
 	int index = (int)index_elem.value.i;
 
 	double value = sqlite3_column_double(stmt, index);
@@ -569,7 +1528,7 @@ int usr_sqlite_column_text(qd_context* ctx) {
 		return 0;
 	}
 
-	sqlite3_stmt* stmt = (sqlite3_stmt*)stmt_elem.value.p;
+	sqlite3_stmt* stmt = ((qdsqlite_stmt*)stmt_elem.value.p)->handle;
 	int index = (int)index_elem.value.i;
 
 	const unsigned char* text = sqlite3_column_text(stmt, index);
@@ -590,6 +1549,81 @@ int usr_sqlite_column_text(qd_context* ctx) {
 	return 0;
 }
 
+/**
+ * column_text_view - Borrow text column without copying
+ * Stack: (index:i64 stmt:ptr -- data:ptr len:i64)
+ */
+int usr_sqlite_column_text_view(qd_context* ctx) {
+	qd_stack_element_t stmt_elem, index_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		qd_push_p(ctx, NULL);
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	err = qd_stack_pop(ctx->st, &index_elem);
+	if (err != QD_STACK_OK || index_elem.type != QD_STACK_TYPE_INT) {
+		qd_push_p(ctx, NULL);
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	sqlite3_stmt* stmt = ((qdsqlite_stmt*)stmt_elem.value.p)->handle;
+	int index = (int)index_elem.value.i;
+
+	/* Points into SQLite's row buffer; valid until the next step/reset/finalize */
+	const unsigned char* text = sqlite3_column_text(stmt, index);
+	int len = sqlite3_column_bytes(stmt, index);
+
+	qd_push_p(ctx, (void*)text);
+	qd_push_i(ctx, text ? len : 0);
+	return 0;
+}
+
+/**
+ * column_blob - Borrow BLOB column without copying
+ * Stack: (index:i64 stmt:ptr -- data:ptr len:i64)
+ */
+int usr_sqlite_column_blob(qd_context* ctx) {
+	qd_stack_element_t stmt_elem, index_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		qd_push_p(ctx, NULL);
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	err = qd_stack_pop(ctx->st, &index_elem);
+	if (err != QD_STACK_OK || index_elem.type != QD_STACK_TYPE_INT) {
+		qd_push_p(ctx, NULL);
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	sqlite3_stmt* stmt = ((qdsqlite_stmt*)stmt_elem.value.p)->handle;
+	int index = (int)index_elem.value.i;
+
+	/* Points into SQLite's row buffer; valid until the next step/reset/finalize */
+	const void* data = sqlite3_column_blob(stmt, index);
+	int len = sqlite3_column_bytes(stmt, index);
+
+	qd_push_p(ctx, (void*)data);
+	qd_push_i(ctx, data ? len : 0);
+	return 0;
+}
+
+/**
+ * monotonic_ns - Read the monotonic clock
+ * Stack: ( -- ns:i64)
+ */
+int usr_sqlite_monotonic_ns(qd_context* ctx) {
+	qd_push_i(ctx, now_ns());
+	return 0;
+}
+
 /**
  * last_insert_rowid - Get last insert rowid
  * Stack: (db:ptr -- rowid:i64)
@@ -603,7 +1637,7 @@ int usr_sqlite_last_insert_rowid(qd_context* ctx) {
 		return 0;
 	}
 
-	sqlite3* db = (sqlite3*)db_elem.value.p;
+	sqlite3* db = ((qdsqlite_db*)db_elem.value.p)->handle;
 	int64_t rowid = sqlite3_last_insert_rowid(db);
 	qd_push_i(ctx, rowid);
 	return 0;
@@ -622,122 +1656,8100 @@ int usr_sqlite_changes(qd_context* ctx) {
 		return 0;
 	}
 
-	sqlite3* db = (sqlite3*)db_elem.value.p;
+	sqlite3* db = ((qdsqlite_db*)db_elem.value.p)->handle;
 	int changes = sqlite3_changes(db);
 	qd_push_i(ctx, changes);
 	return 0;
 }
 
-/**
- * begin - Begin transaction
- * Stack: (db:ptr -- )!
- */
-int usr_sqlite_begin(qd_context* ctx) {
+/** Pop a database pointer and run a transaction control statement */
+static int tx_control(qd_context* ctx, const char* prefix, int op) {
 	qd_stack_element_t db_elem;
+	char msg[96];
 
 	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
 	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
-		set_error_msg(ctx, "sqlite::begin: expected database pointer");
+		snprintf(msg, sizeof(msg), "%s: expected database pointer", prefix);
+		set_error_msg(ctx, msg);
 		ctx->error_code = SQLITE_ERR_INVALID_ARG;
 		return (int){SQLITE_ERR_INVALID_ARG};
 	}
 
-	sqlite3* db = (sqlite3*)db_elem.value.p;
-	char* errmsg = NULL;
-	int rc = sqlite3_exec(db, "BEGIN TRANSACTION", NULL, NULL, &errmsg);
-
+	qdsqlite_db* conn = (qdsqlite_db*)db_elem.value.p;
+	int rc = tx_run(conn, op);
 	if (rc != SQLITE_OK) {
-		if (ctx->error_msg) free(ctx->error_msg);
-		if (errmsg) {
-			size_t len = strlen("sqlite::begin: ") + strlen(errmsg) + 1;
-			ctx->error_msg = malloc(len);
-			if (ctx->error_msg) {
-				snprintf(ctx->error_msg, len, "sqlite::begin: %s", errmsg);
-			}
-			sqlite3_free(errmsg);
-		} else {
-			ctx->error_msg = strdup("sqlite::begin: failed");
-		}
-		ctx->error_code = SQLITE_ERR_EXEC;
-		return (int){SQLITE_ERR_EXEC};
+		set_sqlite_error(ctx, prefix, conn->handle);
+		int code = error_code_for(rc, SQLITE_ERR_EXEC);
+		ctx->error_code = code;
+		return code;
 	}
 
 	qd_push_i(ctx, SQLITE_ERR_OK);
 	return 0;
 }
 
+/**
+ * begin - Begin transaction
+ * Stack: (db:ptr -- )!
+ */
+int usr_sqlite_begin(qd_context* ctx) {
+	return tx_control(ctx, "sqlite::begin", TX_BEGIN);
+}
+
 /**
  * commit - Commit transaction
  * Stack: (db:ptr -- )!
  */
 int usr_sqlite_commit(qd_context* ctx) {
-	qd_stack_element_t db_elem;
-
-	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
-	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
-		set_error_msg(ctx, "sqlite::commit: expected database pointer");
-		ctx->error_code = SQLITE_ERR_INVALID_ARG;
-		return (int){SQLITE_ERR_INVALID_ARG};
-	}
+	return tx_control(ctx, "sqlite::commit", TX_COMMIT);
+}
 
-	sqlite3* db = (sqlite3*)db_elem.value.p;
-	char* errmsg = NULL;
-	int rc = sqlite3_exec(db, "COMMIT", NULL, NULL, &errmsg);
+/**
+ * rollback - Rollback transaction
+ * Stack: (db:ptr -- )!
+ */
+int usr_sqlite_rollback(qd_context* ctx) {
+	return tx_control(ctx, "sqlite::rollback", TX_ROLLBACK);
+}
 
-	if (rc != SQLITE_OK) {
-		if (ctx->error_msg) free(ctx->error_msg);
-		if (errmsg) {
-			size_t len = strlen("sqlite::commit: ") + strlen(errmsg) + 1;
-			ctx->error_msg = malloc(len);
-			if (ctx->error_msg) {
-				snprintf(ctx->error_msg, len, "sqlite::commit: %s", errmsg);
-			}
-			sqlite3_free(errmsg);
-		} else {
-			ctx->error_msg = strdup("sqlite::commit: failed");
-		}
+/**
+ * begin_immediate - Begin transaction holding the write lock
+ * Stack: (db:ptr -- )!
+ */
+int usr_sqlite_begin_immediate(qd_context* ctx) {
+	return tx_control(ctx, "sqlite::begin_immediate", TX_BEGIN_IMMEDIATE);
+}
+
+/**
+ * begin_exclusive - Begin exclusive transaction
+ * Stack: (db:ptr -- )!
+ */
+int usr_sqlite_begin_exclusive(qd_context* ctx) {
+	return tx_control(ctx, "sqlite::begin_exclusive", TX_BEGIN_EXCLUSIVE);
+}
+
+/**
+ * Pop (name db) and run "<verb> "name"". Each name is a distinct SQL
+ * text, so it is prepared once and finalized rather than cached, keeping
+ * savepoints from evicting user statements or skewing cache statistics.
+ */
+static int savepoint_control(qd_context* ctx, const char* prefix, const char* verb) {
+	qd_stack_element_t db_elem, name_elem;
+	char msg[96];
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		snprintf(msg, sizeof(msg), "%s: expected database pointer", prefix);
+		set_error_msg(ctx, msg);
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &name_elem);
+	if (err != QD_STACK_OK || name_elem.type != QD_STACK_TYPE_STR) {
+		snprintf(msg, sizeof(msg), "%s: expected savepoint name", prefix);
+		set_error_msg(ctx, msg);
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_db* conn = (qdsqlite_db*)db_elem.value.p;
+	const char* name = qd_string_data(name_elem.value.s);
+	size_t name_len = qd_string_length(name_elem.value.s);
+
+	/* Quote the name as an identifier, doubling embedded quotes */
+	size_t verb_len = strlen(verb);
+	char* sql = malloc(verb_len + 2 * name_len + 3);
+	if (!sql) {
+		qd_string_release(name_elem.value.s);
+		snprintf(msg, sizeof(msg), "%s: out of memory", prefix);
+		set_error_msg(ctx, msg);
 		ctx->error_code = SQLITE_ERR_EXEC;
 		return (int){SQLITE_ERR_EXEC};
 	}
+	size_t len = 0;
+	memcpy(sql, verb, verb_len);
+	len += verb_len;
+	sql[len++] = ' ';
+	sql[len++] = '"';
+	for (size_t i = 0; i < name_len; i++) {
+		if (name[i] == '"') sql[len++] = '"';
+		sql[len++] = name[i];
+	}
+	sql[len++] = '"';
+	qd_string_release(name_elem.value.s);
+
+	sqlite3_stmt* stmt = NULL;
+	int rc = sqlite3_prepare_v2(conn->handle, sql, (int)len, &stmt, NULL);
+	free(sql);
+	if (rc == SQLITE_OK) rc = sqlite3_step(stmt);
+
+	if (rc != SQLITE_DONE) {
+		set_sqlite_error(ctx, prefix, conn->handle);
+		sqlite3_finalize(stmt);
+		int code = error_code_for(rc, SQLITE_ERR_EXEC);
+		ctx->error_code = code;
+		return code;
+	}
+	sqlite3_finalize(stmt);
 
 	qd_push_i(ctx, SQLITE_ERR_OK);
 	return 0;
 }
 
 /**
- * rollback - Rollback transaction
- * Stack: (db:ptr -- )!
+ * savepoint - Open a named savepoint
+ * Stack: (name:str db:ptr -- )!
  */
-int usr_sqlite_rollback(qd_context* ctx) {
-	qd_stack_element_t db_elem;
+int usr_sqlite_savepoint(qd_context* ctx) {
+	return savepoint_control(ctx, "sqlite::savepoint", "SAVEPOINT");
+}
+
+/**
+ * release_savepoint - Release a savepoint, keeping its changes
+ * Stack: (name:str db:ptr -- )!
+ */
+int usr_sqlite_release_savepoint(qd_context* ctx) {
+	return savepoint_control(ctx, "sqlite::release_savepoint", "RELEASE");
+}
+
+/**
+ * rollback_to - Undo changes made since a savepoint
+ * Stack: (name:str db:ptr -- )!
+ */
+int usr_sqlite_rollback_to(qd_context* ctx) {
+	return savepoint_control(ctx, "sqlite::rollback_to", "ROLLBACK TO");
+}
+
+/**
+ * set_stmt_cache - Set statement cache capacity
+ * Stack: (capacity:i64 db:ptr -- )!
+ */
+int usr_sqlite_set_stmt_cache(qd_context* ctx) {
+	qd_stack_element_t db_elem, capacity_elem;
 
 	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
 	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
-		set_error_msg(ctx, "sqlite::rollback: expected database pointer");
+		set_error_msg(ctx, "sqlite::set_stmt_cache: expected database pointer");
 		ctx->error_code = SQLITE_ERR_INVALID_ARG;
 		return (int){SQLITE_ERR_INVALID_ARG};
 	}
 
-	sqlite3* db = (sqlite3*)db_elem.value.p;
-	char* errmsg = NULL;
-	int rc = sqlite3_exec(db, "ROLLBACK", NULL, NULL, &errmsg);
+	err = qd_stack_pop(ctx->st, &capacity_elem);
+	if (err != QD_STACK_OK || capacity_elem.type != QD_STACK_TYPE_INT || capacity_elem.value.i < 0) {
+		set_error_msg(ctx, "sqlite::set_stmt_cache: expected non-negative capacity");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
 
-	if (rc != SQLITE_OK) {
+	qdsqlite_db* conn = (qdsqlite_db*)db_elem.value.p;
+	size_t capacity = (size_t)capacity_elem.value.i;
+	size_t nbuckets = cache_bucket_count(capacity);
+
+	cache_trim(conn, capacity);
+	conn->cache_capacity = capacity;
+
+	if (nbuckets != conn->nbuckets) {
+		qdsqlite_stmt** buckets = calloc(nbuckets, sizeof(qdsqlite_stmt*));
+		if (!buckets) {
+			set_error_msg(ctx, "sqlite::set_stmt_cache: out of memory");
+			ctx->error_code = SQLITE_ERR_INVALID_ARG;
+			return (int){SQLITE_ERR_INVALID_ARG};
+		}
+		for (qdsqlite_stmt* s = conn->lru_head; s; s = s->lru_next) {
+			qdsqlite_stmt** bucket = &buckets[s->hash & (nbuckets - 1)];
+			s->bucket_next = *bucket;
+			*bucket = s;
+		}
+		free(conn->buckets);
+		conn->buckets = buckets;
+		conn->nbuckets = nbuckets;
+	}
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * stmt_cache_stats - Get statement cache counters
+ * Stack: (db:ptr -- hits:i64 misses:i64 evictions:i64)
+ */
+int usr_sqlite_stmt_cache_stats(qd_context* ctx) {
+	qd_stack_element_t db_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		qd_push_i(ctx, 0);
+		qd_push_i(ctx, 0);
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	qdsqlite_db* conn = (qdsqlite_db*)db_elem.value.p;
+	qd_push_i(ctx, conn->cache_hits);
+	qd_push_i(ctx, conn->cache_misses);
+	qd_push_i(ctx, conn->cache_evictions);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Batch fetch
+ *
+ * A batch holds up to capacity rows of a statement's result in
+ * column-major arrays: cell (row, col) lives at index col * capacity + row.
+ * INTEGER cells use ints, FLOAT cells use floats, TEXT and BLOB cells
+ * store an offset into bytes in ints and their length in lengths.
+ * ------------------------------------------------------------------------ */
+
+typedef struct qdsqlite_batch {
+	int ncols;
+	int64_t rows;
+	int64_t capacity;
+	int64_t cells;  /* cells written so far, in row-major order */
+	unsigned char* types;
+	int64_t* ints;
+	double* floats;
+	int64_t* lengths;
+	char* bytes;
+	size_t bytes_len;
+	size_t bytes_cap;
+} qdsqlite_batch;
+
+static void batch_destroy(qdsqlite_batch* b) {
+	free(b->types);
+	free(b->ints);
+	free(b->floats);
+	free(b->lengths);
+	free(b->bytes);
+	free(b);
+}
+
+/** Largest row capacity a batch may have, fixed or grown */
+#define SQLITE_BATCH_MAX_ROWS ((int64_t)1 << 26)
+
+/** Bytes per cell across types, ints, floats and lengths */
+#define BATCH_CELL_BYTES (1 + sizeof(int64_t) + sizeof(double) + sizeof(int64_t))
+
+/** Whether ncols x capacity cells can be allocated without size overflow */
+static int batch_size_ok(int ncols, int64_t capacity) {
+	if (ncols < 0 || capacity < 0 || capacity > SQLITE_BATCH_MAX_ROWS) return 0;
+	return ncols == 0 || (size_t)capacity <= SIZE_MAX / BATCH_CELL_BYTES / (size_t)ncols;
+}
+
+static qdsqlite_batch* batch_create(int ncols, int64_t capacity) {
+	if (!batch_size_ok(ncols, capacity)) return NULL;
+	qdsqlite_batch* b = calloc(1, sizeof(qdsqlite_batch));
+	if (!b) return NULL;
+
+	size_t cells = (size_t)ncols * (size_t)capacity;
+	if (cells == 0) cells = 1;
+
+	b->ncols = ncols;
+	b->capacity = capacity;
+	b->types = malloc(cells);
+	b->ints = malloc(cells * sizeof(int64_t));
+	b->floats = malloc(cells * sizeof(double));
+	b->lengths = malloc(cells * sizeof(int64_t));
+	if (!b->types || !b->ints || !b->floats || !b->lengths) {
+		batch_destroy(b);
+		return NULL;
+	}
+	return b;
+}
+
+/** Append bytes to the batch buffer, returning the offset or -1 */
+static int64_t batch_append(qdsqlite_batch* b, const void* data, size_t len) {
+	if (b->bytes_len + len > b->bytes_cap) {
+		size_t cap = b->bytes_cap ? b->bytes_cap : 4096;
+		while (cap < b->bytes_len + len) cap *= 2;
+		char* bytes = realloc(b->bytes, cap);
+		if (!bytes) return -1;
+		b->bytes = bytes;
+		b->bytes_cap = cap;
+	}
+	int64_t offset = (int64_t)b->bytes_len;
+	if (len > 0) memcpy(b->bytes + b->bytes_len, data, len);
+	b->bytes_len += len;
+	return offset;
+}
+
+/**
+ * Step up to capacity rows into the batch.
+ * Returns SQLITE_DONE or SQLITE_ROW on success (ROW when the batch filled
+ * before the result ended), SQLITE_NOMEM if the buffer could not grow, or
+ * the failing step's result code.
+ */
+static int batch_fill(qdsqlite_batch* b, qdsqlite_stmt* s) {
+	b->rows = 0;
+	b->cells = 0;
+	b->bytes_len = 0;
+	if (s->exhausted) return SQLITE_DONE;
+
+	sqlite3_stmt* stmt = s->handle;
+	while (b->rows < b->capacity) {
+		int rc = stmt_step(s);
+		if (rc == SQLITE_DONE) {
+			s->exhausted = 1;
+			return SQLITE_DONE;
+		}
+		if (rc != SQLITE_ROW) return rc;
+
+		int64_t row = b->rows;
+		for (int col = 0; col < b->ncols; col++) {
+			size_t cell = (size_t)col * (size_t)b->capacity + (size_t)row;
+			int type = sqlite3_column_type(stmt, col);
+			b->types[cell] = (unsigned char)type;
+
+			if (type == SQLITE_INTEGER) {
+				b->ints[cell] = sqlite3_column_int64(stmt, col);
+			} else if (type == SQLITE_FLOAT) {
+				b->floats[cell] = sqlite3_column_double(stmt, col);
+			} else if (type == SQLITE_TEXT || type == SQLITE_BLOB) {
+				const void* data = type == SQLITE_TEXT
+					? (const void*)sqlite3_column_text(stmt, col)
+					: sqlite3_column_blob(stmt, col);
+				int len = sqlite3_column_bytes(stmt, col);
+				int64_t offset = batch_append(b, data, (size_t)len);
+				if (offset < 0) return SQLITE_NOMEM;
+				b->ints[cell] = offset;
+				b->lengths[cell] = len;
+			}
+		}
+		b->rows++;
+		b->cells += b->ncols;
+	}
+	return SQLITE_ROW;
+}
+
+/** Report a failed batch fill */
+static int batch_fill_error(qd_context* ctx, const char* prefix, qdsqlite_stmt* s, int rc) {
+	if (rc == SQLITE_NOMEM) {
+		size_t len = strlen(prefix) + strlen(": out of memory") + 1;
+		char* msg = malloc(len);
+		if (msg) snprintf(msg, len, "%s: out of memory", prefix);
 		if (ctx->error_msg) free(ctx->error_msg);
-		if (errmsg) {
-			size_t len = strlen("sqlite::rollback: ") + strlen(errmsg) + 1;
-			ctx->error_msg = malloc(len);
-			if (ctx->error_msg) {
-				snprintf(ctx->error_msg, len, "sqlite::rollback: %s", errmsg);
+		ctx->error_msg = msg;
+	} else {
+		set_sqlite_error(ctx, prefix, sqlite3_db_handle(s->handle));
+	}
+	int code = error_code_for(rc, SQLITE_ERR_STEP);
+	ctx->error_code = code;
+	return code;
+}
+
+/**
+ * fetch_batch - Step up to n rows into a new batch
+ * Stack: (n:i64 stmt:ptr -- batch:ptr rows:i64)!
+ */
+int usr_sqlite_fetch_batch(qd_context* ctx) {
+	qd_stack_element_t stmt_elem, n_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::fetch_batch: expected statement pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &n_elem);
+	if (err != QD_STACK_OK || n_elem.type != QD_STACK_TYPE_INT || n_elem.value.i <= 0 ||
+	    n_elem.value.i > SQLITE_BATCH_MAX_ROWS) {
+		set_error_msg(ctx, "sqlite::fetch_batch: row count must be 1..67108864");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_stmt* s = (qdsqlite_stmt*)stmt_elem.value.p;
+	qdsqlite_batch* b = batch_create(sqlite3_column_count(s->handle), n_elem.value.i);
+	if (!b) {
+		set_error_msg(ctx, "sqlite::fetch_batch: out of memory");
+		ctx->error_code = SQLITE_ERR_STEP;
+		return (int){SQLITE_ERR_STEP};
+	}
+
+	int rc = batch_fill(b, s);
+	if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+		batch_destroy(b);
+		return batch_fill_error(ctx, "sqlite::fetch_batch", s, rc);
+	}
+
+	qd_push_p(ctx, b);
+	qd_push_i(ctx, b->rows);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * refill_batch - Step the next rows into an existing batch
+ * Stack: (batch:ptr stmt:ptr -- rows:i64)!
+ */
+int usr_sqlite_refill_batch(qd_context* ctx) {
+	qd_stack_element_t stmt_elem, batch_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::refill_batch: expected statement pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &batch_elem);
+	if (err != QD_STACK_OK || batch_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::refill_batch: expected batch pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_stmt* s = (qdsqlite_stmt*)stmt_elem.value.p;
+	qdsqlite_batch* b = (qdsqlite_batch*)batch_elem.value.p;
+	if (b->ncols != sqlite3_column_count(s->handle)) {
+		set_error_msg(ctx, "sqlite::refill_batch: column count mismatch");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	int rc = batch_fill(b, s);
+	if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+		return batch_fill_error(ctx, "sqlite::refill_batch", s, rc);
+	}
+
+	qd_push_i(ctx, b->rows);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * batch_free - Free a batch
+ * Stack: (batch:ptr -- )
+ */
+int usr_sqlite_batch_free(qd_context* ctx) {
+	qd_stack_element_t batch_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &batch_elem);
+	if (err != QD_STACK_OK || batch_elem.type != QD_STACK_TYPE_PTR) {
+		return 0;
+	}
+
+	qdsqlite_batch* b = (qdsqlite_batch*)batch_elem.value.p;
+	if (b) {
+		batch_destroy(b);
+	}
+
+	return 0;
+}
+
+/**
+ * batch_rows - Get number of rows in a batch
+ * Stack: (batch:ptr -- rows:i64)
+ */
+int usr_sqlite_batch_rows(qd_context* ctx) {
+	qd_stack_element_t batch_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &batch_elem);
+	if (err != QD_STACK_OK || batch_elem.type != QD_STACK_TYPE_PTR) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	qdsqlite_batch* b = (qdsqlite_batch*)batch_elem.value.p;
+	qd_push_i(ctx, b->rows);
+	return 0;
+}
+
+/**
+ * Pop (row col batch) accessor arguments.
+ * Returns the cell index, or -1 if the arguments are invalid or out of range.
+ */
+static int64_t pop_batch_cell(qd_context* ctx, qdsqlite_batch** out) {
+	qd_stack_element_t batch_elem, col_elem, row_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &batch_elem);
+	if (err != QD_STACK_OK || batch_elem.type != QD_STACK_TYPE_PTR) return -1;
+
+	err = qd_stack_pop(ctx->st, &col_elem);
+	if (err != QD_STACK_OK || col_elem.type != QD_STACK_TYPE_INT) return -1;
+
+	err = qd_stack_pop(ctx->st, &row_elem);
+	if (err != QD_STACK_OK || row_elem.type != QD_STACK_TYPE_INT) return -1;
+
+	qdsqlite_batch* b = (qdsqlite_batch*)batch_elem.value.p;
+	int64_t row = row_elem.value.i;
+	int64_t col = col_elem.value.i;
+	if (!b || row < 0 || row >= b->rows || col < 0 || col >= b->ncols) return -1;
+
+	*out = b;
+	return col * b->capacity + row;
+}
+
+/**
+ * batch_type - Get cell type
+ * Stack: (row:i64 col:i64 batch:ptr -- type:i64)
+ */
+int usr_sqlite_batch_type(qd_context* ctx) {
+	qdsqlite_batch* b = NULL;
+	int64_t cell = pop_batch_cell(ctx, &b);
+	qd_push_i(ctx, cell < 0 ? 0 : b->types[cell]);
+	return 0;
+}
+
+/**
+ * batch_int - Get integer cell value
+ * Stack: (row:i64 col:i64 batch:ptr -- value:i64)
+ */
+int usr_sqlite_batch_int(qd_context* ctx) {
+	qdsqlite_batch* b = NULL;
+	int64_t cell = pop_batch_cell(ctx, &b);
+	if (cell < 0) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	switch (b->types[cell]) {
+	case SQLITE_INTEGER:
+		qd_push_i(ctx, b->ints[cell]);
+		break;
+	case SQLITE_FLOAT:
+		qd_push_i(ctx, (int64_t)b->floats[cell]);
+		break;
+	case SQLITE_TEXT: {
+		char buf[32];
+		int64_t len = b->lengths[cell] < 31 ? b->lengths[cell] : 31;
+		memcpy(buf, b->bytes + b->ints[cell], (size_t)len);
+		buf[len] = '\0';
+		qd_push_i(ctx, strtoll(buf, NULL, 10));
+		break;
+	}
+	default:
+		qd_push_i(ctx, 0);
+		break;
+	}
+	return 0;
+}
+
+/**
+ * batch_float - Get float cell value
+ * Stack: (row:i64 col:i64 batch:ptr -- value:f64)
+ */
+int usr_sqlite_batch_float(qd_context* ctx) {
+	qdsqlite_batch* b = NULL;
+	int64_t cell = pop_batch_cell(ctx, &b);
+	if (cell < 0) {
+		qd_push_f(ctx, 0.0);
+		return 0;
+	}
+
+	switch (b->types[cell]) {
+	case SQLITE_INTEGER:
+		qd_push_f(ctx, (double)b->ints[cell]);
+		break;
+	case SQLITE_FLOAT:
+		qd_push_f(ctx, b->floats[cell]);
+		break;
+	case SQLITE_TEXT: {
+		char buf[64];
+		int64_t len = b->lengths[cell] < 63 ? b->lengths[cell] : 63;
+		memcpy(buf, b->bytes + b->ints[cell], (size_t)len);
+		buf[len] = '\0';
+		qd_push_f(ctx, strtod(buf, NULL));
+		break;
+	}
+	default:
+		qd_push_f(ctx, 0.0);
+		break;
+	}
+	return 0;
+}
+
+/**
+ * batch_text - Get text cell value
+ * Stack: (row:i64 col:i64 batch:ptr -- value:str)
+ */
+int usr_sqlite_batch_text(qd_context* ctx) {
+	qdsqlite_batch* b = NULL;
+	int64_t cell = pop_batch_cell(ctx, &b);
+	if (cell < 0) {
+		qd_push_s(ctx, "");
+		return 0;
+	}
+
+	char buf[32];
+	switch (b->types[cell]) {
+	case SQLITE_INTEGER:
+		snprintf(buf, sizeof(buf), "%lld", (long long)b->ints[cell]);
+		qd_push_s(ctx, buf);
+		break;
+	case SQLITE_FLOAT:
+		snprintf(buf, sizeof(buf), "%.15g", b->floats[cell]);
+		qd_push_s(ctx, buf);
+		break;
+	case SQLITE_TEXT:
+	case SQLITE_BLOB:
+		if (b->lengths[cell] > 0) {
+			qd_string_t* str = qd_string_create_with_length(b->bytes + b->ints[cell], (size_t)b->lengths[cell]);
+			if (str) {
+				qd_push_s_ref(ctx, str);
+				qd_string_release(str);
+			} else {
+				qd_push_s(ctx, "");
 			}
-			sqlite3_free(errmsg);
 		} else {
-			ctx->error_msg = strdup("sqlite::rollback: failed");
+			qd_push_s(ctx, "");
 		}
-		ctx->error_code = SQLITE_ERR_EXEC;
-		return (int){SQLITE_ERR_EXEC};
+		break;
+	default:
+		qd_push_s(ctx, "");
+		break;
+	}
+	return 0;
+}
+
+/** Double a batch's row capacity, keeping its column-major layout */
+static int batch_grow(qdsqlite_batch* b) {
+	int64_t capacity = b->capacity * 2;
+	if (!batch_size_ok(b->ncols, capacity)) return 0;
+	size_t cells = (size_t)b->ncols * (size_t)capacity;
+	unsigned char* types = malloc(cells);
+	int64_t* ints = malloc(cells * sizeof(int64_t));
+	double* floats = malloc(cells * sizeof(double));
+	int64_t* lengths = malloc(cells * sizeof(int64_t));
+	if (!types || !ints || !floats || !lengths) {
+		free(types);
+		free(ints);
+		free(floats);
+		free(lengths);
+		return 0;
 	}
 
-	qd_push_i(ctx, SQLITE_ERR_OK);
+	size_t old = (size_t)b->capacity;
+	for (size_t col = 0; col < (size_t)b->ncols; col++) {
+		memcpy(types + col * (size_t)capacity, b->types + col * old, old);
+		memcpy(ints + col * (size_t)capacity, b->ints + col * old, old * sizeof(int64_t));
+		memcpy(floats + col * (size_t)capacity, b->floats + col * old, old * sizeof(double));
+		memcpy(lengths + col * (size_t)capacity, b->lengths + col * old, old * sizeof(int64_t));
+	}
+
+	free(b->types);
+	free(b->ints);
+	free(b->floats);
+	free(b->lengths);
+	b->types = types;
+	b->ints = ints;
+	b->floats = floats;
+	b->lengths = lengths;
+	b->capacity = capacity;
+	return 1;
+}
+
+/**
+ * batch_new - Create an empty batch for building parameter rows
+ * Stack: (ncols:i64 capacity:i64 -- batch:ptr)!
+ */
+int usr_sqlite_batch_new(qd_context* ctx) {
+	qd_stack_element_t capacity_elem, ncols_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &capacity_elem);
+	if (err != QD_STACK_OK || capacity_elem.type != QD_STACK_TYPE_INT || capacity_elem.value.i <= 0 ||
+	    capacity_elem.value.i > SQLITE_BATCH_MAX_ROWS) {
+		set_error_msg(ctx, "sqlite::batch_new: capacity must be 1..67108864");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &ncols_elem);
+	if (err != QD_STACK_OK || ncols_elem.type != QD_STACK_TYPE_INT || ncols_elem.value.i <= 0) {
+		set_error_msg(ctx, "sqlite::batch_new: expected positive column count");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_batch* b = batch_create((int)ncols_elem.value.i, capacity_elem.value.i);
+	if (!b) {
+		set_error_msg(ctx, "sqlite::batch_new: out of memory");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qd_push_p(ctx, b);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * batch_clear - Remove all rows from a batch, keeping its buffers
+ * Stack: (batch:ptr -- )
+ */
+int usr_sqlite_batch_clear(qd_context* ctx) {
+	qd_stack_element_t batch_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &batch_elem);
+	if (err != QD_STACK_OK || batch_elem.type != QD_STACK_TYPE_PTR) {
+		return 0;
+	}
+
+	qdsqlite_batch* b = (qdsqlite_batch*)batch_elem.value.p;
+	if (b) {
+		b->rows = 0;
+		b->cells = 0;
+		b->bytes_len = 0;
+	}
+
+	return 0;
+}
+
+/**
+ * Reserve the next cell of a batch being built.
+ * Returns the cell index, or -1 if the batch has no columns or could not grow.
+ */
+static int64_t batch_next_cell(qdsqlite_batch* b) {
+	if (b->ncols <= 0) return -1;
+	int64_t row = b->cells / b->ncols;
+	int64_t col = b->cells % b->ncols;
+	if (row >= b->capacity && !batch_grow(b)) return -1;
+
+	b->cells++;
+	b->rows = (b->cells + b->ncols - 1) / b->ncols;
+	return col * b->capacity + row;
+}
+
+/**
+ * batch_add_int - Append integer cell to a batch
+ * Stack: (value:i64 batch:ptr -- )!
+ */
+int usr_sqlite_batch_add_int(qd_context* ctx) {
+	qd_stack_element_t batch_elem, value_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &batch_elem);
+	if (err != QD_STACK_OK || batch_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::batch_add_int: expected batch pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &value_elem);
+	if (err != QD_STACK_OK || value_elem.type != QD_STACK_TYPE_INT) {
+		set_error_msg(ctx, "sqlite::batch_add_int: expected integer value");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_batch* b = (qdsqlite_batch*)batch_elem.value.p;
+	int64_t cell = batch_next_cell(b);
+	if (cell < 0) {
+		set_error_msg(ctx, "sqlite::batch_add_int: out of memory");
+		ctx->error_code = SQLITE_ERR_BIND;
+		return (int){SQLITE_ERR_BIND};
+	}
+
+	b->types[cell] = SQLITE_INTEGER;
+	b->ints[cell] = value_elem.value.i;
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * batch_add_float - Append float cell to a batch
+ * Stack: (value:f64 batch:ptr -- )!
+ */
+int usr_sqlite_batch_add_float(qd_context* ctx) {
+	qd_stack_element_t batch_elem, value_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &batch_elem);
+	if (err != QD_STACK_OK || batch_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::batch_add_float: expected batch pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &value_elem);
+	if (err != QD_STACK_OK || value_elem.type != QD_STACK_TYPE_FLOAT) {
+		set_error_msg(ctx, "sqlite::batch_add_float: expected float value");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_batch* b = (qdsqlite_batch*)batch_elem.value.p;
+	int64_t cell = batch_next_cell(b);
+	if (cell < 0) {
+		set_error_msg(ctx, "sqlite::batch_add_float: out of memory");
+		ctx->error_code = SQLITE_ERR_BIND;
+		return (int){SQLITE_ERR_BIND};
+	}
+
+	b->types[cell] = SQLITE_FLOAT;
+	b->floats[cell] = value_elem.value.f;
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * batch_add_text - Append text cell to a batch
+ * Stack: (value:str batch:ptr -- )!
+ */
+int usr_sqlite_batch_add_text(qd_context* ctx) {
+	qd_stack_element_t batch_elem, value_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &batch_elem);
+	if (err != QD_STACK_OK || batch_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::batch_add_text: expected batch pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &value_elem);
+	if (err != QD_STACK_OK || value_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::batch_add_text: expected string value");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_batch* b = (qdsqlite_batch*)batch_elem.value.p;
+	size_t len = qd_string_length(value_elem.value.s);
+	int64_t offset = batch_append(b, qd_string_data(value_elem.value.s), len);
+	qd_string_release(value_elem.value.s);
+
+	int64_t cell = offset < 0 ? -1 : batch_next_cell(b);
+	if (cell < 0) {
+		set_error_msg(ctx, "sqlite::batch_add_text: out of memory");
+		ctx->error_code = SQLITE_ERR_BIND;
+		return (int){SQLITE_ERR_BIND};
+	}
+
+	b->types[cell] = SQLITE_TEXT;
+	b->ints[cell] = offset;
+	b->lengths[cell] = (int64_t)len;
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * batch_add_null - Append NULL cell to a batch
+ * Stack: (batch:ptr -- )!
+ */
+int usr_sqlite_batch_add_null(qd_context* ctx) {
+	qd_stack_element_t batch_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &batch_elem);
+	if (err != QD_STACK_OK || batch_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::batch_add_null: expected batch pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_batch* b = (qdsqlite_batch*)batch_elem.value.p;
+	int64_t cell = batch_next_cell(b);
+	if (cell < 0) {
+		set_error_msg(ctx, "sqlite::batch_add_null: out of memory");
+		ctx->error_code = SQLITE_ERR_BIND;
+		return (int){SQLITE_ERR_BIND};
+	}
+
+	b->types[cell] = SQLITE_NULL;
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/** Bind one batch row to the statement's parameters (SQLITE_STATIC) */
+static int batch_bind_row(qdsqlite_batch* b, sqlite3_stmt* stmt, int64_t row) {
+	for (int col = 0; col < b->ncols; col++) {
+		size_t cell = (size_t)col * (size_t)b->capacity + (size_t)row;
+		int index = col + 1;
+		int rc;
+
+		switch (b->types[cell]) {
+		case SQLITE_INTEGER:
+			rc = sqlite3_bind_int64(stmt, index, b->ints[cell]);
+			break;
+		case SQLITE_FLOAT:
+			rc = sqlite3_bind_double(stmt, index, b->floats[cell]);
+			break;
+		case SQLITE_TEXT:
+			rc = sqlite3_bind_text(stmt, index, b->bytes + b->ints[cell], (int)b->lengths[cell], SQLITE_STATIC);
+			break;
+		case SQLITE_BLOB:
+			rc = sqlite3_bind_blob(stmt, index, b->bytes + b->ints[cell], (int)b->lengths[cell], SQLITE_STATIC);
+			break;
+		default:
+			rc = sqlite3_bind_null(stmt, index);
+			break;
+		}
+		if (rc != SQLITE_OK) return rc;
+	}
+	return SQLITE_OK;
+}
+
+/**
+ * Bind each batch row to the statement's parameters and run it.
+ * Bindings are replaced row by row, so the statement is only reset between
+ * rows, never cleared. Returns SQLITE_OK or the failing result code and
+ * sets *failed_bind to 1 if binding failed, 0 if stepping failed.
+ */
+static int batch_execute(qdsqlite_batch* b, sqlite3_stmt* stmt, int* failed_bind) {
+	int rc = SQLITE_OK;
+	sqlite3_reset(stmt);
+
+	for (int64_t row = 0; row < b->rows; row++) {
+		rc = batch_bind_row(b, stmt, row);
+		if (rc != SQLITE_OK) {
+			*failed_bind = 1;
+			sqlite3_clear_bindings(stmt);
+			return rc;
+		}
+
+		rc = sqlite3_step(stmt);
+		sqlite3_reset(stmt);
+		if (rc != SQLITE_DONE && rc != SQLITE_ROW) {
+			*failed_bind = 0;
+			sqlite3_clear_bindings(stmt);
+			return rc;
+		}
+	}
+
+	/* Batch text is bound SQLITE_STATIC; don't leave the statement pointing at it */
+	sqlite3_clear_bindings(stmt);
+	return SQLITE_OK;
+}
+
+/** Shared body of execute_batch and execute_batch_tx */
+static int execute_batch_impl(qd_context* ctx, const char* name, int use_tx) {
+	qd_stack_element_t stmt_elem, batch_elem;
+	char prefix[64];
+	char msg[128];
+	snprintf(prefix, sizeof(prefix), "sqlite::%s", name);
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		snprintf(msg, sizeof(msg), "%s: expected statement pointer", prefix);
+		set_error_msg(ctx, msg);
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &batch_elem);
+	if (err != QD_STACK_OK || batch_elem.type != QD_STACK_TYPE_PTR) {
+		snprintf(msg, sizeof(msg), "%s: expected batch pointer", prefix);
+		set_error_msg(ctx, msg);
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_stmt* s = (qdsqlite_stmt*)stmt_elem.value.p;
+	qdsqlite_batch* b = (qdsqlite_batch*)batch_elem.value.p;
+	sqlite3* db = sqlite3_db_handle(s->handle);
+
+	if (b->ncols <= 0 || b->cells % b->ncols != 0 || sqlite3_bind_parameter_count(s->handle) != b->ncols) {
+		snprintf(msg, sizeof(msg), "%s: batch columns do not match statement parameters", prefix);
+		set_error_msg(ctx, msg);
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	/* Only open a transaction when not already inside one */
+	int own_tx = use_tx && sqlite3_get_autocommit(db);
+	if (own_tx && tx_run(s->db, TX_BEGIN) != SQLITE_OK) {
+		set_sqlite_error(ctx, prefix, db);
+		ctx->error_code = SQLITE_ERR_EXEC;
+		return (int){SQLITE_ERR_EXEC};
+	}
+
+	int failed_bind = 0;
+	int rc = batch_execute(b, s->handle, &failed_bind);
+	if (rc != SQLITE_OK) {
+		set_sqlite_error(ctx, prefix, db);
+		if (own_tx) tx_run(s->db, TX_ROLLBACK);
+		int code = failed_bind ? SQLITE_ERR_BIND : error_code_for(rc, SQLITE_ERR_STEP);
+		ctx->error_code = code;
+		return code;
+	}
+
+	if (own_tx && tx_run(s->db, TX_COMMIT) != SQLITE_OK) {
+		set_sqlite_error(ctx, prefix, db);
+		tx_run(s->db, TX_ROLLBACK);
+		ctx->error_code = SQLITE_ERR_EXEC;
+		return (int){SQLITE_ERR_EXEC};
+	}
+
+	qd_push_i(ctx, b->rows);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * execute_batch - Run statement once per batch row
+ * Stack: (batch:ptr stmt:ptr -- rows:i64)!
+ */
+int usr_sqlite_execute_batch(qd_context* ctx) {
+	return execute_batch_impl(ctx, "execute_batch", 0);
+}
+
+/**
+ * execute_batch_tx - Run statement once per batch row in one transaction
+ * Stack: (batch:ptr stmt:ptr -- rows:i64)!
+ */
+int usr_sqlite_execute_batch_tx(qd_context* ctx) {
+	return execute_batch_impl(ctx, "execute_batch_tx", 1);
+}
+
+/**
+ * batch_text_view - Borrow text cell from a batch without copying
+ * Stack: (row:i64 col:i64 batch:ptr -- data:ptr len:i64)
+ */
+int usr_sqlite_batch_text_view(qd_context* ctx) {
+	qdsqlite_batch* b = NULL;
+	int64_t cell = pop_batch_cell(ctx, &b);
+	if (cell < 0 || (b->types[cell] != SQLITE_TEXT && b->types[cell] != SQLITE_BLOB)) {
+		qd_push_p(ctx, NULL);
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	/* Points into the batch buffer; valid until the batch is refilled or freed */
+	qd_push_p(ctx, b->bytes + b->ints[cell]);
+	qd_push_i(ctx, b->lengths[cell]);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Text views
+ *
+ * A view is a borrowed (data, len) pair from column_text_view or
+ * batch_text_view. These helpers work on views without creating strings.
+ * ------------------------------------------------------------------------ */
+
+/**
+ * Pop a (data len) view.
+ * Returns 0 if the arguments are invalid.
+ */
+static int pop_view(qd_context* ctx, const char** data, size_t* len) {
+	qd_stack_element_t len_elem, data_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &len_elem);
+	if (err != QD_STACK_OK || len_elem.type != QD_STACK_TYPE_INT || len_elem.value.i < 0) return 0;
+
+	err = qd_stack_pop(ctx->st, &data_elem);
+	if (err != QD_STACK_OK || data_elem.type != QD_STACK_TYPE_PTR) return 0;
+
+	*data = (const char*)data_elem.value.p;
+	*len = *data ? (size_t)len_elem.value.i : 0;
+	return 1;
+}
+
+/** Order two byte strings like memcmp, shorter prefix first */
+static int compare_bytes(const char* a, size_t alen, const char* b, size_t blen) {
+	size_t n = alen < blen ? alen : blen;
+	int c = n > 0 ? memcmp(a, b, n) : 0;
+	if (c != 0) return c < 0 ? -1 : 1;
+	if (alen == blen) return 0;
+	return alen < blen ? -1 : 1;
+}
+
+/**
+ * text_view_compare - Compare string with a view
+ * Stack: (value:str data:ptr len:i64 -- order:i64)
+ */
+int usr_sqlite_text_view_compare(qd_context* ctx) {
+	const char* data = NULL;
+	size_t len = 0;
+	if (!pop_view(ctx, &data, &len)) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	qd_stack_element_t value_elem;
+	qd_stack_error err = qd_stack_pop(ctx->st, &value_elem);
+	if (err != QD_STACK_OK || value_elem.type != QD_STACK_TYPE_STR) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	int order = compare_bytes(qd_string_data(value_elem.value.s), qd_string_length(value_elem.value.s), data, len);
+	qd_string_release(value_elem.value.s);
+	qd_push_i(ctx, order);
+	return 0;
+}
+
+/**
+ * text_view_equals - Check whether a view equals a string
+ * Stack: (value:str data:ptr len:i64 -- equal:i64)
+ */
+int usr_sqlite_text_view_equals(qd_context* ctx) {
+	const char* data = NULL;
+	size_t len = 0;
+	if (!pop_view(ctx, &data, &len)) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	qd_stack_element_t value_elem;
+	qd_stack_error err = qd_stack_pop(ctx->st, &value_elem);
+	if (err != QD_STACK_OK || value_elem.type != QD_STACK_TYPE_STR) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	size_t vlen = qd_string_length(value_elem.value.s);
+	int equal = vlen == len && (len == 0 || memcmp(qd_string_data(value_elem.value.s), data, len) == 0);
+	qd_string_release(value_elem.value.s);
+	qd_push_i(ctx, equal);
+	return 0;
+}
+
+/**
+ * text_view_hash - Hash a view (64-bit FNV-1a)
+ * Stack: (data:ptr len:i64 -- hash:i64)
+ */
+int usr_sqlite_text_view_hash(qd_context* ctx) {
+	const char* data = NULL;
+	size_t len = 0;
+	if (!pop_view(ctx, &data, &len)) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	qd_push_i(ctx, (int64_t)hash_bytes(data, len));
+	return 0;
+}
+
+/**
+ * text_view_copy - Copy a view into a new string
+ * Stack: (data:ptr len:i64 -- value:str)
+ */
+int usr_sqlite_text_view_copy(qd_context* ctx) {
+	const char* data = NULL;
+	size_t len = 0;
+	if (!pop_view(ctx, &data, &len) || len == 0) {
+		qd_push_s(ctx, "");
+		return 0;
+	}
+
+	qd_string_t* s = qd_string_create_with_length(data, len);
+	if (s) {
+		qd_push_s_ref(ctx, s);
+		qd_string_release(s);
+	} else {
+		qd_push_s(ctx, "");
+	}
+	return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Incremental BLOB I/O
+ * ------------------------------------------------------------------------ */
+
+typedef struct qdsqlite_blob {
+	sqlite3_blob* handle;
+	sqlite3* db;
+	char* chunk;  /* last blob_read result, reused between reads */
+	size_t chunk_cap;
+} qdsqlite_blob;
+
+/**
+ * blob_open - Open a BLOB for incremental I/O
+ * Stack: (schema:str table:str column:str rowid:i64 writable:i64 db:ptr -- blob:ptr)!
+ */
+int usr_sqlite_blob_open(qd_context* ctx) {
+	qd_stack_element_t db_elem, writable_elem, rowid_elem, column_elem, table_elem, schema_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::blob_open: expected database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &writable_elem);
+	if (err != QD_STACK_OK || writable_elem.type != QD_STACK_TYPE_INT) {
+		set_error_msg(ctx, "sqlite::blob_open: expected integer writable flag");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &rowid_elem);
+	if (err != QD_STACK_OK || rowid_elem.type != QD_STACK_TYPE_INT) {
+		set_error_msg(ctx, "sqlite::blob_open: expected integer rowid");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &column_elem);
+	if (err != QD_STACK_OK || column_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::blob_open: expected column name");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &table_elem);
+	if (err != QD_STACK_OK || table_elem.type != QD_STACK_TYPE_STR) {
+		qd_string_release(column_elem.value.s);
+		set_error_msg(ctx, "sqlite::blob_open: expected table name");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &schema_elem);
+	if (err != QD_STACK_OK || schema_elem.type != QD_STACK_TYPE_STR) {
+		qd_string_release(table_elem.value.s);
+		qd_string_release(column_elem.value.s);
+		set_error_msg(ctx, "sqlite::blob_open: expected schema name");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	sqlite3* db = ((qdsqlite_db*)db_elem.value.p)->handle;
+	const char* schema = qd_string_data(schema_elem.value.s);
+	sqlite3_blob* handle = NULL;
+	int rc = sqlite3_blob_open(db, schema[0] ? schema : "main", qd_string_data(table_elem.value.s),
+		qd_string_data(column_elem.value.s), rowid_elem.value.i,
+		writable_elem.value.i ? 1 : 0, &handle);
+	qd_string_release(schema_elem.value.s);
+	qd_string_release(table_elem.value.s);
+	qd_string_release(column_elem.value.s);
+
+	if (rc != SQLITE_OK) {
+		set_sqlite_error(ctx, "sqlite::blob_open", db);
+		ctx->error_code = SQLITE_ERR_BLOB;
+		if (handle) sqlite3_blob_close(handle);
+		return (int){SQLITE_ERR_BLOB};
+	}
+
+	qdsqlite_blob* blob = calloc(1, sizeof(qdsqlite_blob));
+	if (!blob) {
+		sqlite3_blob_close(handle);
+		set_error_msg(ctx, "sqlite::blob_open: out of memory");
+		ctx->error_code = SQLITE_ERR_BLOB;
+		return (int){SQLITE_ERR_BLOB};
+	}
+	blob->handle = handle;
+	blob->db = db;
+
+	qd_push_p(ctx, blob);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * blob_reopen - Move an open BLOB handle to another row
+ * Stack: (rowid:i64 blob:ptr -- )!
+ */
+int usr_sqlite_blob_reopen(qd_context* ctx) {
+	qd_stack_element_t blob_elem, rowid_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &blob_elem);
+	if (err != QD_STACK_OK || blob_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::blob_reopen: expected blob pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &rowid_elem);
+	if (err != QD_STACK_OK || rowid_elem.type != QD_STACK_TYPE_INT) {
+		set_error_msg(ctx, "sqlite::blob_reopen: expected integer rowid");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_blob* blob = (qdsqlite_blob*)blob_elem.value.p;
+	if (sqlite3_blob_reopen(blob->handle, rowid_elem.value.i) != SQLITE_OK) {
+		set_sqlite_error(ctx, "sqlite::blob_reopen", blob->db);
+		ctx->error_code = SQLITE_ERR_BLOB;
+		return (int){SQLITE_ERR_BLOB};
+	}
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * blob_bytes - Get size of an open BLOB
+ * Stack: (blob:ptr -- size:i64)
+ */
+int usr_sqlite_blob_bytes(qd_context* ctx) {
+	qd_stack_element_t blob_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &blob_elem);
+	if (err != QD_STACK_OK || blob_elem.type != QD_STACK_TYPE_PTR) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	qdsqlite_blob* blob = (qdsqlite_blob*)blob_elem.value.p;
+	qd_push_i(ctx, sqlite3_blob_bytes(blob->handle));
+	return 0;
+}
+
+/**
+ * blob_read - Read a chunk of an open BLOB
+ * Stack: (n:i64 offset:i64 blob:ptr -- data:ptr len:i64)!
+ */
+int usr_sqlite_blob_read(qd_context* ctx) {
+	qd_stack_element_t blob_elem, offset_elem, n_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &blob_elem);
+	if (err != QD_STACK_OK || blob_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::blob_read: expected blob pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &offset_elem);
+	if (err != QD_STACK_OK || offset_elem.type != QD_STACK_TYPE_INT || offset_elem.value.i < 0) {
+		set_error_msg(ctx, "sqlite::blob_read: expected non-negative offset");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &n_elem);
+	if (err != QD_STACK_OK || n_elem.type != QD_STACK_TYPE_INT || n_elem.value.i < 0) {
+		set_error_msg(ctx, "sqlite::blob_read: expected non-negative length");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_blob* blob = (qdsqlite_blob*)blob_elem.value.p;
+	int64_t size = sqlite3_blob_bytes(blob->handle);
+	int64_t offset = offset_elem.value.i;
+
+	/* Short read at the end of the blob, like read(2) */
+	int64_t n = n_elem.value.i;
+	if (offset >= size) n = 0;
+	else if (n > size - offset) n = size - offset;
+
+	if ((size_t)n > blob->chunk_cap) {
+		char* chunk = realloc(blob->chunk, (size_t)n);
+		if (!chunk) {
+			set_error_msg(ctx, "sqlite::blob_read: out of memory");
+			ctx->error_code = SQLITE_ERR_BLOB;
+			return (int){SQLITE_ERR_BLOB};
+		}
+		blob->chunk = chunk;
+		blob->chunk_cap = (size_t)n;
+	}
+
+	if (n > 0 && sqlite3_blob_read(blob->handle, blob->chunk, (int)n, (int)offset) != SQLITE_OK) {
+		set_sqlite_error(ctx, "sqlite::blob_read", blob->db);
+		ctx->error_code = SQLITE_ERR_BLOB;
+		return (int){SQLITE_ERR_BLOB};
+	}
+
+	qd_push_p(ctx, blob->chunk);
+	qd_push_i(ctx, n);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * blob_write - Write bytes into an open BLOB
+ * Stack: (data:ptr len:i64 offset:i64 blob:ptr -- )!
+ */
+int usr_sqlite_blob_write(qd_context* ctx) {
+	qd_stack_element_t blob_elem, offset_elem, len_elem, data_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &blob_elem);
+	if (err != QD_STACK_OK || blob_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::blob_write: expected blob pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &offset_elem);
+	if (err != QD_STACK_OK || offset_elem.type != QD_STACK_TYPE_INT || offset_elem.value.i < 0) {
+		set_error_msg(ctx, "sqlite::blob_write: expected non-negative offset");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &len_elem);
+	if (err != QD_STACK_OK || len_elem.type != QD_STACK_TYPE_INT || len_elem.value.i < 0) {
+		set_error_msg(ctx, "sqlite::blob_write: expected non-negative length");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &data_elem);
+	if (err != QD_STACK_OK || data_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::blob_write: expected data pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_blob* blob = (qdsqlite_blob*)blob_elem.value.p;
+	int64_t len = len_elem.value.i;
+	int64_t offset = offset_elem.value.i;
+
+	/* Incremental I/O cannot grow a blob; size it with bind_zeroblob first */
+	if (offset + len > sqlite3_blob_bytes(blob->handle)) {
+		set_error_msg(ctx, "sqlite::blob_write: write past end of blob");
+		ctx->error_code = SQLITE_ERR_BLOB;
+		return (int){SQLITE_ERR_BLOB};
+	}
+
+	if (len > 0 && sqlite3_blob_write(blob->handle, data_elem.value.p, (int)len, (int)offset) != SQLITE_OK) {
+		set_sqlite_error(ctx, "sqlite::blob_write", blob->db);
+		ctx->error_code = SQLITE_ERR_BLOB;
+		return (int){SQLITE_ERR_BLOB};
+	}
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * blob_close - Close an open BLOB
+ * Stack: (blob:ptr -- )
+ */
+int usr_sqlite_blob_close(qd_context* ctx) {
+	qd_stack_element_t blob_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &blob_elem);
+	if (err != QD_STACK_OK || blob_elem.type != QD_STACK_TYPE_PTR) {
+		return 0;
+	}
+
+	qdsqlite_blob* blob = (qdsqlite_blob*)blob_elem.value.p;
+	if (blob) {
+		sqlite3_blob_close(blob->handle);
+		free(blob->chunk);
+		free(blob);
+	}
+
+	return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Connection pool
+ *
+ * One writer and N readers over the same WAL database. Every connection
+ * is opened with SQLITE_OPEN_NOMUTEX and handed to one thread at a time,
+ * so each keeps its own warm page cache and statement cache for the
+ * lifetime of the pool.
+ * ------------------------------------------------------------------------ */
+
+typedef struct qdsqlite_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t reader_free;
+	pthread_cond_t writer_free;
+	pthread_cond_t all_idle;   /* every connection back in the pool */
+	qdsqlite_db* writer;
+	int writer_busy;
+	qdsqlite_db** readers;
+	int nreaders;
+	qdsqlite_db** idle;  /* stack of idle readers */
+	int nidle;
+} qdsqlite_pool;
+
+static void pool_destroy(qdsqlite_pool* pool) {
+	for (int i = 0; i < pool->nreaders; i++) {
+		if (pool->readers[i]) db_destroy(pool->readers[i]);
+	}
+	if (pool->writer) db_destroy(pool->writer);
+	free(pool->readers);
+	free(pool->idle);
+	pthread_mutex_destroy(&pool->lock);
+	pthread_cond_destroy(&pool->reader_free);
+	pthread_cond_destroy(&pool->writer_free);
+	pthread_cond_destroy(&pool->all_idle);
+	free(pool);
+}
+
+/** Open one pooled connection with a preset, or NULL with *errmsg set */
+static qdsqlite_db* pool_connect(const char* path, int flags, const char* preset, char** errmsg) {
+	sqlite3* db = NULL;
+	if (sqlite3_open_v2(path, &db, flags | SQLITE_OPEN_NOMUTEX | SQLITE_OPEN_URI, NULL) != SQLITE_OK) {
+		*errmsg = sqlite3_mprintf("%s", db ? sqlite3_errmsg(db) : "unable to open database");
+		if (db) sqlite3_close(db);
+		return NULL;
+	}
+	if (apply_preset(db, find_preset(preset), errmsg) != SQLITE_OK) {
+		sqlite3_close(db);
+		return NULL;
+	}
+
+	qdsqlite_db* conn = db_wrap(db);
+	if (!conn) {
+		*errmsg = sqlite3_mprintf("out of memory");
+		sqlite3_close(db);
+	}
+	return conn;
+}
+
+/**
+ * pool_open - Open a writer and N reader connections over a WAL database
+ * Stack: (path:str readers:i64 -- pool:ptr)!
+ */
+int usr_sqlite_pool_open(qd_context* ctx) {
+	qd_stack_element_t readers_elem, path_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &readers_elem);
+	if (err != QD_STACK_OK || readers_elem.type != QD_STACK_TYPE_INT || readers_elem.value.i < 1) {
+		set_error_msg(ctx, "sqlite::pool_open: expected positive reader count");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &path_elem);
+	if (err != QD_STACK_OK || path_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::pool_open: expected string path");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	int nreaders = (int)readers_elem.value.i;
+	qdsqlite_pool* pool = calloc(1, sizeof(qdsqlite_pool));
+	if (pool) {
+		pool->readers = calloc((size_t)nreaders, sizeof(qdsqlite_db*));
+		pool->idle = calloc((size_t)nreaders, sizeof(qdsqlite_db*));
+	}
+	if (!pool || !pool->readers || !pool->idle) {
+		if (pool) {
+			free(pool->readers);
+			free(pool->idle);
+			free(pool);
+		}
+		qd_string_release(path_elem.value.s);
+		set_error_msg(ctx, "sqlite::pool_open: out of memory");
+		ctx->error_code = SQLITE_ERR_OPEN;
+		return (int){SQLITE_ERR_OPEN};
+	}
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->reader_free, NULL);
+	pthread_cond_init(&pool->writer_free, NULL);
+	pthread_cond_init(&pool->all_idle, NULL);
+
+	/* The writer goes first: it creates the file and switches it to WAL */
+	const char* path = qd_string_data(path_elem.value.s);
+	char* errmsg = NULL;
+	pool->writer = pool_connect(path, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, "throughput", &errmsg);
+	for (int i = 0; pool->writer && i < nreaders; i++) {
+		pool->readers[i] = pool_connect(path, SQLITE_OPEN_READONLY, "readonly", &errmsg);
+		if (!pool->readers[i]) break;
+		pool->idle[pool->nidle++] = pool->readers[i];
+		pool->nreaders++;
+	}
+	qd_string_release(path_elem.value.s);
+
+	if (!pool->writer || pool->nreaders < nreaders) {
+		set_exec_error(ctx, "sqlite::pool_open", errmsg);
+		ctx->error_code = SQLITE_ERR_OPEN;
+		pool_destroy(pool);
+		return (int){SQLITE_ERR_OPEN};
+	}
+
+	qd_push_p(ctx, pool);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * pool_acquire_read - Take an idle reader, waiting if all are busy
+ * Stack: (pool:ptr -- db:ptr)!
+ */
+int usr_sqlite_pool_acquire_read(qd_context* ctx) {
+	qd_stack_element_t pool_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &pool_elem);
+	if (err != QD_STACK_OK || pool_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::pool_acquire_read: expected pool pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_pool* pool = (qdsqlite_pool*)pool_elem.value.p;
+	pthread_mutex_lock(&pool->lock);
+	while (pool->nidle == 0) {
+		pthread_cond_wait(&pool->reader_free, &pool->lock);
+	}
+	qdsqlite_db* conn = pool->idle[--pool->nidle];
+	pthread_mutex_unlock(&pool->lock);
+
+	qd_push_p(ctx, conn);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * pool_acquire_write - Take the writer, waiting if it is busy
+ * Stack: (pool:ptr -- db:ptr)!
+ */
+int usr_sqlite_pool_acquire_write(qd_context* ctx) {
+	qd_stack_element_t pool_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &pool_elem);
+	if (err != QD_STACK_OK || pool_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::pool_acquire_write: expected pool pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_pool* pool = (qdsqlite_pool*)pool_elem.value.p;
+	pthread_mutex_lock(&pool->lock);
+	while (pool->writer_busy) {
+		pthread_cond_wait(&pool->writer_free, &pool->lock);
+	}
+	pool->writer_busy = 1;
+	pthread_mutex_unlock(&pool->lock);
+
+	qd_push_p(ctx, pool->writer);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * pool_release - Return a connection to its pool
+ * Stack: (db:ptr pool:ptr -- )!
+ */
+int usr_sqlite_pool_release(qd_context* ctx) {
+	qd_stack_element_t pool_elem, db_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &pool_elem);
+	if (err != QD_STACK_OK || pool_elem.type != QD_STACK_TYPE_PTR || !pool_elem.value.p) {
+		set_error_msg(ctx, "sqlite::pool_release: expected pool pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::pool_release: expected database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_pool* pool = (qdsqlite_pool*)pool_elem.value.p;
+	qdsqlite_db* conn = (qdsqlite_db*)db_elem.value.p;
+
+	/* A foreign or already idle connection would overrun idle[] and break all_idle */
+	pthread_mutex_lock(&pool->lock);
+	int held;
+	if (conn == pool->writer) {
+		held = pool->writer_busy;
+	} else {
+		held = 0;
+		for (int i = 0; i < pool->nreaders; i++) {
+			if (pool->readers[i] == conn) held = 1;
+		}
+		for (int i = 0; held && i < pool->nidle; i++) {
+			if (pool->idle[i] == conn) held = 0;
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+	if (!held) {
+		set_error_msg(ctx, "sqlite::pool_release: connection is not checked out from this pool");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	/* Never hand out a connection with a transaction left open */
+	if (!sqlite3_get_autocommit(conn->handle)) {
+		tx_run(conn, TX_ROLLBACK);
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	if (conn == pool->writer) {
+		pool->writer_busy = 0;
+		pthread_cond_signal(&pool->writer_free);
+	} else {
+		pool->idle[pool->nidle++] = conn;
+		pthread_cond_signal(&pool->reader_free);
+	}
+	if (!pool->writer_busy && pool->nidle == pool->nreaders) {
+		pthread_cond_broadcast(&pool->all_idle);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * pool_close - Close every connection in a pool
+ * Stack: (pool:ptr -- )
+ */
+int usr_sqlite_pool_close(qd_context* ctx) {
+	qd_stack_element_t pool_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &pool_elem);
+	if (err != QD_STACK_OK || pool_elem.type != QD_STACK_TYPE_PTR) {
+		return 0;
+	}
+
+	qdsqlite_pool* pool = (qdsqlite_pool*)pool_elem.value.p;
+	if (pool) {
+		pool_destroy(pool);
+	}
+
+	return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Busy handling
+ * ------------------------------------------------------------------------ */
+
+/**
+ * Busy handler with capped exponential backoff and jitter.
+ * Sleeps between half and all of min(max, base * 2^count) so that
+ * contending writers spread out instead of retrying in lockstep.
+ */
+static int busy_backoff(void* arg, int count) {
+	qdsqlite_db* conn = (qdsqlite_db*)arg;
+	if (count >= conn->busy_max_retries) return 0;
+
+	int64_t delay = conn->busy_base_ms;
+	for (int i = 0; i < count && delay < conn->busy_max_ms; i++) delay *= 2;
+	if (delay > conn->busy_max_ms) delay = conn->busy_max_ms;
+
+	/* xorshift32 */
+	uint32_t x = conn->busy_rng;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	conn->busy_rng = x;
+
+	int64_t half = delay / 2;
+	sqlite3_sleep((int)(half + (int64_t)(x % (uint32_t)(delay - half + 1))));
+	return 1;
+}
+
+/**
+ * set_busy_timeout - Retry on SQLITE_BUSY for up to ms milliseconds
+ * Stack: (ms:i64 db:ptr -- )!
+ */
+int usr_sqlite_set_busy_timeout(qd_context* ctx) {
+	qd_stack_element_t db_elem, ms_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::set_busy_timeout: expected database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &ms_elem);
+	if (err != QD_STACK_OK || ms_elem.type != QD_STACK_TYPE_INT || ms_elem.value.i < 0 || ms_elem.value.i > INT32_MAX) {
+		set_error_msg(ctx, "sqlite::set_busy_timeout: expected non-negative milliseconds");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	sqlite3* db = ((qdsqlite_db*)db_elem.value.p)->handle;
+	sqlite3_busy_timeout(db, (int)ms_elem.value.i);
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * set_busy_backoff - Retry on SQLITE_BUSY with jittered exponential backoff
+ * Stack: (base_ms:i64 max_ms:i64 retries:i64 db:ptr -- )!
+ */
+int usr_sqlite_set_busy_backoff(qd_context* ctx) {
+	qd_stack_element_t db_elem, retries_elem, max_elem, base_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::set_busy_backoff: expected database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &retries_elem);
+	if (err != QD_STACK_OK || retries_elem.type != QD_STACK_TYPE_INT || retries_elem.value.i < 0 || retries_elem.value.i > INT32_MAX) {
+		set_error_msg(ctx, "sqlite::set_busy_backoff: expected non-negative retry count");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &max_elem);
+	if (err != QD_STACK_OK || max_elem.type != QD_STACK_TYPE_INT || max_elem.value.i < 1 || max_elem.value.i > INT32_MAX) {
+		set_error_msg(ctx, "sqlite::set_busy_backoff: expected positive max delay");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &base_elem);
+	if (err != QD_STACK_OK || base_elem.type != QD_STACK_TYPE_INT || base_elem.value.i < 1 || base_elem.value.i > max_elem.value.i) {
+		set_error_msg(ctx, "sqlite::set_busy_backoff: expected base delay between 1 and max");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_db* conn = (qdsqlite_db*)db_elem.value.p;
+	conn->busy_base_ms = (int)base_elem.value.i;
+	conn->busy_max_ms = (int)max_elem.value.i;
+	conn->busy_max_retries = (int)retries_elem.value.i;
+	if (conn->busy_rng == 0) {
+		/* Seeded per connection so pooled writers don't share a sequence */
+		conn->busy_rng = (uint32_t)((uintptr_t)conn >> 4) | 1u;
+	}
+	sqlite3_busy_handler(conn->handle, busy_backoff, conn);
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Script execution
+ *
+ * Runs a multi-statement script by walking sqlite3_prepare_v2's tail
+ * pointer, recording per statement its SQL span, changes, elapsed time
+ * and error.
+ * ------------------------------------------------------------------------ */
+
+typedef struct script_entry {
+	size_t offset;  /* statement span within the script copy */
+	size_t len;
+	int64_t changes;
+	int64_t elapsed_ns;
+	int error;      /* driver error code, 0 on success */
+	char* message;
+} script_entry;
+
+typedef struct qdsqlite_script {
+	char* sql;
+	script_entry* entries;
+	size_t count;
+	size_t cap;
+} qdsqlite_script;
+
+static void script_destroy(qdsqlite_script* r) {
+	for (size_t i = 0; i < r->count; i++) free(r->entries[i].message);
+	free(r->entries);
+	free(r->sql);
+	free(r);
+}
+
+static script_entry* script_add(qdsqlite_script* r) {
+	if (r->count == r->cap) {
+		size_t cap = r->cap ? r->cap * 2 : 16;
+		script_entry* entries = realloc(r->entries, cap * sizeof(script_entry));
+		if (!entries) return NULL;
+		r->entries = entries;
+		r->cap = cap;
+	}
+	script_entry* e = &r->entries[r->count++];
+	memset(e, 0, sizeof(*e));
+	return e;
+}
+
+/**
+ * Run every statement in r->sql.
+ * Returns the number of failed statements, or -1 if out of memory.
+ */
+static int64_t script_run(qdsqlite_script* r, sqlite3* db, int stop_on_error) {
+	int64_t failed = 0;
+	const char* p = r->sql;
+
+	while (*p) {
+		const char* tail = NULL;
+		sqlite3_stmt* stmt = NULL;
+		int64_t start = now_ns();
+		int rc = sqlite3_prepare_v2(db, p, -1, &stmt, &tail);
+
+		if (rc == SQLITE_OK && !stmt) {
+			/* Whitespace or a comment */
+			p = tail;
+			continue;
+		}
+
+		script_entry* e = script_add(r);
+		if (!e) {
+			sqlite3_finalize(stmt);
+			return -1;
+		}
+		e->offset = (size_t)(p - r->sql);
+
+		if (rc != SQLITE_OK) {
+			/* The tail is unreliable after a parse error, so the script ends here */
+			e->len = strlen(p);
+			e->error = SQLITE_ERR_PREPARE;
+			e->message = strdup(sqlite3_errmsg(db));
+			e->elapsed_ns = now_ns() - start;
+			return failed + 1;
+		}
+
+		e->len = (size_t)(tail - p);
+		while (e->len > 0 && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+			p++;
+			e->offset++;
+			e->len--;
+		}
+
+		/* sqlite3_changes is stale after DDL, so measure the difference */
+		int64_t before = sqlite3_total_changes64(db);
+		do {
+			rc = sqlite3_step(stmt);
+		} while (rc == SQLITE_ROW);
+
+		if (rc == SQLITE_DONE) {
+			e->changes = sqlite3_total_changes64(db) - before;
+		} else {
+			e->error = error_code_for(rc, SQLITE_ERR_STEP);
+			e->message = strdup(sqlite3_errmsg(db));
+			failed++;
+		}
+		sqlite3_finalize(stmt);
+		e->elapsed_ns = now_ns() - start;
+
+		if (e->error && stop_on_error) break;
+		p = tail;
+	}
+
+	return failed;
+}
+
+/**
+ * exec_script - Run a multi-statement script with per-statement results
+ * Stack: (sql:str stop_on_error:i64 db:ptr -- result:ptr failed:i64)!
+ */
+int usr_sqlite_exec_script(qd_context* ctx) {
+	qd_stack_element_t db_elem, stop_elem, sql_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::exec_script: expected database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &stop_elem);
+	if (err != QD_STACK_OK || stop_elem.type != QD_STACK_TYPE_INT) {
+		set_error_msg(ctx, "sqlite::exec_script: expected integer stop_on_error flag");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &sql_elem);
+	if (err != QD_STACK_OK || sql_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::exec_script: expected SQL string");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	sqlite3* db = ((qdsqlite_db*)db_elem.value.p)->handle;
+	qdsqlite_script* r = calloc(1, sizeof(qdsqlite_script));
+	if (r) r->sql = strdup(qd_string_data(sql_elem.value.s));
+	qd_string_release(sql_elem.value.s);
+
+	int64_t failed = r && r->sql ? script_run(r, db, stop_elem.value.i != 0) : -1;
+	if (failed < 0) {
+		if (r) script_destroy(r);
+		set_error_msg(ctx, "sqlite::exec_script: out of memory");
+		ctx->error_code = SQLITE_ERR_EXEC;
+		return (int){SQLITE_ERR_EXEC};
+	}
+
+	qd_push_p(ctx, r);
+	qd_push_i(ctx, failed);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * Pop (index result) accessor arguments.
+ * Returns the entry, or NULL if the arguments are invalid or out of range.
+ */
+static script_entry* pop_script_entry(qd_context* ctx, qdsqlite_script** out) {
+	qd_stack_element_t result_elem, index_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &result_elem);
+	if (err != QD_STACK_OK || result_elem.type != QD_STACK_TYPE_PTR) return NULL;
+
+	err = qd_stack_pop(ctx->st, &index_elem);
+	if (err != QD_STACK_OK || index_elem.type != QD_STACK_TYPE_INT) return NULL;
+
+	qdsqlite_script* r = (qdsqlite_script*)result_elem.value.p;
+	if (!r || index_elem.value.i < 0 || (size_t)index_elem.value.i >= r->count) return NULL;
+
+	if (out) *out = r;
+	return &r->entries[index_elem.value.i];
+}
+
+/**
+ * script_count - Get number of statements run
+ * Stack: (result:ptr -- count:i64)
+ */
+int usr_sqlite_script_count(qd_context* ctx) {
+	qd_stack_element_t result_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &result_elem);
+	if (err != QD_STACK_OK || result_elem.type != QD_STACK_TYPE_PTR) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	qdsqlite_script* r = (qdsqlite_script*)result_elem.value.p;
+	qd_push_i(ctx, (int64_t)r->count);
+	return 0;
+}
+
+/**
+ * script_sql - Get SQL text of a statement
+ * Stack: (index:i64 result:ptr -- sql:str)
+ */
+int usr_sqlite_script_sql(qd_context* ctx) {
+	qdsqlite_script* r = NULL;
+	script_entry* e = pop_script_entry(ctx, &r);
+	qd_string_t* s = e && e->len > 0 ? qd_string_create_with_length(r->sql + e->offset, e->len) : NULL;
+	if (s) {
+		qd_push_s_ref(ctx, s);
+		qd_string_release(s);
+	} else {
+		qd_push_s(ctx, "");
+	}
+	return 0;
+}
+
+/**
+ * script_changes - Get rows changed by a statement
+ * Stack: (index:i64 result:ptr -- changes:i64)
+ */
+int usr_sqlite_script_changes(qd_context* ctx) {
+	script_entry* e = pop_script_entry(ctx, NULL);
+	qd_push_i(ctx, e ? e->changes : 0);
+	return 0;
+}
+
+/**
+ * script_elapsed_us - Get statement wall time in microseconds
+ * Stack: (index:i64 result:ptr -- us:i64)
+ */
+int usr_sqlite_script_elapsed_us(qd_context* ctx) {
+	script_entry* e = pop_script_entry(ctx, NULL);
+	qd_push_i(ctx, e ? e->elapsed_ns / 1000 : 0);
+	return 0;
+}
+
+/**
+ * script_error - Get statement error code (0 on success)
+ * Stack: (index:i64 result:ptr -- code:i64)
+ */
+int usr_sqlite_script_error(qd_context* ctx) {
+	script_entry* e = pop_script_entry(ctx, NULL);
+	qd_push_i(ctx, e ? e->error : 0);
+	return 0;
+}
+
+/**
+ * script_message - Get statement error message ("" on success)
+ * Stack: (index:i64 result:ptr -- message:str)
+ */
+int usr_sqlite_script_message(qd_context* ctx) {
+	script_entry* e = pop_script_entry(ctx, NULL);
+	qd_push_s(ctx, e && e->message ? e->message : "");
+	return 0;
+}
+
+/**
+ * script_free - Free script results
+ * Stack: (result:ptr -- )
+ */
+int usr_sqlite_script_free(qd_context* ctx) {
+	qd_stack_element_t result_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &result_elem);
+	if (err != QD_STACK_OK || result_elem.type != QD_STACK_TYPE_PTR) {
+		return 0;
+	}
+
+	qdsqlite_script* r = (qdsqlite_script*)result_elem.value.p;
+	if (r) {
+		script_destroy(r);
+	}
+
+	return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Profiling
+ * ------------------------------------------------------------------------ */
+
+/**
+ * stmt_status - Read a sqlite3_stmt_status counter
+ * Stack: (op:i64 reset:i64 stmt:ptr -- value:i64)
+ */
+int usr_sqlite_stmt_status(qd_context* ctx) {
+	qd_stack_element_t stmt_elem, reset_elem, op_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	err = qd_stack_pop(ctx->st, &reset_elem);
+	if (err != QD_STACK_OK || reset_elem.type != QD_STACK_TYPE_INT) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	err = qd_stack_pop(ctx->st, &op_elem);
+	if (err != QD_STACK_OK || op_elem.type != QD_STACK_TYPE_INT) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	sqlite3_stmt* stmt = ((qdsqlite_stmt*)stmt_elem.value.p)->handle;
+	int value = sqlite3_stmt_status(stmt, (int)op_elem.value.i, reset_elem.value.i ? 1 : 0);
+	qd_push_i(ctx, value);
+	return 0;
+}
+
+/**
+ * stmt_elapsed - Get wall time spent stepping a statement
+ * Stack: (reset:i64 stmt:ptr -- ns:i64 steps:i64)
+ */
+int usr_sqlite_stmt_elapsed(qd_context* ctx) {
+	qd_stack_element_t stmt_elem, reset_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		qd_push_i(ctx, 0);
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	err = qd_stack_pop(ctx->st, &reset_elem);
+	if (err != QD_STACK_OK || reset_elem.type != QD_STACK_TYPE_INT) {
+		qd_push_i(ctx, 0);
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	qdsqlite_stmt* s = (qdsqlite_stmt*)stmt_elem.value.p;
+	qd_push_i(ctx, s->step_ns);
+	qd_push_i(ctx, s->steps);
+	if (reset_elem.value.i) {
+		s->step_ns = 0;
+		s->steps = 0;
+	}
+	return 0;
+}
+
+/**
+ * set_step_timing - Enable or disable per-statement step timing
+ * Stack: (enabled:i64 db:ptr -- )
+ */
+int usr_sqlite_set_step_timing(qd_context* ctx) {
+	qd_stack_element_t db_elem, enabled_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		return 0;
+	}
+
+	err = qd_stack_pop(ctx->st, &enabled_elem);
+	if (err != QD_STACK_OK || enabled_elem.type != QD_STACK_TYPE_INT) {
+		return 0;
+	}
+
+	qdsqlite_db* conn = (qdsqlite_db*)db_elem.value.p;
+	conn->step_timing = enabled_elem.value.i != 0;
+	return 0;
+}
+
+/**
+ * db_status - Read a sqlite3_db_status counter
+ * Stack: (op:i64 reset:i64 db:ptr -- current:i64 highwater:i64)
+ */
+int usr_sqlite_db_status(qd_context* ctx) {
+	qd_stack_element_t db_elem, reset_elem, op_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		qd_push_i(ctx, 0);
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	err = qd_stack_pop(ctx->st, &reset_elem);
+	if (err != QD_STACK_OK || reset_elem.type != QD_STACK_TYPE_INT) {
+		qd_push_i(ctx, 0);
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	err = qd_stack_pop(ctx->st, &op_elem);
+	if (err != QD_STACK_OK || op_elem.type != QD_STACK_TYPE_INT) {
+		qd_push_i(ctx, 0);
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	sqlite3* db = ((qdsqlite_db*)db_elem.value.p)->handle;
+	int current = 0;
+	int highwater = 0;
+	sqlite3_db_status(db, (int)op_elem.value.i, &current, &highwater, reset_elem.value.i ? 1 : 0);
+	qd_push_i(ctx, current);
+	qd_push_i(ctx, highwater);
+	return 0;
+}
+
+/** SQLITE_TRACE_PROFILE callback: record statements slower than the threshold */
+static int trace_profile(unsigned mask, void* arg, void* p, void* x) {
+	(void)mask;
+	qdsqlite_db* conn = (qdsqlite_db*)arg;
+	int64_t elapsed = (int64_t)*(sqlite3_int64*)x;
+	if (elapsed < conn->slow_threshold_ns) return 0;
+
+	const char* sql = sqlite3_sql((sqlite3_stmt*)p);
+	slow_entry* e = &conn->slow_log[conn->slow_head];
+	free(e->sql);
+	e->sql = strdup(sql ? sql : "");
+	e->elapsed_ns = elapsed;
+
+	conn->slow_head = (conn->slow_head + 1) % SQLITE_SLOW_LOG_SIZE;
+	if (conn->slow_count < SQLITE_SLOW_LOG_SIZE) conn->slow_count++;
+	return 0;
+}
+
+/**
+ * trace_slow - Log statements slower than a threshold
+ * Stack: (threshold_us:i64 db:ptr -- )!
+ */
+int usr_sqlite_trace_slow(qd_context* ctx) {
+	qd_stack_element_t db_elem, threshold_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::trace_slow: expected database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &threshold_elem);
+	if (err != QD_STACK_OK || threshold_elem.type != QD_STACK_TYPE_INT) {
+		set_error_msg(ctx, "sqlite::trace_slow: expected integer threshold");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_db* conn = (qdsqlite_db*)db_elem.value.p;
+	if (threshold_elem.value.i < 0) {
+		sqlite3_trace_v2(conn->handle, 0, NULL, NULL);
+		qd_push_i(ctx, SQLITE_ERR_OK);
+		return 0;
+	}
+
+	if (!conn->slow_log) {
+		conn->slow_log = calloc(SQLITE_SLOW_LOG_SIZE, sizeof(slow_entry));
+		if (!conn->slow_log) {
+			set_error_msg(ctx, "sqlite::trace_slow: out of memory");
+			ctx->error_code = SQLITE_ERR_INVALID_ARG;
+			return (int){SQLITE_ERR_INVALID_ARG};
+		}
+	}
+
+	conn->slow_threshold_ns = threshold_elem.value.i * 1000;
+	sqlite3_trace_v2(conn->handle, SQLITE_TRACE_PROFILE, trace_profile, conn);
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * slow_count - Get number of logged slow statements
+ * Stack: (db:ptr -- count:i64)
+ */
+int usr_sqlite_slow_count(qd_context* ctx) {
+	qd_stack_element_t db_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	qdsqlite_db* conn = (qdsqlite_db*)db_elem.value.p;
+	qd_push_i(ctx, conn->slow_count);
+	return 0;
+}
+
+/**
+ * Pop (index db) slow log arguments, oldest entry first.
+ * Returns the entry, or NULL if the arguments are invalid or out of range.
+ */
+static slow_entry* pop_slow_entry(qd_context* ctx) {
+	qd_stack_element_t db_elem, index_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) return NULL;
+
+	err = qd_stack_pop(ctx->st, &index_elem);
+	if (err != QD_STACK_OK || index_elem.type != QD_STACK_TYPE_INT) return NULL;
+
+	qdsqlite_db* conn = (qdsqlite_db*)db_elem.value.p;
+	int64_t index = index_elem.value.i;
+	if (index < 0 || index >= conn->slow_count) return NULL;
+
+	int oldest = (conn->slow_head - conn->slow_count + SQLITE_SLOW_LOG_SIZE) % SQLITE_SLOW_LOG_SIZE;
+	return &conn->slow_log[(oldest + index) % SQLITE_SLOW_LOG_SIZE];
+}
+
+/**
+ * slow_sql - Get SQL of a logged slow statement
+ * Stack: (index:i64 db:ptr -- sql:str)
+ */
+int usr_sqlite_slow_sql(qd_context* ctx) {
+	slow_entry* e = pop_slow_entry(ctx);
+	qd_push_s(ctx, e && e->sql ? e->sql : "");
+	return 0;
+}
+
+/**
+ * slow_elapsed_us - Get run time of a logged slow statement
+ * Stack: (index:i64 db:ptr -- us:i64)
+ */
+int usr_sqlite_slow_elapsed_us(qd_context* ctx) {
+	slow_entry* e = pop_slow_entry(ctx);
+	qd_push_i(ctx, e ? e->elapsed_ns / 1000 : 0);
+	return 0;
+}
+
+/**
+ * slow_clear - Empty the slow statement log
+ * Stack: (db:ptr -- )
+ */
+int usr_sqlite_slow_clear(qd_context* ctx) {
+	qd_stack_element_t db_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		return 0;
+	}
+
+	qdsqlite_db* conn = (qdsqlite_db*)db_elem.value.p;
+	conn->slow_head = 0;
+	conn->slow_count = 0;
+	return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Unchecked column access and binding
+ *
+ * The Quadrate declarations already fix the argument types at compile time,
+ * so these skip the runtime type checks and default pushes of the checked
+ * variants. Only call them through the module signatures. The binds still
+ * report SQLite's own failures, such as an out-of-range index.
+ * ------------------------------------------------------------------------ */
+
+/** Pop the (index stmt) arguments of an unchecked call without type checks */
+static inline int pop_column_unchecked(qd_context* ctx, sqlite3_stmt** stmt) {
+	qd_stack_element_t stmt_elem, index_elem;
+	qd_stack_pop(ctx->st, &stmt_elem);
+	qd_stack_pop(ctx->st, &index_elem);
+	*stmt = ((qdsqlite_stmt*)stmt_elem.value.p)->handle;
+	return (int)index_elem.value.i;
+}
+
+/**
+ * column_type_unchecked - Get column type without argument checks
+ * Stack: (index:i64 stmt:ptr -- type:i64)
+ */
+int usr_sqlite_column_type_unchecked(qd_context* ctx) {
+	sqlite3_stmt* stmt;
+	int index = pop_column_unchecked(ctx, &stmt);
+	qd_push_i(ctx, sqlite3_column_type(stmt, index));
+	return 0;
+}
+
+/**
+ * column_int_unchecked - Get integer column without argument checks
+ * Stack: (index:i64 stmt:ptr -- value:i64)
+ */
+int usr_sqlite_column_int_unchecked(qd_context* ctx) {
+	sqlite3_stmt* stmt;
+	int index = pop_column_unchecked(ctx, &stmt);
+	qd_push_i(ctx, sqlite3_column_int64(stmt, index));
+	return 0;
+}
+
+/**
+ * column_float_unchecked - Get float column without argument checks
+ * Stack: (index:i64 stmt:ptr -- value:f64)
+ */
+int usr_sqlite_column_float_unchecked(qd_context* ctx) {
+	sqlite3_stmt* stmt;
+	int index = pop_column_unchecked(ctx, &stmt);
+	qd_push_f(ctx, sqlite3_column_double(stmt, index));
+	return 0;
+}
+
+/**
+ * column_text_unchecked - Get text column without argument checks
+ * Stack: (index:i64 stmt:ptr -- value:str)
+ */
+int usr_sqlite_column_text_unchecked(qd_context* ctx) {
+	sqlite3_stmt* stmt;
+	int index = pop_column_unchecked(ctx, &stmt);
+
+	const unsigned char* text = sqlite3_column_text(stmt, index);
+	int len = sqlite3_column_bytes(stmt, index);
+	qd_string_t* s = text && len > 0 ? qd_string_create_with_length((const char*)text, (size_t)len) : NULL;
+	if (s) {
+		qd_push_s_ref(ctx, s);
+		qd_string_release(s);
+	} else {
+		qd_push_s(ctx, "");
+	}
+	return 0;
+}
+
+/** Finish an unchecked bind with the same result as the checked variant */
+static int bind_unchecked_result(qd_context* ctx, const char* prefix, int rc) {
+	if (rc != SQLITE_OK) {
+		char msg[64];
+		snprintf(msg, sizeof(msg), "%s: bind failed", prefix);
+		set_error_msg(ctx, msg);
+		ctx->error_code = SQLITE_ERR_BIND;
+		return (int){SQLITE_ERR_BIND};
+	}
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * bind_int_unchecked - Bind integer parameter without argument checks
+ * Stack: (value:i64 index:i64 stmt:ptr -- )!
+ */
+int usr_sqlite_bind_int_unchecked(qd_context* ctx) {
+	sqlite3_stmt* stmt;
+	int index = pop_column_unchecked(ctx, &stmt);
+	qd_stack_element_t value_elem;
+	qd_stack_pop(ctx->st, &value_elem);
+	return bind_unchecked_result(ctx, "sqlite::bind_int_unchecked",
+	                             sqlite3_bind_int64(stmt, index, value_elem.value.i));
+}
+
+/**
+ * bind_float_unchecked - Bind float parameter without argument checks
+ * Stack: (value:f64 index:i64 stmt:ptr -- )!
+ */
+int usr_sqlite_bind_float_unchecked(qd_context* ctx) {
+	sqlite3_stmt* stmt;
+	int index = pop_column_unchecked(ctx, &stmt);
+	qd_stack_element_t value_elem;
+	qd_stack_pop(ctx->st, &value_elem);
+	return bind_unchecked_result(ctx, "sqlite::bind_float_unchecked",
+	                             sqlite3_bind_double(stmt, index, value_elem.value.f));
+}
+
+/**
+ * bind_text_unchecked - Bind string parameter without argument checks
+ * Stack: (value:str index:i64 stmt:ptr -- )!
+ */
+int usr_sqlite_bind_text_unchecked(qd_context* ctx) {
+	sqlite3_stmt* stmt;
+	int index = pop_column_unchecked(ctx, &stmt);
+	qd_stack_element_t value_elem;
+	qd_stack_pop(ctx->st, &value_elem);
+	int rc = sqlite3_bind_text(stmt, index, qd_string_data(value_elem.value.s),
+	                           (int)qd_string_length(value_elem.value.s), SQLITE_TRANSIENT);
+	qd_string_release(value_elem.value.s);
+	return bind_unchecked_result(ctx, "sqlite::bind_text_unchecked", rc);
+}
+
+/**
+ * step_int - Step and read one integer column in a single call
+ * Stack: (index:i64 stmt:ptr -- value:i64 has_row:i64)!
+ */
+int usr_sqlite_step_int(qd_context* ctx) {
+	qd_stack_element_t stmt_elem, index_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::step_int: expected statement pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &index_elem);
+	if (err != QD_STACK_OK || index_elem.type != QD_STACK_TYPE_INT) {
+		set_error_msg(ctx, "sqlite::step_int: expected integer column index");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_stmt* s = (qdsqlite_stmt*)stmt_elem.value.p;
+	s->exhausted = 0;
+	int rc = stmt_step(s);
+
+	if (rc == SQLITE_ROW) {
+		qd_push_i(ctx, sqlite3_column_int64(s->handle, (int)index_elem.value.i));
+		qd_push_i(ctx, 1);
+	} else if (rc == SQLITE_DONE) {
+		qd_push_i(ctx, 0);
+		qd_push_i(ctx, 0);
+	} else {
+		int code = error_code_for(rc, SQLITE_ERR_STEP);
+		set_sqlite_error(ctx, "sqlite::step_int", sqlite3_db_handle(s->handle));
+		ctx->error_code = code;
+		return (int){code};
+	}
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Group-commit write queue
+ *
+ * write_queue_start hands a connection to a background writer thread.
+ * Callers on any thread submit statements (optionally with a batch of
+ * parameter rows) and get a ticket; the writer coalesces pending writes
+ * into one IMMEDIATE transaction every interval_ms or max_ops writes,
+ * whichever comes first. Each write runs inside its own savepoint, so a
+ * failing write is rolled back and reported on its ticket without
+ * affecting the rest of the group.
+ * ------------------------------------------------------------------------ */
+
+/** BEGIN IMMEDIATE retries (1, 2, 4 ... ms) when no busy backoff is set */
+#define SQLITE_WRITE_BEGIN_RETRIES 8
+
+typedef struct qdsqlite_write {
+	char* sql;
+	size_t sql_len;
+	qdsqlite_batch* batch;  /* owned; NULL runs the statement once */
+	int done;
+	int code;               /* SQLITE_ERR_* result */
+	char* message;          /* error message, NULL on success */
+	int64_t changes;
+	int aborted;            /* ended the group transaction; not run again */
+	struct qdsqlite_write* next;
+} qdsqlite_write;
+
+typedef struct qdsqlite_write_queue {
+	qdsqlite_db* conn;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t work;       /* signalled on submit and stop */
+	pthread_cond_t completed;  /* broadcast after each group */
+	qdsqlite_write* head;
+	qdsqlite_write* tail;
+	int64_t pending;
+	int64_t interval_ms;
+	int64_t max_ops;
+	int stopping;
+} qdsqlite_write_queue;
+
+static void write_fail(qdsqlite_write* w, int code, const char* message) {
+	free(w->message);
+	w->message = strdup(message ? message : "failed");
+	w->code = code;
+}
+
+/**
+ * Whether sql holds more than the statement s was prepared from. Only
+ * whitespace and comments may follow it.
+ */
+static int write_has_tail(qdsqlite_db* conn, qdsqlite_stmt* s, const char* sql, size_t len) {
+	size_t used = strlen(sqlite3_sql(s->handle));
+	if (used >= len) return 0;
+
+	sqlite3_stmt* extra = NULL;
+	int rc = sqlite3_prepare_v2(conn->handle, sql + used, (int)(len - used), &extra, NULL);
+	sqlite3_finalize(extra);
+	return rc != SQLITE_OK || extra != NULL;
+}
+
+/** Run one queued write inside its own savepoint */
+static void write_run(qdsqlite_db* conn, qdsqlite_write* w) {
+	w->code = SQLITE_ERR_OK;
+
+	int rc = tx_run(conn, TX_SAVEPOINT);
+	if (rc != SQLITE_OK) {
+		write_fail(w, error_code_for(rc, SQLITE_ERR_EXEC), sqlite3_errmsg(conn->handle));
+		return;
+	}
+
+	qdsqlite_stmt* s = NULL;
+	rc = cache_prepare(conn, w->sql, w->sql_len, &s);
+	if (rc != SQLITE_OK) {
+		write_fail(w, SQLITE_ERR_PREPARE, sqlite3_errmsg(conn->handle));
+		tx_run(conn, TX_RELEASE);
+		return;
+	}
+
+	sqlite3_int64 before = sqlite3_total_changes64(conn->handle);
+	if (write_has_tail(conn, s, w->sql, w->sql_len)) {
+		write_fail(w, SQLITE_ERR_INVALID_ARG, "SQL must be a single statement");
+	} else if (sqlite3_stmt_readonly(s->handle) && sqlite3_column_count(s->handle) == 0) {
+		/* BEGIN, COMMIT, ROLLBACK, SAVEPOINT and RELEASE would end or split the group */
+		write_fail(w, SQLITE_ERR_INVALID_ARG, "transaction control statements cannot be queued");
+	} else if (w->batch) {
+		qdsqlite_batch* b = w->batch;
+		if (b->ncols <= 0 || b->cells % b->ncols != 0 || sqlite3_bind_parameter_count(s->handle) != b->ncols) {
+			write_fail(w, SQLITE_ERR_INVALID_ARG, "batch columns do not match statement parameters");
+		} else {
+			int failed_bind = 0;
+			rc = batch_execute(b, s->handle, &failed_bind);
+			if (rc != SQLITE_OK) {
+				write_fail(w, failed_bind ? SQLITE_ERR_BIND : error_code_for(rc, SQLITE_ERR_STEP),
+				           sqlite3_errmsg(conn->handle));
+			}
+		}
+	} else {
+		do {
+			rc = sqlite3_step(s->handle);
+		} while (rc == SQLITE_ROW);
+		if (rc != SQLITE_DONE) {
+			write_fail(w, error_code_for(rc, SQLITE_ERR_STEP), sqlite3_errmsg(conn->handle));
+		}
+	}
+	cache_return(conn, s);
+
+	if (w->code != SQLITE_ERR_OK) {
+		tx_run(conn, TX_ROLLBACK_TO);
+	} else {
+		w->changes = sqlite3_total_changes64(conn->handle) - before;
+	}
+	tx_run(conn, TX_RELEASE);
+}
+
+/**
+ * BEGIN IMMEDIATE for a group, retrying SQLITE_BUSY with the
+ * connection's set_busy_backoff schedule, or up to
+ * SQLITE_WRITE_BEGIN_RETRIES short doubling sleeps when none is set.
+ * Covers the BUSY results SQLite returns without calling the busy
+ * handler, so one contended moment doesn't fail every ticket.
+ */
+static int write_begin(qdsqlite_db* conn) {
+	for (int attempt = 0;; attempt++) {
+		int rc = tx_run(conn, TX_BEGIN_IMMEDIATE);
+		if ((rc & 0xff) != SQLITE_BUSY) return rc;
+		if (conn->busy_max_retries > 0) {
+			if (!busy_backoff(conn, attempt)) return rc;
+		} else {
+			if (attempt >= SQLITE_WRITE_BEGIN_RETRIES) return rc;
+			sqlite3_sleep(1 << attempt);
+		}
+	}
+}
+
+/** Run a group of writes in one transaction */
+static void write_group(qdsqlite_db* conn, qdsqlite_write* group) {
+	int rc;
+	for (;;) {
+		rc = write_begin(conn);
+		if (rc != SQLITE_OK) {
+			int code = error_code_for(rc, SQLITE_ERR_EXEC);
+			for (qdsqlite_write* w = group; w; w = w->next) {
+				if (!w->aborted) write_fail(w, code, sqlite3_errmsg(conn->handle));
+			}
+			return;
+		}
+
+		/*
+		 * Some failures (INSERT OR ROLLBACK, SQLITE_FULL, ...) roll back the
+		 * whole transaction, undoing the writes before them. Keep that
+		 * write's error and run the others again in a new transaction.
+		 */
+		qdsqlite_write* aborted = NULL;
+		for (qdsqlite_write* w = group; w && !aborted; w = w->next) {
+			if (w->aborted) continue;
+			write_run(conn, w);
+			if (sqlite3_get_autocommit(conn->handle)) aborted = w;
+		}
+		if (!aborted) break;
+		aborted->aborted = 1;
+		if (aborted->code == SQLITE_ERR_OK) {
+			write_fail(aborted, SQLITE_ERR_EXEC, "write ended the group transaction");
+		}
+	}
+
+	rc = tx_run(conn, TX_COMMIT);
+	if (rc != SQLITE_OK) {
+		int code = error_code_for(rc, SQLITE_ERR_EXEC);
+		for (qdsqlite_write* w = group; w; w = w->next) {
+			if (w->code == SQLITE_ERR_OK) write_fail(w, code, sqlite3_errmsg(conn->handle));
+		}
+		tx_run(conn, TX_ROLLBACK);
+	}
+}
+
+static void* write_queue_main(void* arg) {
+	qdsqlite_write_queue* q = (qdsqlite_write_queue*)arg;
+
+	pthread_mutex_lock(&q->lock);
+	for (;;) {
+		while (!q->head && !q->stopping) pthread_cond_wait(&q->work, &q->lock);
+		if (!q->head) break;
+
+		/* Let the group fill for up to interval_ms after its first write */
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += q->interval_ms / 1000;
+		deadline.tv_nsec += (q->interval_ms % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		while (q->pending < q->max_ops && !q->stopping) {
+			if (pthread_cond_timedwait(&q->work, &q->lock, &deadline) != 0) break;
+		}
+
+		/* Detach up to max_ops writes */
+		qdsqlite_write* group = q->head;
+		qdsqlite_write* last = group;
+		int64_t n = 1;
+		while (n < q->max_ops && last->next) {
+			last = last->next;
+			n++;
+		}
+		q->head = last->next;
+		if (!q->head) q->tail = NULL;
+		last->next = NULL;
+		q->pending -= n;
+		pthread_mutex_unlock(&q->lock);
+
+		write_group(q->conn, group);
+
+		pthread_mutex_lock(&q->lock);
+		for (qdsqlite_write* w = group; w;) {
+			qdsqlite_write* next = w->next;
+			if (w->batch) {
+				batch_destroy(w->batch);
+				w->batch = NULL;
+			}
+			w->next = NULL;
+			w->done = 1;
+			w = next;
+		}
+		pthread_cond_broadcast(&q->completed);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return NULL;
+}
+
+/**
+ * write_queue_start - Hand a connection to a group-commit writer thread
+ * Stack: (interval_ms:i64 max_ops:i64 db:ptr -- queue:ptr)!
+ */
+int usr_sqlite_write_queue_start(qd_context* ctx) {
+	qd_stack_element_t db_elem, max_elem, interval_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::write_queue_start: expected database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &max_elem);
+	if (err != QD_STACK_OK || max_elem.type != QD_STACK_TYPE_INT || max_elem.value.i < 1) {
+		set_error_msg(ctx, "sqlite::write_queue_start: expected positive max_ops");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &interval_elem);
+	if (err != QD_STACK_OK || interval_elem.type != QD_STACK_TYPE_INT || interval_elem.value.i < 0) {
+		set_error_msg(ctx, "sqlite::write_queue_start: expected non-negative interval_ms");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_db* conn = (qdsqlite_db*)db_elem.value.p;
+	if (!sqlite3_get_autocommit(conn->handle)) {
+		set_error_msg(ctx, "sqlite::write_queue_start: connection has an open transaction");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_write_queue* q = calloc(1, sizeof(qdsqlite_write_queue));
+	if (!q) {
+		set_error_msg(ctx, "sqlite::write_queue_start: out of memory");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+	q->conn = conn;
+	q->interval_ms = interval_elem.value.i;
+	q->max_ops = max_elem.value.i;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->work, NULL);
+	pthread_cond_init(&q->completed, NULL);
+
+	if (pthread_create(&q->thread, NULL, write_queue_main, q) != 0) {
+		pthread_cond_destroy(&q->completed);
+		pthread_cond_destroy(&q->work);
+		pthread_mutex_destroy(&q->lock);
+		free(q);
+		set_error_msg(ctx, "sqlite::write_queue_start: failed to start writer thread");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qd_push_p(ctx, q);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/** Queue a write; takes ownership of batch (may be NULL) */
+static int write_enqueue(qd_context* ctx, const char* prefix, qdsqlite_write_queue* q,
+                         qd_string_t* sql, qdsqlite_batch* batch) {
+	char msg[96];
+	qdsqlite_write* w = calloc(1, sizeof(qdsqlite_write));
+	size_t len = qd_string_length(sql);
+	char* copy = w ? malloc(len + 1) : NULL;
+	if (!copy) {
+		free(w);
+		qd_string_release(sql);
+		if (batch) batch_destroy(batch);
+		snprintf(msg, sizeof(msg), "%s: out of memory", prefix);
+		set_error_msg(ctx, msg);
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+	memcpy(copy, qd_string_data(sql), len);
+	copy[len] = '\0';
+	qd_string_release(sql);
+	w->sql = copy;
+	w->sql_len = len;
+	w->batch = batch;
+
+	pthread_mutex_lock(&q->lock);
+	if (q->tail) {
+		q->tail->next = w;
+	} else {
+		q->head = w;
+	}
+	q->tail = w;
+	q->pending++;
+	pthread_cond_signal(&q->work);
+	pthread_mutex_unlock(&q->lock);
+
+	qd_push_p(ctx, w);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * write_submit - Queue a statement for the next group commit
+ * Stack: (sql:str queue:ptr -- ticket:ptr)!
+ */
+int usr_sqlite_write_submit(qd_context* ctx) {
+	qd_stack_element_t queue_elem, sql_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &queue_elem);
+	if (err != QD_STACK_OK || queue_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::write_submit: expected queue pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &sql_elem);
+	if (err != QD_STACK_OK || sql_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::write_submit: expected SQL string");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	return write_enqueue(ctx, "sqlite::write_submit", (qdsqlite_write_queue*)queue_elem.value.p,
+	                     sql_elem.value.s, NULL);
+}
+
+/**
+ * write_submit_batch - Queue a statement with parameter rows
+ * Stack: (sql:str batch:ptr queue:ptr -- ticket:ptr)!
+ */
+int usr_sqlite_write_submit_batch(qd_context* ctx) {
+	qd_stack_element_t queue_elem, batch_elem, sql_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &queue_elem);
+	if (err != QD_STACK_OK || queue_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::write_submit_batch: expected queue pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &batch_elem);
+	if (err != QD_STACK_OK || batch_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::write_submit_batch: expected batch pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &sql_elem);
+	if (err != QD_STACK_OK || sql_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::write_submit_batch: expected SQL string");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	return write_enqueue(ctx, "sqlite::write_submit_batch", (qdsqlite_write_queue*)queue_elem.value.p,
+	                     sql_elem.value.s, (qdsqlite_batch*)batch_elem.value.p);
+}
+
+/**
+ * write_wait - Wait for a queued write to commit and free its ticket
+ * Stack: (ticket:ptr queue:ptr -- changes:i64)!
+ */
+int usr_sqlite_write_wait(qd_context* ctx) {
+	qd_stack_element_t queue_elem, ticket_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &queue_elem);
+	if (err != QD_STACK_OK || queue_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::write_wait: expected queue pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &ticket_elem);
+	if (err != QD_STACK_OK || ticket_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::write_wait: expected ticket pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_write_queue* q = (qdsqlite_write_queue*)queue_elem.value.p;
+	qdsqlite_write* w = (qdsqlite_write*)ticket_elem.value.p;
+
+	pthread_mutex_lock(&q->lock);
+	while (!w->done) pthread_cond_wait(&q->completed, &q->lock);
+	pthread_mutex_unlock(&q->lock);
+
+	int code = w->code;
+	int64_t changes = w->changes;
+	if (code != SQLITE_ERR_OK) set_prefixed_error(ctx, "sqlite::write_wait", w->message);
+	free(w->message);
+	free(w->sql);
+	free(w);
+
+	if (code != SQLITE_ERR_OK) {
+		ctx->error_code = code;
+		return code;
+	}
+
+	qd_push_i(ctx, changes);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * write_queue_stop - Commit pending writes and stop the writer thread
+ * Stack: (queue:ptr -- )
+ */
+int usr_sqlite_write_queue_stop(qd_context* ctx) {
+	qd_stack_element_t queue_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &queue_elem);
+	if (err != QD_STACK_OK || queue_elem.type != QD_STACK_TYPE_PTR) {
+		return 0;
+	}
+
+	qdsqlite_write_queue* q = (qdsqlite_write_queue*)queue_elem.value.p;
+	if (!q) return 0;
+
+	pthread_mutex_lock(&q->lock);
+	q->stopping = 1;
+	pthread_cond_signal(&q->work);
+	pthread_mutex_unlock(&q->lock);
+	pthread_join(q->thread, NULL);
+
+	pthread_cond_destroy(&q->completed);
+	pthread_cond_destroy(&q->work);
+	pthread_mutex_destroy(&q->lock);
+	free(q);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Asynchronous queries
+ *
+ * query_async runs a query on a shared pool of native worker threads and
+ * returns a handle. The worker steps the query into batches of chunk rows
+ * and queues up to SQLITE_ASYNC_DEPTH of them; async_await hands them to
+ * the caller in order. A query whose queue is full parks with its
+ * statement open and gives its worker back to the pool; taking a batch
+ * requeues it, so queries nobody drains cannot starve the others. The
+ * connection belongs to the query until the handle is freed.
+ * ------------------------------------------------------------------------ */
+
+/** Worker threads shared by all asynchronous queries */
+#define SQLITE_ASYNC_WORKERS 4
+
+/** Upper bound when parallel_scan grows the pool */
+#define SQLITE_ASYNC_MAX_WORKERS 64
+
+/** Result batches buffered per query before it parks */
+#define SQLITE_ASYNC_DEPTH 4
+
+/** Wakes one waiter across several async queries (see parallel_scan) */
+typedef struct async_notify {
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	uint64_t seq;
+} async_notify;
+
+static void async_notify_signal(async_notify* n) {
+	if (!n) return;
+	pthread_mutex_lock(&n->lock);
+	n->seq++;
+	pthread_cond_broadcast(&n->changed);
+	pthread_mutex_unlock(&n->lock);
+}
+
+typedef struct qdsqlite_async {
+	qdsqlite_db* conn;
+	char* sql;
+	size_t sql_len;
+	qdsqlite_batch* params;  /* owned; first row is bound, may be NULL */
+	int64_t chunk;
+	int ncols;
+
+	pthread_mutex_t lock;
+	pthread_cond_t changed;  /* batch queued, finished, cancelled */
+	qdsqlite_batch* ready[SQLITE_ASYNC_DEPTH];
+	int ready_head;
+	int ready_count;
+	qdsqlite_stmt* stmt;  /* open while running or parked */
+	int parked;           /* ready is full and no worker holds the query */
+	int finished;
+	int cancelled;
+	int code;       /* SQLITE_ERR_* result once finished */
+	char* message;  /* error message, NULL on success */
+	async_notify* notify;  /* also signalled on batch or finish, may be NULL */
+
+	struct qdsqlite_async* next;  /* worker pool queue */
+} qdsqlite_async;
+
+static struct {
+	pthread_once_t once;
+	pthread_mutex_t lock;
+	pthread_cond_t work;
+	qdsqlite_async* head;
+	qdsqlite_async* tail;
+	int workers;
+} async_pool = {PTHREAD_ONCE_INIT, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, NULL, NULL, 0};
+
+static void async_fail(qdsqlite_async* a, int code, const char* message) {
+	pthread_mutex_lock(&a->lock);
+	if (a->code == SQLITE_ERR_OK) {
+		a->code = code;
+		a->message = strdup(message ? message : "failed");
+	}
+	pthread_mutex_unlock(&a->lock);
+}
+
+static void async_enqueue(qdsqlite_async* a) {
+	pthread_mutex_lock(&async_pool.lock);
+	if (async_pool.tail) {
+		async_pool.tail->next = a;
+	} else {
+		async_pool.head = a;
+	}
+	async_pool.tail = a;
+	pthread_cond_signal(&async_pool.work);
+	pthread_mutex_unlock(&async_pool.lock);
+}
+
+/**
+ * Take the oldest ready batch, or NULL. Requeues a parked query now that
+ * its ring has room. Caller holds a->lock.
+ */
+static qdsqlite_batch* async_take(qdsqlite_async* a) {
+	if (a->ready_count == 0) return NULL;
+
+	qdsqlite_batch* b = a->ready[a->ready_head];
+	a->ready_head = (a->ready_head + 1) % SQLITE_ASYNC_DEPTH;
+	a->ready_count--;
+	if (a->parked) {
+		a->parked = 0;
+		async_enqueue(a);
+	}
+	return b;
+}
+
+/**
+ * Run a query on the calling worker until it finishes or its ready ring
+ * fills. Returns 1 once finished, or 0 after parking the query with its
+ * statement left open on a->stmt for whichever worker resumes it.
+ */
+static int async_run(qdsqlite_async* a) {
+	qdsqlite_db* conn = a->conn;
+	qdsqlite_stmt* s = a->stmt;
+	int rc;
+
+	if (!s) {
+		pthread_mutex_lock(&a->lock);
+		int cancelled = a->cancelled;
+		pthread_mutex_unlock(&a->lock);
+		if (cancelled) {
+			async_fail(a, SQLITE_ERR_STEP, "interrupted");
+			return 1;
+		}
+
+		rc = cache_prepare(conn, a->sql, a->sql_len, &s);
+		if (rc != SQLITE_OK) {
+			async_fail(a, SQLITE_ERR_PREPARE, rc == SQLITE_NOMEM ? "out of memory" : sqlite3_errmsg(conn->handle));
+			return 1;
+		}
+		pthread_mutex_lock(&a->lock);
+		a->ncols = sqlite3_column_count(s->handle);
+		pthread_mutex_unlock(&a->lock);
+
+		if (a->params) {
+			if (a->params->rows < 1 || a->params->cells < a->params->ncols ||
+			    sqlite3_bind_parameter_count(s->handle) != a->params->ncols) {
+				async_fail(a, SQLITE_ERR_INVALID_ARG, "params do not match statement parameters");
+				cache_return(conn, s);
+				return 1;
+			}
+			if (batch_bind_row(a->params, s->handle, 0) != SQLITE_OK) {
+				async_fail(a, SQLITE_ERR_BIND, sqlite3_errmsg(conn->handle));
+				cache_return(conn, s);
+				return 1;
+			}
+		}
+		a->stmt = s;
+	}
+
+	for (;;) {
+		/* Only this worker adds to ready, so room now means room after the fill */
+		pthread_mutex_lock(&a->lock);
+		int cancelled = a->cancelled;
+		if (!cancelled && a->ready_count == SQLITE_ASYNC_DEPTH) {
+			a->parked = 1;
+			pthread_mutex_unlock(&a->lock);
+			return 0;
+		}
+		pthread_mutex_unlock(&a->lock);
+		if (cancelled) {
+			async_fail(a, SQLITE_ERR_STEP, "interrupted");
+			break;
+		}
+
+		qdsqlite_batch* b = batch_create(a->ncols, a->chunk);
+		if (!b) {
+			async_fail(a, SQLITE_ERR_STEP, "out of memory");
+			break;
+		}
+
+		rc = batch_fill(b, s);
+		if (rc != SQLITE_ROW && rc != SQLITE_DONE) {
+			batch_destroy(b);
+			async_fail(a, error_code_for(rc, SQLITE_ERR_STEP),
+			           rc == SQLITE_NOMEM ? "out of memory" : sqlite3_errmsg(conn->handle));
+			break;
+		}
+		if (b->rows == 0) {
+			batch_destroy(b);
+			break;
+		}
+
+		pthread_mutex_lock(&a->lock);
+		a->ready[(a->ready_head + a->ready_count) % SQLITE_ASYNC_DEPTH] = b;
+		a->ready_count++;
+		pthread_cond_broadcast(&a->changed);
+		pthread_mutex_unlock(&a->lock);
+		async_notify_signal(a->notify);
+
+		if (rc == SQLITE_DONE) break;
+	}
+
+	a->stmt = NULL;
+	cache_return(conn, s);
+	return 1;
+}
+
+static void* async_worker_main(void* arg) {
+	(void)arg;
+	for (;;) {
+		pthread_mutex_lock(&async_pool.lock);
+		while (!async_pool.head) pthread_cond_wait(&async_pool.work, &async_pool.lock);
+		qdsqlite_async* a = async_pool.head;
+		async_pool.head = a->next;
+		if (!async_pool.head) async_pool.tail = NULL;
+		a->next = NULL;
+		pthread_mutex_unlock(&async_pool.lock);
+
+		if (!async_run(a)) continue;  /* parked; a may already be running elsewhere */
+
+		/* Signal notify under a->lock: a and notify may be freed once finished is seen */
+		pthread_mutex_lock(&a->lock);
+		a->finished = 1;
+		pthread_cond_broadcast(&a->changed);
+		async_notify_signal(a->notify);
+		pthread_mutex_unlock(&a->lock);
+	}
+	return NULL;
+}
+
+/** Grow the pool to at least n workers; returns the worker count. Caller holds async_pool.lock. */
+static int async_pool_grow(int n) {
+	if (n > SQLITE_ASYNC_MAX_WORKERS) n = SQLITE_ASYNC_MAX_WORKERS;
+	while (async_pool.workers < n) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, async_worker_main, NULL) != 0) break;
+		pthread_detach(thread);
+		async_pool.workers++;
+	}
+	return async_pool.workers;
+}
+
+static void async_pool_start(void) {
+	pthread_mutex_lock(&async_pool.lock);
+	async_pool_grow(SQLITE_ASYNC_WORKERS);
+	pthread_mutex_unlock(&async_pool.lock);
+}
+
+/** Create a query handle for the pool; takes ownership of params only on success */
+static qdsqlite_async* async_create(qdsqlite_db* conn, const char* sql, size_t len,
+                                    qdsqlite_batch* params, int64_t chunk) {
+	qdsqlite_async* a = calloc(1, sizeof(qdsqlite_async));
+	char* copy = a ? malloc(len + 1) : NULL;
+	if (!copy) {
+		free(a);
+		return NULL;
+	}
+	memcpy(copy, sql, len);
+	copy[len] = '\0';
+
+	a->conn = conn;
+	a->sql = copy;
+	a->sql_len = len;
+	a->params = params;
+	a->chunk = chunk;
+	a->code = SQLITE_ERR_OK;
+	pthread_mutex_init(&a->lock, NULL);
+	pthread_cond_init(&a->changed, NULL);
+	return a;
+}
+
+/** Submit a query to the worker pool; takes ownership of params (may be NULL) */
+static int async_submit(qd_context* ctx, const char* prefix, qdsqlite_db* conn,
+                        qd_string_t* sql, qdsqlite_batch* params, int64_t chunk) {
+	char msg[96];
+
+	pthread_once(&async_pool.once, async_pool_start);
+	if (async_pool.workers == 0) {
+		qd_string_release(sql);
+		if (params) batch_destroy(params);
+		snprintf(msg, sizeof(msg), "%s: failed to start worker threads", prefix);
+		set_error_msg(ctx, msg);
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_async* a = async_create(conn, qd_string_data(sql), qd_string_length(sql), params, chunk);
+	qd_string_release(sql);
+	if (!a) {
+		if (params) batch_destroy(params);
+		snprintf(msg, sizeof(msg), "%s: out of memory", prefix);
+		set_error_msg(ctx, msg);
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+	async_enqueue(a);
+
+	qd_push_p(ctx, a);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * query_async - Run a query on a worker thread
+ * Stack: (sql:str chunk:i64 db:ptr -- handle:ptr)!
+ */
+int usr_sqlite_query_async(qd_context* ctx) {
+	qd_stack_element_t db_elem, chunk_elem, sql_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::query_async: expected database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &chunk_elem);
+	if (err != QD_STACK_OK || chunk_elem.type != QD_STACK_TYPE_INT || chunk_elem.value.i <= 0) {
+		set_error_msg(ctx, "sqlite::query_async: expected positive chunk size");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &sql_elem);
+	if (err != QD_STACK_OK || sql_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::query_async: expected SQL string");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	return async_submit(ctx, "sqlite::query_async", (qdsqlite_db*)db_elem.value.p,
+	                    sql_elem.value.s, NULL, chunk_elem.value.i);
+}
+
+/**
+ * query_async_params - Run a query with parameters on a worker thread
+ * Stack: (sql:str params:ptr chunk:i64 db:ptr -- handle:ptr)!
+ */
+int usr_sqlite_query_async_params(qd_context* ctx) {
+	qd_stack_element_t db_elem, chunk_elem, params_elem, sql_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::query_async_params: expected database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &chunk_elem);
+	if (err != QD_STACK_OK || chunk_elem.type != QD_STACK_TYPE_INT || chunk_elem.value.i <= 0) {
+		set_error_msg(ctx, "sqlite::query_async_params: expected positive chunk size");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &params_elem);
+	if (err != QD_STACK_OK || params_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::query_async_params: expected params batch pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &sql_elem);
+	if (err != QD_STACK_OK || sql_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::query_async_params: expected SQL string");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	return async_submit(ctx, "sqlite::query_async_params", (qdsqlite_db*)db_elem.value.p,
+	                    sql_elem.value.s, (qdsqlite_batch*)params_elem.value.p, chunk_elem.value.i);
+}
+
+/**
+ * async_poll - Check whether async_await would return without blocking
+ * Stack: (handle:ptr -- ready:i64)
+ */
+int usr_sqlite_async_poll(qd_context* ctx) {
+	qd_stack_element_t handle_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &handle_elem);
+	if (err != QD_STACK_OK || handle_elem.type != QD_STACK_TYPE_PTR) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	qdsqlite_async* a = (qdsqlite_async*)handle_elem.value.p;
+	pthread_mutex_lock(&a->lock);
+	int ready = a->ready_count > 0 || a->finished;
+	pthread_mutex_unlock(&a->lock);
+
+	qd_push_i(ctx, ready);
+	return 0;
+}
+
+/**
+ * async_await - Wait for the next batch of an asynchronous query
+ * Stack: (handle:ptr -- batch:ptr rows:i64)!
+ */
+int usr_sqlite_async_await(qd_context* ctx) {
+	qd_stack_element_t handle_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &handle_elem);
+	if (err != QD_STACK_OK || handle_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::async_await: expected async handle");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_async* a = (qdsqlite_async*)handle_elem.value.p;
+	pthread_mutex_lock(&a->lock);
+	while (a->ready_count == 0 && !a->finished) pthread_cond_wait(&a->changed, &a->lock);
+
+	qdsqlite_batch* b = async_take(a);
+	int code = a->code;
+	int ncols = a->ncols;
+	pthread_mutex_unlock(&a->lock);
+
+	/* Batches produced before an error are delivered first */
+	if (!b && code != SQLITE_ERR_OK) {
+		set_prefixed_error(ctx, "sqlite::async_await", a->message);
+		ctx->error_code = code;
+		return code;
+	}
+
+	if (!b) {
+		b = batch_create(ncols, 1);
+		if (!b) {
+			set_error_msg(ctx, "sqlite::async_await: out of memory");
+			ctx->error_code = SQLITE_ERR_STEP;
+			return (int){SQLITE_ERR_STEP};
+		}
+	}
+
+	qd_push_p(ctx, b);
+	qd_push_i(ctx, b->rows);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/** Stop a running query; it finishes with an "interrupted" error */
+static void async_cancel(qdsqlite_async* a) {
+	pthread_mutex_lock(&a->lock);
+	if (!a->finished) {
+		a->cancelled = 1;
+		sqlite3_interrupt(a->conn->handle);
+		pthread_cond_broadcast(&a->changed);
+		if (a->parked) {
+			/* A worker picks it up, sees cancelled and finishes it */
+			a->parked = 0;
+			async_enqueue(a);
+		}
+	}
+	pthread_mutex_unlock(&a->lock);
+}
+
+/** Cancel if running, wait for the worker to let go and free the handle */
+static void async_destroy(qdsqlite_async* a) {
+	async_cancel(a);
+	pthread_mutex_lock(&a->lock);
+	while (!a->finished) pthread_cond_wait(&a->changed, &a->lock);
+	pthread_mutex_unlock(&a->lock);
+
+	for (int i = 0; i < a->ready_count; i++) {
+		batch_destroy(a->ready[(a->ready_head + i) % SQLITE_ASYNC_DEPTH]);
+	}
+	if (a->params) batch_destroy(a->params);
+	pthread_cond_destroy(&a->changed);
+	pthread_mutex_destroy(&a->lock);
+	free(a->message);
+	free(a->sql);
+	free(a);
+}
+
+/**
+ * async_cancel - Interrupt an asynchronous query
+ * Stack: (handle:ptr -- )
+ */
+int usr_sqlite_async_cancel(qd_context* ctx) {
+	qd_stack_element_t handle_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &handle_elem);
+	if (err != QD_STACK_OK || handle_elem.type != QD_STACK_TYPE_PTR) {
+		return 0;
+	}
+
+	async_cancel((qdsqlite_async*)handle_elem.value.p);
+	return 0;
+}
+
+/**
+ * async_free - Cancel if running, wait for the worker and free the handle
+ * Stack: (handle:ptr -- )
+ */
+int usr_sqlite_async_free(qd_context* ctx) {
+	qd_stack_element_t handle_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &handle_elem);
+	if (err != QD_STACK_OK || handle_elem.type != QD_STACK_TYPE_PTR) {
+		return 0;
+	}
+
+	qdsqlite_async* a = (qdsqlite_async*)handle_elem.value.p;
+	if (a) async_destroy(a);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Bulk import
+ *
+ * import_csv and import_ndjson map the input file read-only and bind each
+ * field straight from the mapping with SQLITE_STATIC through one reused
+ * INSERT statement. Rows are committed every commit_rows rows.
+ * ------------------------------------------------------------------------ */
+
+/** Import flag: PRAGMA synchronous=OFF for the duration of the import */
+#define SQLITE_IMPORT_SYNC_OFF 1
+
+/** Import flag: CSV has no header row; insert by column position */
+#define SQLITE_IMPORT_NO_HEADER 2
+
+typedef struct import_state {
+	qdsqlite_db* conn;
+	const char* prefix;
+	int flags;
+	int64_t commit_rows;  /* 0 commits once at the end */
+	int64_t pending;
+	int own_tx;
+	int old_sync;         /* -1 if synchronous was not changed */
+	char* data;           /* mapped file */
+	size_t size;
+	sqlite3_stmt* insert;
+	int64_t rows;
+	int64_t line;
+} import_state;
+
+/** Report an import error, prefixed with the current line if known */
+static int import_error(qd_context* ctx, import_state* st, int code, const char* detail) {
+	if (ctx->error_msg) free(ctx->error_msg);
+	size_t len = strlen(st->prefix) + strlen(detail) + 32;
+	ctx->error_msg = malloc(len);
+	if (ctx->error_msg) {
+		if (st->line > 0) {
+			snprintf(ctx->error_msg, len, "%s: line %lld: %s", st->prefix, (long long)st->line, detail);
+		} else {
+			snprintf(ctx->error_msg, len, "%s: %s", st->prefix, detail);
+		}
+	}
+	ctx->error_code = code;
+	return code;
+}
+
+/** Map the input file and set up synchronous and the first transaction */
+static int import_open(qd_context* ctx, import_state* st, const char* path) {
+	st->old_sync = -1;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return import_error(ctx, st, SQLITE_ERR_INVALID_ARG, "cannot open input file");
+
+	struct stat sb;
+	if (fstat(fd, &sb) != 0) {
+		close(fd);
+		return import_error(ctx, st, SQLITE_ERR_INVALID_ARG, "cannot stat input file");
+	}
+	st->size = (size_t)sb.st_size;
+	if (st->size > 0) {
+		void* data = mmap(NULL, st->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) {
+			close(fd);
+			return import_error(ctx, st, SQLITE_ERR_INVALID_ARG, "cannot map input file");
+		}
+		madvise(data, st->size, MADV_SEQUENTIAL);
+		st->data = data;
+	}
+	close(fd);
+
+	sqlite3* db = st->conn->handle;
+	if (st->flags & SQLITE_IMPORT_SYNC_OFF) {
+		sqlite3_stmt* pragma = NULL;
+		if (sqlite3_prepare_v2(db, "PRAGMA synchronous", -1, &pragma, NULL) == SQLITE_OK &&
+		    sqlite3_step(pragma) == SQLITE_ROW) {
+			st->old_sync = sqlite3_column_int(pragma, 0);
+		}
+		sqlite3_finalize(pragma);
+		sqlite3_exec(db, "PRAGMA synchronous=OFF", NULL, NULL, NULL);
+	}
+
+	/* Only manage transactions when not already inside one */
+	st->own_tx = sqlite3_get_autocommit(db);
+	if (st->own_tx) {
+		int rc = tx_run(st->conn, TX_BEGIN_IMMEDIATE);
+		if (rc != SQLITE_OK) {
+			st->own_tx = 0;
+			return import_error(ctx, st, error_code_for(rc, SQLITE_ERR_EXEC), sqlite3_errmsg(db));
+		}
+	}
+	return 0;
+}
+
+/** Step the bound INSERT and commit when a batch is complete */
+static int import_insert(qd_context* ctx, import_state* st) {
+	int rc = sqlite3_step(st->insert);
+	sqlite3_reset(st->insert);
+	if (rc != SQLITE_DONE) {
+		return import_error(ctx, st, error_code_for(rc, SQLITE_ERR_STEP), sqlite3_errmsg(st->conn->handle));
+	}
+	st->rows++;
+
+	if (st->own_tx && st->commit_rows > 0 && ++st->pending >= st->commit_rows) {
+		st->pending = 0;
+		rc = tx_run(st->conn, TX_COMMIT);
+		if (rc == SQLITE_OK) rc = tx_run(st->conn, TX_BEGIN_IMMEDIATE);
+		if (rc != SQLITE_OK) {
+			return import_error(ctx, st, error_code_for(rc, SQLITE_ERR_EXEC), sqlite3_errmsg(st->conn->handle));
+		}
+	}
+	return 0;
+}
+
+/**
+ * Commit (or roll back the current batch on failure), restore synchronous
+ * and unmap. Pushes the row count on success.
+ */
+static int import_close(qd_context* ctx, import_state* st, int code) {
+	if (st->insert) {
+		sqlite3_finalize(st->insert);
+		st->insert = NULL;
+	}
+
+	if (st->own_tx) {
+		if (code == 0) {
+			int rc = tx_run(st->conn, TX_COMMIT);
+			if (rc != SQLITE_OK) {
+				code = import_error(ctx, st, error_code_for(rc, SQLITE_ERR_EXEC), sqlite3_errmsg(st->conn->handle));
+			}
+		}
+		if (code != 0 && !sqlite3_get_autocommit(st->conn->handle)) tx_run(st->conn, TX_ROLLBACK);
+	}
+
+	if (st->old_sync >= 0) {
+		char pragma[40];
+		snprintf(pragma, sizeof(pragma), "PRAGMA synchronous=%d", st->old_sync);
+		sqlite3_exec(st->conn->handle, pragma, NULL, NULL, NULL);
+	}
+
+	if (st->data) munmap(st->data, st->size);
+
+	if (code != 0) return code;
+	qd_push_i(ctx, st->rows);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/** Pop (path table commit_rows flags db) import arguments */
+static int pop_import_args(qd_context* ctx, import_state* st, qd_string_t** path, qd_string_t** table) {
+	qd_stack_element_t db_elem, flags_elem, commit_elem, table_elem, path_elem;
+	char msg[96];
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		snprintf(msg, sizeof(msg), "%s: expected database pointer", st->prefix);
+		goto invalid;
+	}
+
+	err = qd_stack_pop(ctx->st, &flags_elem);
+	if (err != QD_STACK_OK || flags_elem.type != QD_STACK_TYPE_INT) {
+		snprintf(msg, sizeof(msg), "%s: expected integer flags", st->prefix);
+		goto invalid;
+	}
+
+	err = qd_stack_pop(ctx->st, &commit_elem);
+	if (err != QD_STACK_OK || commit_elem.type != QD_STACK_TYPE_INT || commit_elem.value.i < 0) {
+		snprintf(msg, sizeof(msg), "%s: expected non-negative commit_rows", st->prefix);
+		goto invalid;
+	}
+
+	err = qd_stack_pop(ctx->st, &table_elem);
+	if (err != QD_STACK_OK || table_elem.type != QD_STACK_TYPE_STR) {
+		snprintf(msg, sizeof(msg), "%s: expected table name", st->prefix);
+		goto invalid;
+	}
+
+	err = qd_stack_pop(ctx->st, &path_elem);
+	if (err != QD_STACK_OK || path_elem.type != QD_STACK_TYPE_STR) {
+		qd_string_release(table_elem.value.s);
+		snprintf(msg, sizeof(msg), "%s: expected file path", st->prefix);
+		goto invalid;
+	}
+
+	st->conn = (qdsqlite_db*)db_elem.value.p;
+	st->flags = (int)flags_elem.value.i;
+	st->commit_rows = commit_elem.value.i;
+	*table = table_elem.value.s;
+	*path = path_elem.value.s;
+	return 0;
+
+invalid:
+	set_error_msg(ctx, msg);
+	ctx->error_code = SQLITE_ERR_INVALID_ARG;
+	return SQLITE_ERR_INVALID_ARG;
+}
+
+/**
+ * Scan one CSV field at *p. Sets start/len to the raw field text (inside
+ * the quotes if quoted) and *escaped if it contains doubled quotes.
+ * Returns 1 if a comma follows, 0 at end of record, -1 on an unterminated
+ * quote. *p is left at the next field or record.
+ */
+static int csv_field(const char** p, const char* end, const char** start, size_t* len, int* escaped) {
+	const char* q = *p;
+	*escaped = 0;
+
+	if (q < end && *q == '"') {
+		q++;
+		*start = q;
+		for (;;) {
+			if (q >= end) return -1;
+			if (*q == '"') {
+				if (q + 1 < end && q[1] == '"') {
+					*escaped = 1;
+					q += 2;
+					continue;
+				}
+				break;
+			}
+			q++;
+		}
+		*len = (size_t)(q - *start);
+		q++;
+		/* Anything between the closing quote and the delimiter is kept out */
+		while (q < end && *q != ',' && *q != '\n' && *q != '\r') q++;
+	} else {
+		*start = q;
+		while (q < end && *q != ',' && *q != '\n' && *q != '\r') q++;
+		*len = (size_t)(q - *start);
+	}
+
+	if (q < end && *q == ',') {
+		*p = q + 1;
+		return 1;
+	}
+	if (q < end && *q == '\r') q++;
+	if (q < end && *q == '\n') q++;
+	*p = q;
+	return 0;
+}
+
+/** Count the newlines in [from, to), including those inside quoted fields */
+static int64_t csv_count_lines(const char* from, const char* to) {
+	int64_t n = 0;
+	while (from < to && (from = memchr(from, '\n', (size_t)(to - from))) != NULL) {
+		n++;
+		from++;
+	}
+	return n;
+}
+
+/** Copy a quoted field, collapsing doubled quotes; caller frees */
+static char* csv_unescape(const char* start, size_t len, size_t* out_len) {
+	char* out = malloc(len + 1);
+	if (!out) return NULL;
+	size_t n = 0;
+	for (size_t i = 0; i < len; i++) {
+		out[n++] = start[i];
+		if (start[i] == '"') i++;
+	}
+	out[n] = '\0';
+	*out_len = n;
+	return out;
+}
+
+/**
+ * Build the INSERT for a CSV file. With a header, the first record at *p
+ * names the columns and *p is advanced past it; without one, the first
+ * record is only counted and inserts are positional.
+ */
+static char* csv_insert_sql(const char* table, const char** p, const char* end, int header, int* ncols) {
+	sqlite3_str* sql = sqlite3_str_new(NULL);
+	sqlite3_str_appendf(sql, "INSERT INTO \"%w\"", table);
+	if (header) sqlite3_str_appendall(sql, " (");
+
+	const char* q = *p;
+	int n = 0;
+	int more = 1;
+	while (more) {
+		const char* start;
+		size_t len;
+		int escaped;
+		more = csv_field(&q, end, &start, &len, &escaped);
+		if (more < 0) {
+			sqlite3_free(sqlite3_str_finish(sql));
+			return NULL;
+		}
+		if (header) {
+			char* name = escaped ? csv_unescape(start, len, &len) : NULL;
+			sqlite3_str_appendf(sql, "%s\"%.*w\"", n ? ", " : "", (int)len, name ? name : start);
+			free(name);
+		}
+		n++;
+	}
+
+	if (header) {
+		sqlite3_str_appendall(sql, ")");
+		*p = q;
+	}
+	sqlite3_str_appendall(sql, " VALUES (");
+	for (int i = 0; i < n; i++) sqlite3_str_appendall(sql, i ? ", ?" : "?");
+	sqlite3_str_appendall(sql, ")");
+
+	*ncols = n;
+	return sqlite3_str_finish(sql);
+}
+
+/**
+ * import_csv - Bulk load a CSV file into a table
+ * Stack: (path:str table:str commit_rows:i64 flags:i64 db:ptr -- rows:i64)!
+ */
+int usr_sqlite_import_csv(qd_context* ctx) {
+	import_state st = {0};
+	st.prefix = "sqlite::import_csv";
+	qd_string_t* path;
+	qd_string_t* table;
+
+	int code = pop_import_args(ctx, &st, &path, &table);
+	if (code) return code;
+
+	code = import_open(ctx, &st, qd_string_data(path));
+	qd_string_release(path);
+	if (code) {
+		qd_string_release(table);
+		return import_close(ctx, &st, code);
+	}
+
+	const char* p = st.data;
+	const char* end = st.data + st.size;
+	if (end - p >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0) p += 3;
+
+	if (p >= end) {
+		qd_string_release(table);
+		return import_close(ctx, &st, 0);
+	}
+
+	int header = !(st.flags & SQLITE_IMPORT_NO_HEADER);
+	int ncols = 0;
+	const char* counted = p;  /* newlines before here are in lines */
+	int64_t lines = 0;
+	char* sql = csv_insert_sql(qd_string_data(table), &p, end, header, &ncols);
+	qd_string_release(table);
+	st.line = header ? 1 : 0;
+	if (!sql) {
+		st.line = 1;
+		return import_close(ctx, &st, import_error(ctx, &st, SQLITE_ERR_INVALID_ARG, "unterminated quote"));
+	}
+
+	int rc = sqlite3_prepare_v2(st.conn->handle, sql, -1, &st.insert, NULL);
+	sqlite3_free(sql);
+	if (rc != SQLITE_OK) {
+		return import_close(ctx, &st, import_error(ctx, &st, SQLITE_ERR_PREPARE, sqlite3_errmsg(st.conn->handle)));
+	}
+
+	while (p < end) {
+		/* Records can span lines, so number them by the newlines consumed */
+		lines += csv_count_lines(counted, p);
+		counted = p;
+		st.line = lines + 1;
+		if (*p == '\n' || *p == '\r') {
+			/* Skip blank lines */
+			if (*p == '\r') p++;
+			if (p < end && *p == '\n') p++;
+			continue;
+		}
+
+		int col = 0;
+		int more = 1;
+		while (more) {
+			const char* start;
+			size_t len;
+			int escaped;
+			more = csv_field(&p, end, &start, &len, &escaped);
+			if (more < 0) return import_close(ctx, &st, import_error(ctx, &st, SQLITE_ERR_INVALID_ARG, "unterminated quote"));
+			if (col >= ncols) {
+				return import_close(ctx, &st, import_error(ctx, &st, SQLITE_ERR_INVALID_ARG, "too many fields"));
+			}
+
+			if (escaped) {
+				char* text = csv_unescape(start, len, &len);
+				if (!text) return import_close(ctx, &st, import_error(ctx, &st, SQLITE_ERR_EXEC, "out of memory"));
+				rc = sqlite3_bind_text(st.insert, col + 1, text, (int)len, free);
+			} else {
+				rc = sqlite3_bind_text(st.insert, col + 1, start, (int)len, SQLITE_STATIC);
+			}
+			if (rc != SQLITE_OK) {
+				return import_close(ctx, &st, import_error(ctx, &st, SQLITE_ERR_BIND, sqlite3_errmsg(st.conn->handle)));
+			}
+			col++;
+		}
+		if (col != ncols) {
+			return import_close(ctx, &st, import_error(ctx, &st, SQLITE_ERR_INVALID_ARG, "too few fields"));
+		}
+
+		code = import_insert(ctx, &st);
+		if (code) return import_close(ctx, &st, code);
+	}
+
+	return import_close(ctx, &st, 0);
+}
+
+/**
+ * Whether a column name can be spelled as a quoted JSON path label.
+ * SQLite path labels end at the first '"' and take no escapes, so keys
+ * holding '"' or '\\' are looked up through json_each instead.
+ */
+static int ndjson_plain_key(const char* name) {
+	return name && !strpbrk(name, "\"\\");
+}
+
+/**
+ * import_ndjson - Bulk load newline-delimited JSON objects into a table
+ * Stack: (path:str table:str commit_rows:i64 flags:i64 db:ptr -- rows:i64)!
+ */
+int usr_sqlite_import_ndjson(qd_context* ctx) {
+	import_state st = {0};
+	st.prefix = "sqlite::import_ndjson";
+	qd_string_t* path;
+	qd_string_t* table;
+
+	int code = pop_import_args(ctx, &st, &path, &table);
+	if (code) return code;
+
+	/* Map each table column to the object key of the same name */
+	sqlite3* db = st.conn->handle;
+	sqlite3_stmt* info = NULL;
+	sqlite3_str* sql = sqlite3_str_new(NULL);
+	sqlite3_str* values = sqlite3_str_new(NULL);
+	int ncols = 0;
+	if (sqlite3_prepare_v2(db, "SELECT name FROM pragma_table_info(?)", -1, &info, NULL) == SQLITE_OK) {
+		sqlite3_bind_text(info, 1, qd_string_data(table), (int)qd_string_length(table), SQLITE_STATIC);
+		sqlite3_str_appendf(sql, "INSERT INTO \"%w\" (", qd_string_data(table));
+		while (sqlite3_step(info) == SQLITE_ROW) {
+			const char* name = (const char*)sqlite3_column_text(info, 0);
+			sqlite3_str_appendf(sql, "%s\"%w\"", ncols ? ", " : "", name);
+			if (ndjson_plain_key(name)) {
+				sqlite3_str_appendf(values, "%sjson_extract(?1, ?%d)", ncols ? ", " : "", ncols + 2);
+			} else {
+				sqlite3_str_appendf(values, "%s(SELECT value FROM json_each(?1) WHERE key = ?%d)", ncols ? ", " : "", ncols + 2);
+			}
+			ncols++;
+		}
+	}
+	sqlite3_str_appendf(sql, ") SELECT %s", sqlite3_str_value(values) ? sqlite3_str_value(values) : "");
+	sqlite3_free(sqlite3_str_finish(values));
+	char* insert_sql = sqlite3_str_finish(sql);
+
+	if (ncols == 0) {
+		sqlite3_finalize(info);
+		sqlite3_free(insert_sql);
+		qd_string_release(table);
+		qd_string_release(path);
+		return import_error(ctx, &st, SQLITE_ERR_INVALID_ARG, "no such table");
+	}
+
+	/* Bind one JSON path (or raw key) per column; they stay bound across resets */
+	int rc = sqlite3_prepare_v2(db, insert_sql, -1, &st.insert, NULL);
+	sqlite3_free(insert_sql);
+	if (rc == SQLITE_OK) {
+		sqlite3_reset(info);
+		int col = 0;
+		while (sqlite3_step(info) == SQLITE_ROW) {
+			const char* name = (const char*)sqlite3_column_text(info, 0);
+			if (ndjson_plain_key(name)) {
+				sqlite3_bind_text(st.insert, col + 2, sqlite3_mprintf("$.\"%s\"", name), -1, sqlite3_free);
+			} else {
+				sqlite3_bind_text(st.insert, col + 2, name, -1, SQLITE_TRANSIENT);
+			}
+			col++;
+		}
+	}
+	sqlite3_finalize(info);
+	qd_string_release(table);
+	if (rc != SQLITE_OK) {
+		qd_string_release(path);
+		code = import_error(ctx, &st, SQLITE_ERR_PREPARE, sqlite3_errmsg(db));
+		sqlite3_finalize(st.insert);
+		return code;
+	}
+
+	code = import_open(ctx, &st, qd_string_data(path));
+	qd_string_release(path);
+	if (code) return import_close(ctx, &st, code);
+
+	const char* p = st.data;
+	const char* end = st.data + st.size;
+	while (p < end) {
+		st.line++;
+		const char* start = p;
+		const char* nl = memchr(p, '\n', (size_t)(end - p));
+		const char* stop = nl ? nl : end;
+		p = nl ? nl + 1 : end;
+
+		while (start < stop && (*start == ' ' || *start == '\t')) start++;
+		while (stop > start && (stop[-1] == '\r' || stop[-1] == ' ' || stop[-1] == '\t')) stop--;
+		if (start == stop) continue;
+
+		rc = sqlite3_bind_text(st.insert, 1, start, (int)(stop - start), SQLITE_STATIC);
+		if (rc != SQLITE_OK) {
+			return import_close(ctx, &st, import_error(ctx, &st, SQLITE_ERR_BIND, sqlite3_errmsg(db)));
+		}
+		code = import_insert(ctx, &st);
+		if (code) return import_close(ctx, &st, code);
+	}
+
+	return import_close(ctx, &st, 0);
+}
+
+/* ------------------------------------------------------------------------
+ * Result export
+ *
+ * export steps a statement natively and formats each value straight from
+ * sqlite3_column_* into a 64 KiB write buffer.
+ * ------------------------------------------------------------------------ */
+
+/** Export format: CSV with a header row */
+#define SQLITE_EXPORT_CSV 1
+
+/** Export format: one JSON object per row */
+#define SQLITE_EXPORT_NDJSON 2
+
+/** Export flag: omit the CSV header row */
+#define SQLITE_EXPORT_NO_HEADER 4
+
+#define SQLITE_EXPORT_BUFFER (64 * 1024)
+
+typedef struct export_writer {
+	int fd;
+	int failed;  /* errno of the first failed write, 0 if none */
+	size_t len;
+	char buf[SQLITE_EXPORT_BUFFER];
+} export_writer;
+
+static void export_flush(export_writer* w) {
+	size_t off = 0;
+	while (off < w->len && !w->failed) {
+		ssize_t n = write(w->fd, w->buf + off, w->len - off);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			w->failed = errno;
+		} else {
+			off += (size_t)n;
+		}
+	}
+	w->len = 0;
+}
+
+static void export_put(export_writer* w, const char* data, size_t len) {
+	while (len > 0) {
+		if (w->len == SQLITE_EXPORT_BUFFER) export_flush(w);
+		size_t n = SQLITE_EXPORT_BUFFER - w->len;
+		if (n > len) n = len;
+		memcpy(w->buf + w->len, data, n);
+		w->len += n;
+		data += n;
+		len -= n;
+	}
+}
+
+static void export_putc(export_writer* w, char c) {
+	if (w->len == SQLITE_EXPORT_BUFFER) export_flush(w);
+	w->buf[w->len++] = c;
+}
+
+static void export_int(export_writer* w, int64_t v) {
+	char tmp[24];
+	char* p = tmp + sizeof(tmp);
+	uint64_t u = v < 0 ? (uint64_t)0 - (uint64_t)v : (uint64_t)v;
+	do {
+		*--p = (char)('0' + u % 10);
+		u /= 10;
+	} while (u);
+	if (v < 0) *--p = '-';
+	export_put(w, p, (size_t)(tmp + sizeof(tmp) - p));
+}
+
+static void export_float(export_writer* w, double v, int json) {
+	char tmp[32];
+	if (json && (v != v || v - v != 0)) {
+		export_put(w, "null", 4);  /* NaN and infinities are not JSON */
+		return;
+	}
+	/* Shortest of 15 or 17 digits that reads back as the same double */
+	int n = snprintf(tmp, sizeof(tmp), "%.15g", v);
+	if (strtod(tmp, NULL) != v) n = snprintf(tmp, sizeof(tmp), "%.17g", v);
+	export_put(w, tmp, (size_t)n);
+}
+
+static void export_hex(export_writer* w, const unsigned char* data, int len) {
+	static const char digits[] = "0123456789abcdef";
+	for (int i = 0; i < len; i++) {
+		export_putc(w, digits[data[i] >> 4]);
+		export_putc(w, digits[data[i] & 15]);
+	}
+}
+
+/** Write a CSV field, quoting it only if it needs quotes */
+static void export_csv_text(export_writer* w, const char* text, size_t len) {
+	int quote = 0;
+	for (size_t i = 0; i < len; i++) {
+		char c = text[i];
+		if (c == ',' || c == '"' || c == '\n' || c == '\r') {
+			quote = 1;
+			break;
+		}
+	}
+	if (!quote) {
+		export_put(w, text, len);
+		return;
+	}
+
+	export_putc(w, '"');
+	size_t run = 0;
+	for (size_t i = 0; i < len; i++) {
+		if (text[i] == '"') {
+			export_put(w, text + run, i + 1 - run);
+			run = i;  /* the quote is written again, doubling it */
+		}
+	}
+	export_put(w, text + run, len - run);
+	export_putc(w, '"');
+}
+
+/** Write a JSON string literal */
+static void export_json_text(export_writer* w, const char* text, size_t len) {
+	static const char digits[] = "0123456789abcdef";
+	export_putc(w, '"');
+	size_t run = 0;
+	for (size_t i = 0; i < len; i++) {
+		unsigned char c = (unsigned char)text[i];
+		if (c >= 0x20 && c != '"' && c != '\\') continue;
+
+		export_put(w, text + run, i - run);
+		run = i + 1;
+		export_putc(w, '\\');
+		switch (c) {
+		case '"': export_putc(w, '"'); break;
+		case '\\': export_putc(w, '\\'); break;
+		case '\n': export_putc(w, 'n'); break;
+		case '\r': export_putc(w, 'r'); break;
+		case '\t': export_putc(w, 't'); break;
+		default:
+			export_put(w, "u00", 3);
+			export_putc(w, digits[c >> 4]);
+			export_putc(w, digits[c & 15]);
+			break;
+		}
+	}
+	export_put(w, text + run, len - run);
+	export_putc(w, '"');
+}
+
+/** Step stmt to completion writing rows; returns SQLITE_DONE or an error */
+static int export_rows(export_writer* w, qdsqlite_stmt* s, int format, int64_t* rows) {
+	sqlite3_stmt* stmt = s->handle;
+	int ncols = sqlite3_column_count(stmt);
+	int json = (format & 3) == SQLITE_EXPORT_NDJSON;
+
+	if (!json && !(format & SQLITE_EXPORT_NO_HEADER)) {
+		for (int col = 0; col < ncols; col++) {
+			const char* name = sqlite3_column_name(stmt, col);
+			if (col) export_putc(w, ',');
+			export_csv_text(w, name ? name : "", name ? strlen(name) : 0);
+		}
+		export_putc(w, '\n');
+	}
+
+	int rc;
+	while ((rc = stmt_step(s)) == SQLITE_ROW) {
+		if (json) export_putc(w, '{');
+		for (int col = 0; col < ncols; col++) {
+			if (col) export_putc(w, ',');
+			if (json) {
+				const char* name = sqlite3_column_name(stmt, col);
+				export_json_text(w, name ? name : "", name ? strlen(name) : 0);
+				export_putc(w, ':');
+			}
+
+			switch (sqlite3_column_type(stmt, col)) {
+			case SQLITE_INTEGER:
+				export_int(w, sqlite3_column_int64(stmt, col));
+				break;
+			case SQLITE_FLOAT:
+				export_float(w, sqlite3_column_double(stmt, col), json);
+				break;
+			case SQLITE_TEXT: {
+				const char* text = (const char*)sqlite3_column_text(stmt, col);
+				size_t len = (size_t)sqlite3_column_bytes(stmt, col);
+				if (json) {
+					export_json_text(w, text, len);
+				} else {
+					export_csv_text(w, text, len);
+				}
+				break;
+			}
+			case SQLITE_BLOB: {
+				const unsigned char* data = sqlite3_column_blob(stmt, col);
+				int len = sqlite3_column_bytes(stmt, col);
+				if (json) export_putc(w, '"');
+				export_hex(w, data, len);
+				if (json) export_putc(w, '"');
+				break;
+			}
+			default:
+				if (json) export_put(w, "null", 4);
+				break;
+			}
+		}
+		if (json) export_putc(w, '}');
+		export_putc(w, '\n');
+		(*rows)++;
+		if (w->failed) break;
+	}
+
+	export_flush(w);
+	return rc;
+}
+
+/** Run an export to fd; returns 0 and sets *rows, or sets the error */
+static int export_to(qd_context* ctx, const char* prefix, qdsqlite_stmt* s, int format, int fd, int64_t* rows) {
+	char msg[160];
+	int kind = format & 3;
+	if (kind != SQLITE_EXPORT_CSV && kind != SQLITE_EXPORT_NDJSON) {
+		snprintf(msg, sizeof(msg), "%s: unknown export format", prefix);
+		set_error_msg(ctx, msg);
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	export_writer* w = malloc(sizeof(export_writer));
+	if (!w) {
+		snprintf(msg, sizeof(msg), "%s: out of memory", prefix);
+		set_error_msg(ctx, msg);
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+	w->fd = fd;
+	w->failed = 0;
+	w->len = 0;
+
+	*rows = 0;
+	int rc = export_rows(w, s, format, rows);
+	int failed = w->failed;
+	free(w);
+	sqlite3_reset(s->handle);
+
+	if (failed) {
+		snprintf(msg, sizeof(msg), "%s: write failed: %s", prefix, strerror(failed));
+		set_error_msg(ctx, msg);
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+	if (rc != SQLITE_DONE) {
+		set_sqlite_error(ctx, prefix, sqlite3_db_handle(s->handle));
+		int code = error_code_for(rc, SQLITE_ERR_STEP);
+		ctx->error_code = code;
+		return code;
+	}
+	return 0;
+}
+
+/**
+ * export - Write all result rows of a statement to a file descriptor
+ * Stack: (format:i64 fd:i64 stmt:ptr -- rows:i64)!
+ */
+int usr_sqlite_export(qd_context* ctx) {
+	qd_stack_element_t stmt_elem, fd_elem, format_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::export: expected statement pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &fd_elem);
+	if (err != QD_STACK_OK || fd_elem.type != QD_STACK_TYPE_INT || fd_elem.value.i < 0) {
+		set_error_msg(ctx, "sqlite::export: expected file descriptor");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &format_elem);
+	if (err != QD_STACK_OK || format_elem.type != QD_STACK_TYPE_INT) {
+		set_error_msg(ctx, "sqlite::export: expected integer format");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	int64_t rows;
+	int code = export_to(ctx, "sqlite::export", (qdsqlite_stmt*)stmt_elem.value.p,
+	                     (int)format_elem.value.i, (int)fd_elem.value.i, &rows);
+	if (code) return code;
+
+	qd_push_i(ctx, rows);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * export_file - Write all result rows of a statement to a file
+ * Stack: (path:str format:i64 stmt:ptr -- rows:i64)!
+ */
+int usr_sqlite_export_file(qd_context* ctx) {
+	qd_stack_element_t stmt_elem, format_elem, path_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::export_file: expected statement pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &format_elem);
+	if (err != QD_STACK_OK || format_elem.type != QD_STACK_TYPE_INT) {
+		set_error_msg(ctx, "sqlite::export_file: expected integer format");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &path_elem);
+	if (err != QD_STACK_OK || path_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::export_file: expected file path");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	int fd = open(qd_string_data(path_elem.value.s), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	qd_string_release(path_elem.value.s);
+	if (fd < 0) {
+		set_error_msg(ctx, "sqlite::export_file: cannot open output file");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	int64_t rows;
+	int code = export_to(ctx, "sqlite::export_file", (qdsqlite_stmt*)stmt_elem.value.p,
+	                     (int)format_elem.value.i, fd, &rows);
+	if (close(fd) != 0 && code == 0) {
+		set_error_msg(ctx, "sqlite::export_file: write failed on close");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+	if (code) return code;
+
+	qd_push_i(ctx, rows);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Online backup
+ * ------------------------------------------------------------------------ */
+
+typedef struct qdsqlite_backup {
+	sqlite3_backup* handle;
+	sqlite3* dest;  /* backup errors are reported on the destination */
+} qdsqlite_backup;
+
+/** Set the error for a failed backup step and return its code */
+static int backup_error(qd_context* ctx, const char* prefix, sqlite3* dest, int rc) {
+	set_sqlite_error(ctx, prefix, dest);
+	int code = error_code_for(rc, SQLITE_ERR_EXEC);
+	ctx->error_code = code;
+	return code;
+}
+
+/**
+ * backup_init - Start copying src's main database into dest
+ * Stack: (dest:ptr src:ptr -- backup:ptr)!
+ */
+int usr_sqlite_backup_init(qd_context* ctx) {
+	qd_stack_element_t src_elem, dest_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &src_elem);
+	if (err != QD_STACK_OK || src_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::backup_init: expected source database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &dest_elem);
+	if (err != QD_STACK_OK || dest_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::backup_init: expected destination database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	sqlite3* src = ((qdsqlite_db*)src_elem.value.p)->handle;
+	sqlite3* dest = ((qdsqlite_db*)dest_elem.value.p)->handle;
+
+	qdsqlite_backup* b = malloc(sizeof(qdsqlite_backup));
+	if (!b) {
+		set_error_msg(ctx, "sqlite::backup_init: out of memory");
+		ctx->error_code = SQLITE_ERR_EXEC;
+		return (int){SQLITE_ERR_EXEC};
+	}
+
+	b->handle = sqlite3_backup_init(dest, "main", src, "main");
+	b->dest = dest;
+	if (!b->handle) {
+		free(b);
+		return backup_error(ctx, "sqlite::backup_init", dest, sqlite3_errcode(dest));
+	}
+
+	qd_push_p(ctx, b);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * backup_step - Copy up to pages pages (-1 for all)
+ * Stack: (pages:i64 backup:ptr -- done:i64)!
+ */
+int usr_sqlite_backup_step(qd_context* ctx) {
+	qd_stack_element_t backup_elem, pages_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &backup_elem);
+	if (err != QD_STACK_OK || backup_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::backup_step: expected backup pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &pages_elem);
+	if (err != QD_STACK_OK || pages_elem.type != QD_STACK_TYPE_INT) {
+		set_error_msg(ctx, "sqlite::backup_step: expected integer page count");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_backup* b = (qdsqlite_backup*)backup_elem.value.p;
+	int rc = sqlite3_backup_step(b->handle, (int)pages_elem.value.i);
+	if (rc != SQLITE_OK && rc != SQLITE_DONE) {
+		return backup_error(ctx, "sqlite::backup_step", b->dest, rc);
+	}
+
+	qd_push_i(ctx, rc == SQLITE_DONE);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * backup_remaining - Pages still to copy as of the last step
+ * Stack: (backup:ptr -- pages:i64)
+ */
+int usr_sqlite_backup_remaining(qd_context* ctx) {
+	qd_stack_element_t backup_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &backup_elem);
+	if (err != QD_STACK_OK || backup_elem.type != QD_STACK_TYPE_PTR) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	qdsqlite_backup* b = (qdsqlite_backup*)backup_elem.value.p;
+	qd_push_i(ctx, sqlite3_backup_remaining(b->handle));
+	return 0;
+}
+
+/**
+ * backup_pagecount - Total pages in the source as of the last step
+ * Stack: (backup:ptr -- pages:i64)
+ */
+int usr_sqlite_backup_pagecount(qd_context* ctx) {
+	qd_stack_element_t backup_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &backup_elem);
+	if (err != QD_STACK_OK || backup_elem.type != QD_STACK_TYPE_PTR) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	qdsqlite_backup* b = (qdsqlite_backup*)backup_elem.value.p;
+	qd_push_i(ctx, sqlite3_backup_pagecount(b->handle));
+	return 0;
+}
+
+/**
+ * backup_finish - Release a backup, reporting any earlier step error
+ * Stack: (backup:ptr -- )!
+ */
+int usr_sqlite_backup_finish(qd_context* ctx) {
+	qd_stack_element_t backup_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &backup_elem);
+	if (err != QD_STACK_OK || backup_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::backup_finish: expected backup pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_backup* b = (qdsqlite_backup*)backup_elem.value.p;
+	sqlite3* dest = b->dest;
+	int rc = sqlite3_backup_finish(b->handle);
+	free(b);
+	if (rc != SQLITE_OK) return backup_error(ctx, "sqlite::backup_finish", dest, rc);
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * backup_run - Copy src into dest, pages at a time with sleep_ms between
+ * Stack: (pages:i64 sleep_ms:i64 dest:ptr src:ptr -- )!
+ */
+int usr_sqlite_backup_run(qd_context* ctx) {
+	qd_stack_element_t src_elem, dest_elem, sleep_elem, pages_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &src_elem);
+	if (err != QD_STACK_OK || src_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::backup_run: expected source database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &dest_elem);
+	if (err != QD_STACK_OK || dest_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::backup_run: expected destination database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &sleep_elem);
+	if (err != QD_STACK_OK || sleep_elem.type != QD_STACK_TYPE_INT || sleep_elem.value.i < 0) {
+		set_error_msg(ctx, "sqlite::backup_run: expected non-negative sleep_ms");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &pages_elem);
+	if (err != QD_STACK_OK || pages_elem.type != QD_STACK_TYPE_INT || pages_elem.value.i == 0) {
+		set_error_msg(ctx, "sqlite::backup_run: expected non-zero page count");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	sqlite3* src = ((qdsqlite_db*)src_elem.value.p)->handle;
+	sqlite3* dest = ((qdsqlite_db*)dest_elem.value.p)->handle;
+	sqlite3_backup* b = sqlite3_backup_init(dest, "main", src, "main");
+	if (!b) return backup_error(ctx, "sqlite::backup_run", dest, sqlite3_errcode(dest));
+
+	/* Busy and locked steps are retried after the sleep, as the docs suggest */
+	int rc;
+	do {
+		rc = sqlite3_backup_step(b, (int)pages_elem.value.i);
+		if (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED) {
+			if (sleep_elem.value.i > 0) sqlite3_sleep((int)sleep_elem.value.i);
+		}
+	} while (rc == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED);
+
+	sqlite3_backup_finish(b);
+	if (rc != SQLITE_DONE) return backup_error(ctx, "sqlite::backup_run", dest, rc);
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Column metadata
+ * ------------------------------------------------------------------------ */
+
+/**
+ * column_index - Find a result column by name (ASCII case-insensitive)
+ * Stack: (name:str stmt:ptr -- index:i64)
+ */
+int usr_sqlite_column_index(qd_context* ctx) {
+	qd_stack_element_t stmt_elem, name_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		qd_push_i(ctx, -1);
+		return 0;
+	}
+
+	err = qd_stack_pop(ctx->st, &name_elem);
+	if (err != QD_STACK_OK || name_elem.type != QD_STACK_TYPE_STR) {
+		qd_push_i(ctx, -1);
+		return 0;
+	}
+
+	stmt_meta* m = stmt_meta_get((qdsqlite_stmt*)stmt_elem.value.p);
+	const char* name = qd_string_data(name_elem.value.s);
+	size_t len = qd_string_length(name_elem.value.s);
+	int64_t index = -1;
+
+	if (m) {
+		size_t slot = meta_hash(name, len) & (m->nslots - 1);
+		while (m->slots[slot]) {
+			qd_string_t* other = m->names[m->slots[slot] - 1];
+			if (qd_string_length(other) == len && sqlite3_strnicmp(qd_string_data(other), name, (int)len) == 0) {
+				index = m->slots[slot] - 1;
+				break;
+			}
+			slot = (slot + 1) & (m->nslots - 1);
+		}
+	}
+
+	qd_string_release(name_elem.value.s);
+	qd_push_i(ctx, index);
+	return 0;
+}
+
+/** Pop (index stmt) and push one metadata string, "" if unavailable */
+static int push_meta_string(qd_context* ctx, size_t field) {
+	qd_stack_element_t stmt_elem, index_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		qd_push_s(ctx, "");
+		return 0;
+	}
+
+	err = qd_stack_pop(ctx->st, &index_elem);
+	if (err != QD_STACK_OK || index_elem.type != QD_STACK_TYPE_INT) {
+		qd_push_s(ctx, "");
+		return 0;
+	}
+
+	stmt_meta* m = stmt_meta_get((qdsqlite_stmt*)stmt_elem.value.p);
+	int64_t index = index_elem.value.i;
+	if (!m || index < 0 || index >= m->ncols) {
+		qd_push_s(ctx, "");
+		return 0;
+	}
+
+	qd_string_t** fields[] = {m->names, m->decltypes, m->tables, m->origins};
+	qd_push_s_ref(ctx, fields[field][index]);
+	return 0;
+}
+
+/**
+ * column_decltype - Get the declared type of a result column
+ * Stack: (index:i64 stmt:ptr -- decltype:str)
+ */
+int usr_sqlite_column_decltype(qd_context* ctx) {
+	return push_meta_string(ctx, 1);
+}
+
+/**
+ * column_table - Get the table a result column comes from
+ * Stack: (index:i64 stmt:ptr -- table:str)
+ */
+int usr_sqlite_column_table(qd_context* ctx) {
+	return push_meta_string(ctx, 2);
+}
+
+/**
+ * column_origin - Get the table column a result column comes from
+ * Stack: (index:i64 stmt:ptr -- column:str)
+ */
+int usr_sqlite_column_origin(qd_context* ctx) {
+	return push_meta_string(ctx, 3);
+}
+
+/* ------------------------------------------------------------------------
+ * Named parameters
+ *
+ * The first lookup on a statement hashes all of its parameter names once,
+ * so binding by name afterwards costs a hash probe instead of a scan
+ * through sqlite3_bind_parameter_index.
+ * ------------------------------------------------------------------------ */
+
+/** FNV-1a over a parameter's prefix character and the rest of its name */
+static uint64_t param_hash(char prefix, const char* name, size_t len) {
+	uint64_t h = 14695981039346656037ULL;
+	h ^= (unsigned char)prefix;
+	h *= 1099511628211ULL;
+	for (size_t i = 0; i < len; i++) {
+		h ^= (unsigned char)name[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static int param_probe(qdsqlite_stmt* s, char prefix, const char* name, size_t len) {
+	size_t mask = s->param_nslots - 1;
+	size_t slot = param_hash(prefix, name, len) & mask;
+	while (s->param_slots[slot]) {
+		const char* other = sqlite3_bind_parameter_name(s->handle, s->param_slots[slot]);
+		if (other[0] == prefix && strncmp(other + 1, name, len) == 0 && other[len + 1] == '\0') {
+			return s->param_slots[slot];
+		}
+		slot = (slot + 1) & mask;
+	}
+	return 0;
+}
+
+/**
+ * Resolve a parameter name to its 1-based index, 0 if unknown. The name
+ * may include its prefix (":id") or omit it ("id"), in which case :, @
+ * and $ are tried in that order.
+ */
+static int param_lookup(qdsqlite_stmt* s, const char* name, size_t len) {
+	if (!s->param_slots) {
+		int count = sqlite3_bind_parameter_count(s->handle);
+		size_t nslots = 8;
+		while (nslots < 2 * (size_t)count) nslots *= 2;
+		int* slots = calloc(nslots, sizeof(int));
+		if (!slots) return sqlite3_bind_parameter_index(s->handle, name);
+
+		for (int i = 1; i <= count; i++) {
+			const char* pname = sqlite3_bind_parameter_name(s->handle, i);
+			if (!pname) continue;  /* anonymous ? */
+			size_t slot = param_hash(pname[0], pname + 1, strlen(pname + 1)) & (nslots - 1);
+			while (slots[slot]) {
+				/* ?NNN and repeated names resolve to one index; keep the first */
+				if (strcmp(sqlite3_bind_parameter_name(s->handle, slots[slot]), pname) == 0) break;
+				slot = (slot + 1) & (nslots - 1);
+			}
+			if (!slots[slot]) slots[slot] = i;
+		}
+		s->param_slots = slots;
+		s->param_nslots = nslots;
+	}
+
+	if (len == 0) return 0;
+	if (name[0] == ':' || name[0] == '@' || name[0] == '$' || name[0] == '?') {
+		return param_probe(s, name[0], name + 1, len - 1);
+	}
+	int index = param_probe(s, ':', name, len);
+	if (!index) index = param_probe(s, '@', name, len);
+	if (!index) index = param_probe(s, '$', name, len);
+	return index;
+}
+
+/**
+ * param_index - Get the index of a named parameter
+ * Stack: (name:str stmt:ptr -- index:i64)
+ */
+int usr_sqlite_param_index(qd_context* ctx) {
+	qd_stack_element_t stmt_elem, name_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	err = qd_stack_pop(ctx->st, &name_elem);
+	if (err != QD_STACK_OK || name_elem.type != QD_STACK_TYPE_STR) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	int index = param_lookup((qdsqlite_stmt*)stmt_elem.value.p, qd_string_data(name_elem.value.s),
+	                         qd_string_length(name_elem.value.s));
+	qd_string_release(name_elem.value.s);
+	qd_push_i(ctx, index);
+	return 0;
+}
+
+/**
+ * bind_count - Get the number of parameters of a statement
+ * Stack: (stmt:ptr -- count:i64)
+ */
+int usr_sqlite_bind_count(qd_context* ctx) {
+	qd_stack_element_t stmt_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	sqlite3_stmt* stmt = ((qdsqlite_stmt*)stmt_elem.value.p)->handle;
+	qd_push_i(ctx, sqlite3_bind_parameter_count(stmt));
+	return 0;
+}
+
+/**
+ * Pop the (name stmt) part of a named bind and resolve the parameter.
+ * Returns 0 with *stmt and *index set, or the error code. An unknown
+ * name leaves *index 0 so the caller can pop its value before failing.
+ */
+static int pop_named_param(qd_context* ctx, const char* prefix, sqlite3_stmt** stmt, int* index) {
+	qd_stack_element_t stmt_elem, name_elem;
+	char msg[160];
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		snprintf(msg, sizeof(msg), "%s: expected statement pointer", prefix);
+		set_error_msg(ctx, msg);
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &name_elem);
+	if (err != QD_STACK_OK || name_elem.type != QD_STACK_TYPE_STR) {
+		snprintf(msg, sizeof(msg), "%s: expected parameter name", prefix);
+		set_error_msg(ctx, msg);
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_stmt* s = (qdsqlite_stmt*)stmt_elem.value.p;
+	const char* name = qd_string_data(name_elem.value.s);
+	*stmt = s->handle;
+	*index = param_lookup(s, name, qd_string_length(name_elem.value.s));
+	qd_string_release(name_elem.value.s);
+	return 0;
+}
+
+static int named_param_missing(qd_context* ctx, const char* prefix) {
+	char msg[160];
+	snprintf(msg, sizeof(msg), "%s: no such parameter", prefix);
+	set_error_msg(ctx, msg);
+	ctx->error_code = SQLITE_ERR_BIND;
+	return (int){SQLITE_ERR_BIND};
+}
+
+/**
+ * bind_text_named - Bind string parameter by name
+ * Stack: (value:str name:str stmt:ptr -- )!
+ */
+int usr_sqlite_bind_text_named(qd_context* ctx) {
+	qd_stack_element_t value_elem;
+	sqlite3_stmt* stmt;
+	int index;
+
+	int code = pop_named_param(ctx, "sqlite::bind_text_named", &stmt, &index);
+	if (code) return code;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &value_elem);
+	if (err != QD_STACK_OK || value_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::bind_text_named: expected string value");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+	if (index == 0) {
+		qd_string_release(value_elem.value.s);
+		return named_param_missing(ctx, "sqlite::bind_text_named");
+	}
+
+	int rc = sqlite3_bind_text(stmt, index, qd_string_data(value_elem.value.s),
+	                           (int)qd_string_length(value_elem.value.s), SQLITE_TRANSIENT);
+	qd_string_release(value_elem.value.s);
+
+	if (rc != SQLITE_OK) {
+		set_error_msg(ctx, "sqlite::bind_text_named: bind failed");
+		ctx->error_code = SQLITE_ERR_BIND;
+		return (int){SQLITE_ERR_BIND};
+	}
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * bind_int_named - Bind integer parameter by name
+ * Stack: (value:i64 name:str stmt:ptr -- )!
+ */
+int usr_sqlite_bind_int_named(qd_context* ctx) {
+	qd_stack_element_t value_elem;
+	sqlite3_stmt* stmt;
+	int index;
+
+	int code = pop_named_param(ctx, "sqlite::bind_int_named", &stmt, &index);
+	if (code) return code;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &value_elem);
+	if (err != QD_STACK_OK || value_elem.type != QD_STACK_TYPE_INT) {
+		set_error_msg(ctx, "sqlite::bind_int_named: expected integer value");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+	if (index == 0) return named_param_missing(ctx, "sqlite::bind_int_named");
+
+	if (sqlite3_bind_int64(stmt, index, value_elem.value.i) != SQLITE_OK) {
+		set_error_msg(ctx, "sqlite::bind_int_named: bind failed");
+		ctx->error_code = SQLITE_ERR_BIND;
+		return (int){SQLITE_ERR_BIND};
+	}
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * bind_float_named - Bind float parameter by name
+ * Stack: (value:f64 name:str stmt:ptr -- )!
+ */
+int usr_sqlite_bind_float_named(qd_context* ctx) {
+	qd_stack_element_t value_elem;
+	sqlite3_stmt* stmt;
+	int index;
+
+	int code = pop_named_param(ctx, "sqlite::bind_float_named", &stmt, &index);
+	if (code) return code;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &value_elem);
+	if (err != QD_STACK_OK || value_elem.type != QD_STACK_TYPE_FLOAT) {
+		set_error_msg(ctx, "sqlite::bind_float_named: expected float value");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+	if (index == 0) return named_param_missing(ctx, "sqlite::bind_float_named");
+
+	if (sqlite3_bind_double(stmt, index, value_elem.value.f) != SQLITE_OK) {
+		set_error_msg(ctx, "sqlite::bind_float_named: bind failed");
+		ctx->error_code = SQLITE_ERR_BIND;
+		return (int){SQLITE_ERR_BIND};
+	}
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * bind_null_named - Bind NULL parameter by name
+ * Stack: (name:str stmt:ptr -- )!
+ */
+int usr_sqlite_bind_null_named(qd_context* ctx) {
+	sqlite3_stmt* stmt;
+	int index;
+
+	int code = pop_named_param(ctx, "sqlite::bind_null_named", &stmt, &index);
+	if (code) return code;
+	if (index == 0) return named_param_missing(ctx, "sqlite::bind_null_named");
+
+	if (sqlite3_bind_null(stmt, index) != SQLITE_OK) {
+		set_error_msg(ctx, "sqlite::bind_null_named: bind failed");
+		ctx->error_code = SQLITE_ERR_BIND;
+		return (int){SQLITE_ERR_BIND};
+	}
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * bind_blob_named - Bind BLOB parameter by name (copies data)
+ * Stack: (data:ptr len:i64 name:str stmt:ptr -- )!
+ */
+int usr_sqlite_bind_blob_named(qd_context* ctx) {
+	qd_stack_element_t len_elem, data_elem;
+	sqlite3_stmt* stmt;
+	int index;
+
+	int code = pop_named_param(ctx, "sqlite::bind_blob_named", &stmt, &index);
+	if (code) return code;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &len_elem);
+	if (err != QD_STACK_OK || len_elem.type != QD_STACK_TYPE_INT || len_elem.value.i < 0 || len_elem.value.i > INT32_MAX) {
+		set_error_msg(ctx, "sqlite::bind_blob_named: expected valid length");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &data_elem);
+	if (err != QD_STACK_OK || data_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::bind_blob_named: expected data pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+	if (index == 0) return named_param_missing(ctx, "sqlite::bind_blob_named");
+
+	/* A null pointer would bind SQL NULL; bind an empty blob instead */
+	int rc = data_elem.value.p
+		? sqlite3_bind_blob(stmt, index, data_elem.value.p, (int)len_elem.value.i, SQLITE_TRANSIENT)
+		: sqlite3_bind_zeroblob(stmt, index, 0);
+
+	if (rc != SQLITE_OK) {
+		set_error_msg(ctx, "sqlite::bind_blob_named: bind failed");
+		ctx->error_code = SQLITE_ERR_BIND;
+		return (int){SQLITE_ERR_BIND};
+	}
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Materialized results
+ *
+ * query_all copies a whole result set into one handle. Cells live in a
+ * single row-major array and text, blobs and column names are bump
+ * allocated from an arena, so a result costs a handful of allocations
+ * regardless of its size and result_free releases it in one pass.
+ * ------------------------------------------------------------------------ */
+
+#define RESULT_CHUNK_MIN 4096
+#define RESULT_CHUNK_MAX (1024 * 1024)
+
+typedef struct result_chunk {
+	struct result_chunk* next;
+	size_t used;
+	size_t cap;
+	char data[];
+} result_chunk;
+
+typedef struct result_cell {
+	union {
+		int64_t i;
+		double f;
+		const char* p;  /* NUL-terminated arena copy for TEXT and BLOB */
+	} v;
+	int32_t len;
+	int32_t type;
+} result_cell;
+
+typedef struct qdsqlite_result {
+	int ncols;
+	int64_t rows;
+	int64_t capacity;  /* rows the cell array can hold */
+	result_cell* cells;
+	const char** names;
+	result_chunk* chunks;  /* newest first */
+} qdsqlite_result;
+
+static void result_destroy(qdsqlite_result* r) {
+	result_chunk* c = r->chunks;
+	while (c) {
+		result_chunk* next = c->next;
+		free(c);
+		c = next;
+	}
+	free(r->cells);
+	free(r);
+}
+
+/** Bump allocate size bytes, 8-byte aligned; NULL if out of memory */
+static void* result_alloc(qdsqlite_result* r, size_t size) {
+	result_chunk* c = r->chunks;
+	size_t start = c ? (c->used + 7) & ~(size_t)7 : 0;
+	if (!c || start + size > c->cap) {
+		size_t cap = c ? c->cap * 2 : RESULT_CHUNK_MIN;
+		if (cap > RESULT_CHUNK_MAX) cap = RESULT_CHUNK_MAX;
+		if (cap < size) cap = size;
+		result_chunk* fresh = malloc(sizeof(result_chunk) + cap);
+		if (!fresh) return NULL;
+		fresh->next = c;
+		fresh->used = 0;
+		fresh->cap = cap;
+		r->chunks = fresh;
+		c = fresh;
+		start = 0;
+	}
+	c->used = start + size;
+	return c->data + start;
+}
+
+static const char* result_strdup(qdsqlite_result* r, const void* data, size_t len) {
+	char* copy = result_alloc(r, len + 1);
+	if (!copy) return NULL;
+	if (len > 0) memcpy(copy, data, len);
+	copy[len] = '\0';
+	return copy;
+}
+
+/** Step s to completion into r. Returns SQLITE_DONE, SQLITE_NOMEM or the step error. */
+static int result_fill(qdsqlite_result* r, qdsqlite_stmt* s) {
+	sqlite3_stmt* stmt = s->handle;
+
+	r->names = result_alloc(r, (size_t)(r->ncols ? r->ncols : 1) * sizeof(const char*));
+	if (!r->names) return SQLITE_NOMEM;
+	for (int col = 0; col < r->ncols; col++) {
+		const char* name = sqlite3_column_name(stmt, col);
+		if (!name) name = "";
+		r->names[col] = result_strdup(r, name, strlen(name));
+		if (!r->names[col]) return SQLITE_NOMEM;
+	}
+
+	for (;;) {
+		int rc = stmt_step(s);
+		if (rc == SQLITE_DONE) return SQLITE_DONE;
+		if (rc != SQLITE_ROW) return rc;
+
+		if (r->rows == r->capacity) {
+			int64_t capacity = r->capacity ? r->capacity * 2 : 16;
+			size_t cells = (size_t)capacity * (size_t)(r->ncols ? r->ncols : 1);
+			result_cell* grown = realloc(r->cells, cells * sizeof(result_cell));
+			if (!grown) return SQLITE_NOMEM;
+			r->cells = grown;
+			r->capacity = capacity;
+		}
+
+		result_cell* row = r->cells + r->rows * r->ncols;
+		for (int col = 0; col < r->ncols; col++) {
+			result_cell* cell = &row[col];
+			int type = sqlite3_column_type(stmt, col);
+			cell->type = type;
+			cell->len = 0;
+
+			if (type == SQLITE_INTEGER) {
+				cell->v.i = sqlite3_column_int64(stmt, col);
+			} else if (type == SQLITE_FLOAT) {
+				cell->v.f = sqlite3_column_double(stmt, col);
+			} else if (type == SQLITE_TEXT || type == SQLITE_BLOB) {
+				const void* data = type == SQLITE_TEXT
+					? (const void*)sqlite3_column_text(stmt, col)
+					: sqlite3_column_blob(stmt, col);
+				int len = sqlite3_column_bytes(stmt, col);
+				cell->v.p = result_strdup(r, data, (size_t)len);
+				if (!cell->v.p) return SQLITE_NOMEM;
+				cell->len = len;
+			} else {
+				cell->v.i = 0;
+			}
+		}
+		r->rows++;
+	}
+}
+
+/**
+ * query_all - Run a query and materialize every row
+ * Stack: (sql:str params:ptr db:ptr -- result:ptr)!
+ */
+int usr_sqlite_query_all(qd_context* ctx) {
+	qd_stack_element_t db_elem, params_elem, sql_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::query_all: expected database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &params_elem);
+	if (err != QD_STACK_OK || params_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::query_all: expected params batch pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &sql_elem);
+	if (err != QD_STACK_OK || sql_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::query_all: expected SQL string");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_db* conn = (qdsqlite_db*)db_elem.value.p;
+	qdsqlite_batch* params = (qdsqlite_batch*)params_elem.value.p;
+	qdsqlite_stmt* s = NULL;
+
+	int rc = cache_prepare(conn, qd_string_data(sql_elem.value.s), qd_string_length(sql_elem.value.s), &s);
+	qd_string_release(sql_elem.value.s);
+	if (rc != SQLITE_OK) {
+		if (rc == SQLITE_NOMEM) {
+			set_error_msg(ctx, "sqlite::query_all: out of memory");
+		} else {
+			set_sqlite_error(ctx, "sqlite::query_all", conn->handle);
+		}
+		ctx->error_code = SQLITE_ERR_PREPARE;
+		return (int){SQLITE_ERR_PREPARE};
+	}
+
+	/* Statements without parameters ignore params, which may then be null */
+	int nparams = sqlite3_bind_parameter_count(s->handle);
+	if (nparams > 0) {
+		/* rows counts a partly written row, so check its cells were all added */
+		if (!params || params->rows < 1 || params->cells < params->ncols || params->ncols != nparams) {
+			cache_return(conn, s);
+			set_error_msg(ctx, "sqlite::query_all: params do not match statement parameters");
+			ctx->error_code = SQLITE_ERR_INVALID_ARG;
+			return (int){SQLITE_ERR_INVALID_ARG};
+		}
+		if (batch_bind_row(params, s->handle, 0) != SQLITE_OK) {
+			set_sqlite_error(ctx, "sqlite::query_all", conn->handle);
+			cache_return(conn, s);
+			ctx->error_code = SQLITE_ERR_BIND;
+			return (int){SQLITE_ERR_BIND};
+		}
+	}
+
+	qdsqlite_result* r = calloc(1, sizeof(qdsqlite_result));
+	if (r) {
+		r->ncols = sqlite3_column_count(s->handle);
+		rc = result_fill(r, s);
+	} else {
+		rc = SQLITE_NOMEM;
+	}
+
+	if (rc != SQLITE_DONE) {
+		int code = batch_fill_error(ctx, "sqlite::query_all", s, rc);
+		cache_return(conn, s);
+		if (r) result_destroy(r);
+		return code;
+	}
+	cache_return(conn, s);
+
+	qd_push_p(ctx, r);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * result_free - Free a materialized result and all of its values
+ * Stack: (result:ptr -- )
+ */
+int usr_sqlite_result_free(qd_context* ctx) {
+	qd_stack_element_t result_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &result_elem);
+	if (err != QD_STACK_OK || result_elem.type != QD_STACK_TYPE_PTR) {
+		return 0;
+	}
+
+	if (result_elem.value.p) result_destroy((qdsqlite_result*)result_elem.value.p);
+	return 0;
+}
+
+/**
+ * result_rows - Get number of rows in a result
+ * Stack: (result:ptr -- rows:i64)
+ */
+int usr_sqlite_result_rows(qd_context* ctx) {
+	qd_stack_element_t result_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &result_elem);
+	if (err != QD_STACK_OK || result_elem.type != QD_STACK_TYPE_PTR || !result_elem.value.p) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	qd_push_i(ctx, ((qdsqlite_result*)result_elem.value.p)->rows);
+	return 0;
+}
+
+/**
+ * result_cols - Get number of columns in a result
+ * Stack: (result:ptr -- cols:i64)
+ */
+int usr_sqlite_result_cols(qd_context* ctx) {
+	qd_stack_element_t result_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &result_elem);
+	if (err != QD_STACK_OK || result_elem.type != QD_STACK_TYPE_PTR || !result_elem.value.p) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	qd_push_i(ctx, ((qdsqlite_result*)result_elem.value.p)->ncols);
+	return 0;
+}
+
+/**
+ * result_column_name - Get a result column's name
+ * Stack: (col:i64 result:ptr -- name:str)
+ */
+int usr_sqlite_result_column_name(qd_context* ctx) {
+	qd_stack_element_t result_elem, col_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &result_elem);
+	if (err != QD_STACK_OK || result_elem.type != QD_STACK_TYPE_PTR || !result_elem.value.p) {
+		qd_push_s(ctx, "");
+		return 0;
+	}
+
+	err = qd_stack_pop(ctx->st, &col_elem);
+	qdsqlite_result* r = (qdsqlite_result*)result_elem.value.p;
+	if (err != QD_STACK_OK || col_elem.type != QD_STACK_TYPE_INT || col_elem.value.i < 0 || col_elem.value.i >= r->ncols) {
+		qd_push_s(ctx, "");
+		return 0;
+	}
+
+	qd_push_s(ctx, r->names[col_elem.value.i]);
+	return 0;
+}
+
+/**
+ * Pop (row col result) accessor arguments.
+ * Returns the cell, or NULL if the arguments are invalid or out of range.
+ */
+static const result_cell* pop_result_cell(qd_context* ctx) {
+	qd_stack_element_t result_elem, col_elem, row_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &result_elem);
+	if (err != QD_STACK_OK || result_elem.type != QD_STACK_TYPE_PTR) return NULL;
+
+	err = qd_stack_pop(ctx->st, &col_elem);
+	if (err != QD_STACK_OK || col_elem.type != QD_STACK_TYPE_INT) return NULL;
+
+	err = qd_stack_pop(ctx->st, &row_elem);
+	if (err != QD_STACK_OK || row_elem.type != QD_STACK_TYPE_INT) return NULL;
+
+	qdsqlite_result* r = (qdsqlite_result*)result_elem.value.p;
+	int64_t row = row_elem.value.i;
+	int64_t col = col_elem.value.i;
+	if (!r || row < 0 || row >= r->rows || col < 0 || col >= r->ncols) return NULL;
+
+	return &r->cells[row * r->ncols + col];
+}
+
+/**
+ * result_type - Get result cell type
+ * Stack: (row:i64 col:i64 result:ptr -- type:i64)
+ */
+int usr_sqlite_result_type(qd_context* ctx) {
+	const result_cell* cell = pop_result_cell(ctx);
+	qd_push_i(ctx, cell ? cell->type : 0);
+	return 0;
+}
+
+/**
+ * result_int - Get result cell as integer
+ * Stack: (row:i64 col:i64 result:ptr -- value:i64)
+ */
+int usr_sqlite_result_int(qd_context* ctx) {
+	const result_cell* cell = pop_result_cell(ctx);
+	if (!cell) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	switch (cell->type) {
+	case SQLITE_INTEGER:
+		qd_push_i(ctx, cell->v.i);
+		break;
+	case SQLITE_FLOAT:
+		qd_push_i(ctx, (int64_t)cell->v.f);
+		break;
+	case SQLITE_TEXT:
+		qd_push_i(ctx, strtoll(cell->v.p, NULL, 10));
+		break;
+	default:
+		qd_push_i(ctx, 0);
+		break;
+	}
+	return 0;
+}
+
+/**
+ * result_float - Get result cell as float
+ * Stack: (row:i64 col:i64 result:ptr -- value:f64)
+ */
+int usr_sqlite_result_float(qd_context* ctx) {
+	const result_cell* cell = pop_result_cell(ctx);
+	if (!cell) {
+		qd_push_f(ctx, 0.0);
+		return 0;
+	}
+
+	switch (cell->type) {
+	case SQLITE_INTEGER:
+		qd_push_f(ctx, (double)cell->v.i);
+		break;
+	case SQLITE_FLOAT:
+		qd_push_f(ctx, cell->v.f);
+		break;
+	case SQLITE_TEXT:
+		qd_push_f(ctx, strtod(cell->v.p, NULL));
+		break;
+	default:
+		qd_push_f(ctx, 0.0);
+		break;
+	}
+	return 0;
+}
+
+/**
+ * result_text - Get result cell as text
+ * Stack: (row:i64 col:i64 result:ptr -- value:str)
+ */
+int usr_sqlite_result_text(qd_context* ctx) {
+	const result_cell* cell = pop_result_cell(ctx);
+	if (!cell) {
+		qd_push_s(ctx, "");
+		return 0;
+	}
+
+	char buf[32];
+	switch (cell->type) {
+	case SQLITE_INTEGER:
+		snprintf(buf, sizeof(buf), "%lld", (long long)cell->v.i);
+		qd_push_s(ctx, buf);
+		break;
+	case SQLITE_FLOAT:
+		snprintf(buf, sizeof(buf), "%.15g", cell->v.f);
+		qd_push_s(ctx, buf);
+		break;
+	case SQLITE_TEXT:
+	case SQLITE_BLOB:
+		if (cell->len > 0) {
+			qd_string_t* str = qd_string_create_with_length(cell->v.p, (size_t)cell->len);
+			if (str) {
+				qd_push_s_ref(ctx, str);
+				qd_string_release(str);
+			} else {
+				qd_push_s(ctx, "");
+			}
+		} else {
+			qd_push_s(ctx, "");
+		}
+		break;
+	default:
+		qd_push_s(ctx, "");
+		break;
+	}
+	return 0;
+}
+
+/**
+ * result_text_view - Borrow result text or BLOB cell without copying
+ * Stack: (row:i64 col:i64 result:ptr -- data:ptr len:i64)
+ */
+int usr_sqlite_result_text_view(qd_context* ctx) {
+	const result_cell* cell = pop_result_cell(ctx);
+	if (!cell || (cell->type != SQLITE_TEXT && cell->type != SQLITE_BLOB)) {
+		qd_push_p(ctx, NULL);
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	qd_push_p(ctx, (void*)cell->v.p);
+	qd_push_i(ctx, cell->len);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * SQL functions
+ *
+ * Quadrate code cannot be called back from inside sqlite3_step, so
+ * functions are native: either the built-in vector kernels below or C
+ * entry points exported by another native library and passed in as
+ * pointers with sqlite3's xFunc/xStep/xFinal signatures.
+ *
+ * Vectors are BLOBs of little-endian float32. The kernels keep eight
+ * independent partial sums so the compiler can keep them in SIMD lanes,
+ * and read elements with memcpy since BLOB data is not float aligned.
+ * ------------------------------------------------------------------------ */
+
+#define VEC_LANES 8
+
+static inline float vec_load(const unsigned char* p, int i) {
+	float f;
+	memcpy(&f, p + (size_t)i * sizeof(float), sizeof(float));
+	return f;
+}
+
+static double vec_dot_f32(const unsigned char* a, const unsigned char* b, int n) {
+	float acc[VEC_LANES] = {0};
+	int i = 0;
+	for (; i + VEC_LANES <= n; i += VEC_LANES) {
+		for (int j = 0; j < VEC_LANES; j++) acc[j] += vec_load(a, i + j) * vec_load(b, i + j);
+	}
+	double sum = 0.0;
+	for (int j = 0; j < VEC_LANES; j++) sum += acc[j];
+	for (; i < n; i++) sum += (double)vec_load(a, i) * vec_load(b, i);
+	return sum;
+}
+
+static double vec_l2sq_f32(const unsigned char* a, const unsigned char* b, int n) {
+	float acc[VEC_LANES] = {0};
+	int i = 0;
+	for (; i + VEC_LANES <= n; i += VEC_LANES) {
+		for (int j = 0; j < VEC_LANES; j++) {
+			float d = vec_load(a, i + j) - vec_load(b, i + j);
+			acc[j] += d * d;
+		}
+	}
+	double sum = 0.0;
+	for (int j = 0; j < VEC_LANES; j++) sum += acc[j];
+	for (; i < n; i++) {
+		double d = (double)vec_load(a, i) - vec_load(b, i);
+		sum += d * d;
+	}
+	return sum;
+}
+
+/** 1 - cosine similarity; 1 when either vector is all zeros */
+static double vec_cosine_distance_f32(const unsigned char* a, const unsigned char* b, int n) {
+	double norms = sqrt(vec_dot_f32(a, a, n) * vec_dot_f32(b, b, n));
+	if (norms == 0.0) return 1.0;
+	return 1.0 - vec_dot_f32(a, b, n) / norms;
+}
+
+/**
+ * Read a float32 vector argument. Returns its element count, 0 for NULL
+ * (the caller then returns NULL), or -1 after reporting an error.
+ */
+static int vec_arg(sqlite3_context* fctx, sqlite3_value* v, const unsigned char** out) {
+	int type = sqlite3_value_type(v);
+	if (type == SQLITE_NULL) return 0;
+	if (type != SQLITE_BLOB || sqlite3_value_bytes(v) % (int)sizeof(float) != 0) {
+		sqlite3_result_error(fctx, "vector must be a BLOB of float32 values", -1);
+		return -1;
+	}
+	*out = sqlite3_value_blob(v);
+	int n = sqlite3_value_bytes(v) / (int)sizeof(float);
+	if (n == 0) {
+		sqlite3_result_error(fctx, "vector is empty", -1);
+		return -1;
+	}
+	return n;
+}
+
+/** Read two vector arguments of equal length; returns the length, 0 for NULL, -1 on error */
+static int vec_args2(sqlite3_context* fctx, sqlite3_value** argv, const unsigned char** a, const unsigned char** b) {
+	int na = vec_arg(fctx, argv[0], a);
+	if (na <= 0) return na;
+	int nb = vec_arg(fctx, argv[1], b);
+	if (nb <= 0) return nb;
+	if (na != nb) {
+		sqlite3_result_error(fctx, "vectors differ in length", -1);
+		return -1;
+	}
+	return na;
+}
+
+static void sql_vec_dot(sqlite3_context* fctx, int argc, sqlite3_value** argv) {
+	(void)argc;
+	const unsigned char *a = NULL, *b = NULL;
+	int n = vec_args2(fctx, argv, &a, &b);
+	if (n > 0) sqlite3_result_double(fctx, vec_dot_f32(a, b, n));
+	else if (n == 0) sqlite3_result_null(fctx);
+}
+
+static void sql_vec_l2(sqlite3_context* fctx, int argc, sqlite3_value** argv) {
+	(void)argc;
+	const unsigned char *a = NULL, *b = NULL;
+	int n = vec_args2(fctx, argv, &a, &b);
+	if (n > 0) sqlite3_result_double(fctx, sqrt(vec_l2sq_f32(a, b, n)));
+	else if (n == 0) sqlite3_result_null(fctx);
+}
+
+static void sql_vec_cosine(sqlite3_context* fctx, int argc, sqlite3_value** argv) {
+	(void)argc;
+	const unsigned char *a = NULL, *b = NULL;
+	int n = vec_args2(fctx, argv, &a, &b);
+	if (n > 0) sqlite3_result_double(fctx, vec_cosine_distance_f32(a, b, n));
+	else if (n == 0) sqlite3_result_null(fctx);
+}
+
+static void sql_vec_norm(sqlite3_context* fctx, int argc, sqlite3_value** argv) {
+	(void)argc;
+	const unsigned char* a = NULL;
+	int n = vec_arg(fctx, argv[0], &a);
+	if (n > 0) sqlite3_result_double(fctx, sqrt(vec_dot_f32(a, a, n)));
+	else if (n == 0) sqlite3_result_null(fctx);
+}
+
+static void sql_vec_dims(sqlite3_context* fctx, int argc, sqlite3_value** argv) {
+	(void)argc;
+	const unsigned char* a = NULL;
+	int n = vec_arg(fctx, argv[0], &a);
+	if (n > 0) sqlite3_result_int(fctx, n);
+	else if (n == 0) sqlite3_result_null(fctx);
+}
+
+/* vec_sum / vec_avg: element-wise aggregate, usable as a window function */
+typedef struct vec_agg {
+	int dims;
+	int64_t count;
+	double* sums;
+} vec_agg;
+
+static void vec_agg_add(sqlite3_context* fctx, sqlite3_value* v, int sign) {
+	vec_agg* agg = sqlite3_aggregate_context(fctx, sizeof(vec_agg));
+	if (!agg) {
+		sqlite3_result_error_nomem(fctx);
+		return;
+	}
+	const unsigned char* a = NULL;
+	int n = vec_arg(fctx, v, &a);
+	if (n <= 0) return;
+
+	if (!agg->sums) {
+		agg->sums = sqlite3_malloc64((sqlite3_uint64)n * sizeof(double));
+		if (!agg->sums) {
+			sqlite3_result_error_nomem(fctx);
+			return;
+		}
+		memset(agg->sums, 0, (size_t)n * sizeof(double));
+		agg->dims = n;
+	} else if (n != agg->dims) {
+		sqlite3_result_error(fctx, "vectors differ in length", -1);
+		return;
+	}
+
+	for (int i = 0; i < n; i++) agg->sums[i] += sign * (double)vec_load(a, i);
+	agg->count += sign;
+}
+
+static void sql_vec_agg_step(sqlite3_context* fctx, int argc, sqlite3_value** argv) {
+	(void)argc;
+	vec_agg_add(fctx, argv[0], 1);
+}
+
+static void sql_vec_agg_inverse(sqlite3_context* fctx, int argc, sqlite3_value** argv) {
+	(void)argc;
+	vec_agg_add(fctx, argv[0], -1);
+}
+
+static void vec_agg_result(sqlite3_context* fctx, int average) {
+	vec_agg* agg = sqlite3_aggregate_context(fctx, 0);
+	if (!agg || !agg->sums || agg->count == 0) {
+		sqlite3_result_null(fctx);
+		return;
+	}
+	float* out = sqlite3_malloc64((sqlite3_uint64)agg->dims * sizeof(float));
+	if (!out) {
+		sqlite3_result_error_nomem(fctx);
+		return;
+	}
+	for (int i = 0; i < agg->dims; i++) {
+		out[i] = (float)(average ? agg->sums[i] / (double)agg->count : agg->sums[i]);
+	}
+	sqlite3_result_blob(fctx, out, agg->dims * (int)sizeof(float), sqlite3_free);
+}
+
+static void sql_vec_sum_value(sqlite3_context* fctx) {
+	vec_agg_result(fctx, 0);
+}
+
+static void sql_vec_avg_value(sqlite3_context* fctx) {
+	vec_agg_result(fctx, 1);
+}
+
+static void sql_vec_sum_final(sqlite3_context* fctx) {
+	vec_agg_result(fctx, 0);
+	vec_agg* agg = sqlite3_aggregate_context(fctx, 0);
+	if (agg) sqlite3_free(agg->sums);
+}
+
+static void sql_vec_avg_final(sqlite3_context* fctx) {
+	vec_agg_result(fctx, 1);
+	vec_agg* agg = sqlite3_aggregate_context(fctx, 0);
+	if (agg) sqlite3_free(agg->sums);
+}
+
+typedef struct vec_function {
+	const char* name;
+	int nargs;
+	void (*func)(sqlite3_context*, int, sqlite3_value**);
+	void (*step)(sqlite3_context*, int, sqlite3_value**);
+	void (*final)(sqlite3_context*);
+	void (*value)(sqlite3_context*);
+	void (*inverse)(sqlite3_context*, int, sqlite3_value**);
+} vec_function;
+
+static const vec_function vec_functions[] = {
+	{"vec_dot", 2, sql_vec_dot, NULL, NULL, NULL, NULL},
+	{"vec_l2", 2, sql_vec_l2, NULL, NULL, NULL, NULL},
+	{"vec_cosine", 2, sql_vec_cosine, NULL, NULL, NULL, NULL},
+	{"vec_norm", 1, sql_vec_norm, NULL, NULL, NULL, NULL},
+	{"vec_dims", 1, sql_vec_dims, NULL, NULL, NULL, NULL},
+	{"vec_sum", 1, NULL, sql_vec_agg_step, sql_vec_sum_final, sql_vec_sum_value, sql_vec_agg_inverse},
+	{"vec_avg", 1, NULL, sql_vec_agg_step, sql_vec_avg_final, sql_vec_avg_value, sql_vec_agg_inverse},
+};
+
+/**
+ * vector_functions - Register the built-in vector functions
+ * Stack: (db:ptr -- )!
+ */
+int usr_sqlite_vector_functions(qd_context* ctx) {
+	qd_stack_element_t db_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::vector_functions: expected database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	sqlite3* db = ((qdsqlite_db*)db_elem.value.p)->handle;
+	int flags = SQLITE_UTF8 | SQLITE_DETERMINISTIC | SQLITE_INNOCUOUS;
+	for (size_t i = 0; i < sizeof(vec_functions) / sizeof(vec_functions[0]); i++) {
+		const vec_function* f = &vec_functions[i];
+		int rc = f->func
+			? sqlite3_create_function_v2(db, f->name, f->nargs, flags, NULL, f->func, NULL, NULL, NULL)
+			: sqlite3_create_window_function(db, f->name, f->nargs, flags, NULL,
+			                                 f->step, f->final, f->value, f->inverse, NULL);
+		if (rc != SQLITE_OK) {
+			set_sqlite_error(ctx, "sqlite::vector_functions", db);
+			ctx->error_code = SQLITE_ERR_EXEC;
+			return (int){SQLITE_ERR_EXEC};
+		}
+	}
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/** Pop the (name nargs flags) part of a create_* call */
+static int pop_function_spec(qd_context* ctx, const char* prefix, qd_string_t** name, int* nargs, int* flags) {
+	qd_stack_element_t flags_elem, nargs_elem, name_elem;
+	char msg[128];
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &flags_elem);
+	if (err != QD_STACK_OK || flags_elem.type != QD_STACK_TYPE_INT) {
+		snprintf(msg, sizeof(msg), "%s: expected integer flags", prefix);
+		set_error_msg(ctx, msg);
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &nargs_elem);
+	if (err != QD_STACK_OK || nargs_elem.type != QD_STACK_TYPE_INT || nargs_elem.value.i < -1 || nargs_elem.value.i > 127) {
+		snprintf(msg, sizeof(msg), "%s: expected argument count from -1 to 127", prefix);
+		set_error_msg(ctx, msg);
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &name_elem);
+	if (err != QD_STACK_OK || name_elem.type != QD_STACK_TYPE_STR) {
+		snprintf(msg, sizeof(msg), "%s: expected function name", prefix);
+		set_error_msg(ctx, msg);
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	*name = name_elem.value.s;
+	*nargs = (int)nargs_elem.value.i;
+	*flags = SQLITE_UTF8 | (int)(flags_elem.value.i & (SQLITE_DETERMINISTIC | SQLITE_DIRECTONLY | SQLITE_INNOCUOUS));
+	return 0;
+}
+
+/** Pop n non-null native function pointers into ptrs in signature order */
+static int pop_function_ptrs(qd_context* ctx, const char* prefix, void** ptrs, int n) {
+	for (int i = n - 1; i >= 0; i--) {
+		qd_stack_element_t elem;
+		qd_stack_error err = qd_stack_pop(ctx->st, &elem);
+		if (err != QD_STACK_OK || elem.type != QD_STACK_TYPE_PTR || !elem.value.p) {
+			char msg[128];
+			snprintf(msg, sizeof(msg), "%s: expected native function pointer", prefix);
+			set_error_msg(ctx, msg);
+			ctx->error_code = SQLITE_ERR_INVALID_ARG;
+			return (int){SQLITE_ERR_INVALID_ARG};
+		}
+		ptrs[i] = elem.value.p;
+	}
+	return 0;
+}
+
+typedef void (*sql_func_fn)(sqlite3_context*, int, sqlite3_value**);
+typedef void (*sql_final_fn)(sqlite3_context*);
+
+/**
+ * Register a native function. kind is 1 for scalar (func), 2 for
+ * aggregate (step final) and 4 for window (step final value inverse).
+ * Stack: (name:str nargs:i64 flags:i64 <kind pointers> db:ptr -- )!
+ */
+static int create_function_impl(qd_context* ctx, const char* prefix, int kind) {
+	qd_stack_element_t db_elem;
+	void* ptrs[4] = {NULL, NULL, NULL, NULL};
+	qd_string_t* name = NULL;
+	int nargs, flags;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		char msg[128];
+		snprintf(msg, sizeof(msg), "%s: expected database pointer", prefix);
+		set_error_msg(ctx, msg);
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	int code = pop_function_ptrs(ctx, prefix, ptrs, kind);
+	if (code) return code;
+	code = pop_function_spec(ctx, prefix, &name, &nargs, &flags);
+	if (code) return code;
+
+	/* Function and data pointers share a representation on every platform we target */
+	sqlite3* db = ((qdsqlite_db*)db_elem.value.p)->handle;
+	const char* zname = qd_string_data(name);
+	int rc;
+	if (kind == 1) {
+		sql_func_fn func;
+		memcpy(&func, &ptrs[0], sizeof(func));
+		rc = sqlite3_create_function_v2(db, zname, nargs, flags, NULL, func, NULL, NULL, NULL);
+	} else {
+		sql_func_fn step, inverse = NULL;
+		sql_final_fn final, value = NULL;
+		memcpy(&step, &ptrs[0], sizeof(step));
+		memcpy(&final, &ptrs[1], sizeof(final));
+		if (kind == 4) {
+			memcpy(&value, &ptrs[2], sizeof(value));
+			memcpy(&inverse, &ptrs[3], sizeof(inverse));
+			rc = sqlite3_create_window_function(db, zname, nargs, flags, NULL, step, final, value, inverse, NULL);
+		} else {
+			rc = sqlite3_create_function_v2(db, zname, nargs, flags, NULL, NULL, step, final, NULL);
+		}
+	}
+	qd_string_release(name);
+
+	if (rc != SQLITE_OK) {
+		set_sqlite_error(ctx, prefix, db);
+		ctx->error_code = SQLITE_ERR_EXEC;
+		return (int){SQLITE_ERR_EXEC};
+	}
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * create_function - Register a native scalar function
+ * Stack: (name:str nargs:i64 flags:i64 func:ptr db:ptr -- )!
+ */
+int usr_sqlite_create_function(qd_context* ctx) {
+	return create_function_impl(ctx, "sqlite::create_function", 1);
+}
+
+/**
+ * create_aggregate - Register a native aggregate function
+ * Stack: (name:str nargs:i64 flags:i64 step:ptr final:ptr db:ptr -- )!
+ */
+int usr_sqlite_create_aggregate(qd_context* ctx) {
+	return create_function_impl(ctx, "sqlite::create_aggregate", 2);
+}
+
+/**
+ * create_window - Register a native aggregate window function
+ * Stack: (name:str nargs:i64 flags:i64 step:ptr final:ptr value:ptr inverse:ptr db:ptr -- )!
+ */
+int usr_sqlite_create_window(qd_context* ctx) {
+	return create_function_impl(ctx, "sqlite::create_window", 4);
+}
+
+/* ------------------------------------------------------------------------
+ * Vector search
+ *
+ * knn scans a BLOB column with the vector kernels above and keeps the k
+ * best rows in a bounded max-heap, so memory stays O(k) however large
+ * the table is and no vector is copied out of SQLite's row buffer.
+ * ------------------------------------------------------------------------ */
+
+#define VEC_METRIC_DOT 1
+#define VEC_METRIC_L2 2
+#define VEC_METRIC_COSINE 3
+
+typedef struct knn_hit {
+	int64_t id;
+	double key;  /* lower is better: distance, or the negated dot product */
+} knn_hit;
+
+static void knn_sift_down(knn_hit* heap, int64_t n, int64_t i) {
+	for (;;) {
+		int64_t worst = i, l = 2 * i + 1, r = l + 1;
+		if (l < n && heap[l].key > heap[worst].key) worst = l;
+		if (r < n && heap[r].key > heap[worst].key) worst = r;
+		if (worst == i) return;
+		knn_hit t = heap[i];
+		heap[i] = heap[worst];
+		heap[worst] = t;
+		i = worst;
+	}
+}
+
+static void knn_sift_up(knn_hit* heap, int64_t i) {
+	while (i > 0) {
+		int64_t parent = (i - 1) / 2;
+		if (heap[parent].key >= heap[i].key) return;
+		knn_hit t = heap[i];
+		heap[i] = heap[parent];
+		heap[parent] = t;
+		i = parent;
+	}
+}
+
+static int knn_hit_compare(const void* a, const void* b) {
+	double ka = ((const knn_hit*)a)->key, kb = ((const knn_hit*)b)->key;
+	return ka < kb ? -1 : ka > kb;
+}
+
+/**
+ * knn - Find the k rows whose vector column is closest to a query vector
+ * Stack: (query:ptr len:i64 k:i64 metric:i64 table:str column:str db:ptr -- batch:ptr rows:i64)!
+ */
+int usr_sqlite_knn(qd_context* ctx) {
+	qd_stack_element_t db_elem, column_elem, table_elem, metric_elem, k_elem, len_elem, query_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::knn: expected database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &column_elem);
+	if (err != QD_STACK_OK || column_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::knn: expected column name");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &table_elem);
+	if (err != QD_STACK_OK || table_elem.type != QD_STACK_TYPE_STR) {
+		qd_string_release(column_elem.value.s);
+		set_error_msg(ctx, "sqlite::knn: expected table name");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	/*
+	 * A quoted unknown column would silently become a string literal, so
+	 * check the names now; the error is reported once every argument is
+	 * popped, like the prepare error it replaces.
+	 */
+	qdsqlite_db* conn = (qdsqlite_db*)db_elem.value.p;
+	int known = sqlite3_table_column_metadata(conn->handle, NULL, qd_string_data(table_elem.value.s),
+	                                          qd_string_data(column_elem.value.s), NULL, NULL, NULL, NULL,
+	                                          NULL) == SQLITE_OK;
+
+	/* Build the scan while the names are at hand; the cache keeps it prepared */
+	char* sql = known ? sqlite3_mprintf("SELECT rowid, \"%w\" FROM \"%w\"", qd_string_data(column_elem.value.s),
+	                                    qd_string_data(table_elem.value.s)) : NULL;
+	qd_string_release(column_elem.value.s);
+	qd_string_release(table_elem.value.s);
+	if (known && !sql) {
+		set_error_msg(ctx, "sqlite::knn: out of memory");
+		ctx->error_code = SQLITE_ERR_STEP;
+		return (int){SQLITE_ERR_STEP};
+	}
+
+	err = qd_stack_pop(ctx->st, &metric_elem);
+	if (err != QD_STACK_OK || metric_elem.type != QD_STACK_TYPE_INT ||
+	    metric_elem.value.i < VEC_METRIC_DOT || metric_elem.value.i > VEC_METRIC_COSINE) {
+		sqlite3_free(sql);
+		set_error_msg(ctx, "sqlite::knn: expected VecDot, VecL2 or VecCosine");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &k_elem);
+	if (err != QD_STACK_OK || k_elem.type != QD_STACK_TYPE_INT || k_elem.value.i <= 0 || k_elem.value.i > INT32_MAX) {
+		sqlite3_free(sql);
+		set_error_msg(ctx, "sqlite::knn: expected positive k");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &len_elem);
+	if (err != QD_STACK_OK || len_elem.type != QD_STACK_TYPE_INT || len_elem.value.i <= 0 ||
+	    len_elem.value.i > INT32_MAX || len_elem.value.i % (int64_t)sizeof(float) != 0) {
+		sqlite3_free(sql);
+		set_error_msg(ctx, "sqlite::knn: expected query length as a non-zero multiple of 4 bytes");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &query_elem);
+	if (err != QD_STACK_OK || query_elem.type != QD_STACK_TYPE_PTR || !query_elem.value.p) {
+		sqlite3_free(sql);
+		set_error_msg(ctx, "sqlite::knn: expected query vector pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	if (!known) {
+		set_sqlite_error(ctx, "sqlite::knn", conn->handle);
+		ctx->error_code = SQLITE_ERR_PREPARE;
+		return (int){SQLITE_ERR_PREPARE};
+	}
+
+	qdsqlite_stmt* s = NULL;
+	int rc = cache_prepare(conn, sql, strlen(sql), &s);
+	sqlite3_free(sql);
+	if (rc != SQLITE_OK) {
+		if (rc == SQLITE_NOMEM) {
+			set_error_msg(ctx, "sqlite::knn: out of memory");
+		} else {
+			set_sqlite_error(ctx, "sqlite::knn", conn->handle);
+		}
+		ctx->error_code = SQLITE_ERR_PREPARE;
+		return (int){SQLITE_ERR_PREPARE};
+	}
+
+	const unsigned char* query = query_elem.value.p;
+	int dims = (int)(len_elem.value.i / (int64_t)sizeof(float));
+	int metric = (int)metric_elem.value.i;
+	int64_t k = k_elem.value.i;
+	double query_norm = metric == VEC_METRIC_COSINE ? sqrt(vec_dot_f32(query, query, dims)) : 0.0;
+
+	knn_hit* heap = NULL;
+	int64_t n = 0, cap = 0;
+	while ((rc = stmt_step(s)) == SQLITE_ROW) {
+		/* Rows whose vector is NULL or of another dimension cannot be ranked */
+		if (sqlite3_column_type(s->handle, 1) != SQLITE_BLOB) continue;
+		if (sqlite3_column_bytes(s->handle, 1) != (int)len_elem.value.i) continue;
+		const unsigned char* v = sqlite3_column_blob(s->handle, 1);
+
+		double key;
+		if (metric == VEC_METRIC_DOT) {
+			key = -vec_dot_f32(query, v, dims);
+		} else if (metric == VEC_METRIC_L2) {
+			key = vec_l2sq_f32(query, v, dims);
+		} else {
+			double norms = query_norm * sqrt(vec_dot_f32(v, v, dims));
+			key = norms == 0.0 ? 1.0 : 1.0 - vec_dot_f32(query, v, dims) / norms;
+		}
+
+		if (n < k) {
+			if (n == cap) {
+				int64_t grown_cap = cap ? cap * 2 : 64;
+				if (grown_cap > k) grown_cap = k;
+				knn_hit* grown = realloc(heap, (size_t)grown_cap * sizeof(knn_hit));
+				if (!grown) {
+					rc = SQLITE_NOMEM;
+					break;
+				}
+				heap = grown;
+				cap = grown_cap;
+			}
+			heap[n].id = sqlite3_column_int64(s->handle, 0);
+			heap[n].key = key;
+			knn_sift_up(heap, n);
+			n++;
+		} else if (key < heap[0].key) {
+			heap[0].id = sqlite3_column_int64(s->handle, 0);
+			heap[0].key = key;
+			knn_sift_down(heap, n, 0);
+		}
+	}
+
+	qdsqlite_batch* b = NULL;
+	if (rc == SQLITE_DONE) {
+		b = batch_create(2, n ? n : 1);
+		if (!b) rc = SQLITE_NOMEM;
+	}
+	if (rc != SQLITE_DONE) {
+		free(heap);
+		int code = batch_fill_error(ctx, "sqlite::knn", s, rc);
+		cache_return(conn, s);
+		return code;
+	}
+	cache_return(conn, s);
+
+	qsort(heap, (size_t)n, sizeof(knn_hit), knn_hit_compare);
+	for (int64_t i = 0; i < n; i++) {
+		b->types[i] = SQLITE_INTEGER;
+		b->ints[i] = heap[i].id;
+		b->types[b->capacity + i] = SQLITE_FLOAT;
+		b->floats[b->capacity + i] = metric == VEC_METRIC_DOT ? -heap[i].key
+		                           : metric == VEC_METRIC_L2 ? sqrt(heap[i].key)
+		                           : heap[i].key;
+	}
+	b->rows = n;
+	b->cells = 2 * n;
+	free(heap);
+
+	qd_push_p(ctx, b);
+	qd_push_i(ctx, n);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Prefetching cursors
+ *
+ * A cursor gives a statement its own producer thread that steps ahead
+ * into a ring of preallocated batches while the caller works on the
+ * previous one. The ring is single-producer/single-consumer: slots are
+ * handed over through the atomic head and tail counters, and the mutex
+ * is only taken to sleep when the ring is empty or full and to wake the
+ * side that is sleeping.
+ * ------------------------------------------------------------------------ */
+
+typedef struct qdsqlite_cursor {
+	qdsqlite_stmt* stmt;
+	int depth;
+	qdsqlite_batch** slots;
+	pthread_t thread;
+
+	_Atomic uint64_t head;  /* next slot the consumer takes */
+	_Atomic uint64_t tail;  /* next slot the producer fills */
+	_Atomic int finished;   /* producer has published its last batch */
+	_Atomic int closing;
+	_Atomic int consumer_waiting;
+	_Atomic int producer_waiting;
+	int holding;  /* consumer still has slot head from the last cursor_next */
+
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	int rc;  /* final step result, SQLITE_DONE on success */
+} qdsqlite_cursor;
+
+/** Wake the other side if it is, or is about to be, asleep */
+static void cursor_wake(qdsqlite_cursor* c, _Atomic int* waiting) {
+	if (atomic_load(waiting)) {
+		pthread_mutex_lock(&c->lock);
+		pthread_cond_broadcast(&c->changed);
+		pthread_mutex_unlock(&c->lock);
+	}
+}
+
+static void* cursor_produce(void* arg) {
+	qdsqlite_cursor* c = arg;
+	int rc = SQLITE_DONE;
+
+	for (;;) {
+		uint64_t tail = atomic_load(&c->tail);
+		if (tail - atomic_load(&c->head) == (uint64_t)c->depth) {
+			pthread_mutex_lock(&c->lock);
+			atomic_store(&c->producer_waiting, 1);
+			while (tail - atomic_load(&c->head) == (uint64_t)c->depth && !atomic_load(&c->closing)) {
+				pthread_cond_wait(&c->changed, &c->lock);
+			}
+			atomic_store(&c->producer_waiting, 0);
+			pthread_mutex_unlock(&c->lock);
+		}
+		if (atomic_load(&c->closing)) break;
+
+		qdsqlite_batch* b = c->slots[tail % (uint64_t)c->depth];
+		rc = batch_fill(b, c->stmt);
+		if (rc != SQLITE_ROW && rc != SQLITE_DONE) break;
+		if (b->rows > 0) {
+			atomic_store(&c->tail, tail + 1);
+			cursor_wake(c, &c->consumer_waiting);
+		}
+		if (rc == SQLITE_DONE) break;
+	}
+
+	pthread_mutex_lock(&c->lock);
+	c->rc = rc == SQLITE_ROW ? SQLITE_DONE : rc;
+	atomic_store(&c->finished, 1);
+	pthread_cond_broadcast(&c->changed);
+	pthread_mutex_unlock(&c->lock);
+	return NULL;
+}
+
+static void cursor_destroy(qdsqlite_cursor* c) {
+	for (int i = 0; i < c->depth; i++) {
+		if (c->slots[i]) batch_destroy(c->slots[i]);
+	}
+	free(c->slots);
+	pthread_mutex_destroy(&c->lock);
+	pthread_cond_destroy(&c->changed);
+	free(c);
+}
+
+/**
+ * cursor_open - Start a prefetching cursor on a statement
+ * Stack: (chunk:i64 depth:i64 stmt:ptr -- cursor:ptr)!
+ */
+int usr_sqlite_cursor_open(qd_context* ctx) {
+	qd_stack_element_t stmt_elem, depth_elem, chunk_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::cursor_open: expected statement pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &depth_elem);
+	if (err != QD_STACK_OK || depth_elem.type != QD_STACK_TYPE_INT || depth_elem.value.i < 2 || depth_elem.value.i > 1024) {
+		set_error_msg(ctx, "sqlite::cursor_open: expected depth from 2 to 1024");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &chunk_elem);
+	if (err != QD_STACK_OK || chunk_elem.type != QD_STACK_TYPE_INT || chunk_elem.value.i <= 0) {
+		set_error_msg(ctx, "sqlite::cursor_open: expected positive chunk size");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_stmt* s = (qdsqlite_stmt*)stmt_elem.value.p;
+	qdsqlite_cursor* c = calloc(1, sizeof(qdsqlite_cursor));
+	if (!c) {
+		set_error_msg(ctx, "sqlite::cursor_open: out of memory");
+		ctx->error_code = SQLITE_ERR_STEP;
+		return (int){SQLITE_ERR_STEP};
+	}
+	c->stmt = s;
+	c->depth = (int)depth_elem.value.i;
+	pthread_mutex_init(&c->lock, NULL);
+	pthread_cond_init(&c->changed, NULL);
+	c->slots = calloc((size_t)c->depth, sizeof(qdsqlite_batch*));
+	int ok = c->slots != NULL;
+	int ncols = sqlite3_column_count(s->handle);
+	for (int i = 0; ok && i < c->depth; i++) {
+		c->slots[i] = batch_create(ncols, chunk_elem.value.i);
+		ok = c->slots[i] != NULL;
+	}
+	if (!ok) {
+		if (!c->slots) c->depth = 0;
+		cursor_destroy(c);
+		set_error_msg(ctx, "sqlite::cursor_open: out of memory");
+		ctx->error_code = SQLITE_ERR_STEP;
+		return (int){SQLITE_ERR_STEP};
+	}
+
+	if (pthread_create(&c->thread, NULL, cursor_produce, c) != 0) {
+		cursor_destroy(c);
+		set_error_msg(ctx, "sqlite::cursor_open: failed to start producer thread");
+		ctx->error_code = SQLITE_ERR_STEP;
+		return (int){SQLITE_ERR_STEP};
+	}
+
+	qd_push_p(ctx, c);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * cursor_next - Take the next prefetched batch
+ * Stack: (cursor:ptr -- batch:ptr rows:i64)!
+ */
+int usr_sqlite_cursor_next(qd_context* ctx) {
+	qd_stack_element_t cursor_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &cursor_elem);
+	if (err != QD_STACK_OK || cursor_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::cursor_next: expected cursor pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_cursor* c = (qdsqlite_cursor*)cursor_elem.value.p;
+
+	/* Hand the batch from the previous call back to the producer */
+	if (c->holding) {
+		atomic_store(&c->head, atomic_load(&c->head) + 1);
+		c->holding = 0;
+		cursor_wake(c, &c->producer_waiting);
+	}
+
+	uint64_t head = atomic_load(&c->head);
+	if (atomic_load(&c->tail) == head) {
+		pthread_mutex_lock(&c->lock);
+		atomic_store(&c->consumer_waiting, 1);
+		while (atomic_load(&c->tail) == head && !atomic_load(&c->finished)) {
+			pthread_cond_wait(&c->changed, &c->lock);
+		}
+		atomic_store(&c->consumer_waiting, 0);
+		pthread_mutex_unlock(&c->lock);
+	}
+
+	if (atomic_load(&c->tail) == head) {
+		/* Drained; finished was set after the last publish */
+		if (c->rc != SQLITE_DONE) {
+			set_sqlite_error(ctx, "sqlite::cursor_next", sqlite3_db_handle(c->stmt->handle));
+			int code = error_code_for(c->rc, SQLITE_ERR_STEP);
+			ctx->error_code = code;
+			return code;
+		}
+		qdsqlite_batch* empty = c->slots[head % (uint64_t)c->depth];
+		empty->rows = 0;
+		empty->cells = 0;
+		qd_push_p(ctx, empty);
+		qd_push_i(ctx, 0);
+		qd_push_i(ctx, SQLITE_ERR_OK);
+		return 0;
+	}
+
+	qdsqlite_batch* b = c->slots[head % (uint64_t)c->depth];
+	c->holding = 1;
+	qd_push_p(ctx, b);
+	qd_push_i(ctx, b->rows);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * cursor_close - Stop the producer and free the cursor and its batches
+ * Stack: (cursor:ptr -- )
+ */
+int usr_sqlite_cursor_close(qd_context* ctx) {
+	qd_stack_element_t cursor_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &cursor_elem);
+	if (err != QD_STACK_OK || cursor_elem.type != QD_STACK_TYPE_PTR || !cursor_elem.value.p) {
+		return 0;
+	}
+
+	qdsqlite_cursor* c = (qdsqlite_cursor*)cursor_elem.value.p;
+	pthread_mutex_lock(&c->lock);
+	atomic_store(&c->closing, 1);
+	pthread_cond_broadcast(&c->changed);
+	pthread_mutex_unlock(&c->lock);
+	pthread_join(c->thread, NULL);
+	cursor_destroy(c);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Parallel scans
+ *
+ * parallel_scan splits the integer key range of a table into partitions
+ * and runs the query once per partition, each on its own read-only
+ * connection, as async queries on the shared worker pool. parallel_next
+ * hands out whichever partition's batch is ready first; one notifier
+ * shared by all partitions lets it sleep until any of them makes
+ * progress.
+ * ------------------------------------------------------------------------ */
+
+/** Rows per batch produced by each partition */
+#define SQLITE_PARALLEL_CHUNK 1024
+
+typedef struct qdsqlite_parallel {
+	int n;
+	qdsqlite_db** conns;
+	qdsqlite_async** parts;
+	int next;  /* partition to look at first, for round-robin fairness */
+	async_notify notify;
+} qdsqlite_parallel;
+
+static void parallel_destroy(qdsqlite_parallel* p) {
+	for (int i = 0; i < p->n; i++) {
+		if (p->parts[i]) async_destroy(p->parts[i]);
+	}
+	for (int i = 0; i < p->n; i++) {
+		if (p->conns[i]) db_destroy(p->conns[i]);
+	}
+	free(p->parts);
+	free(p->conns);
+	pthread_cond_destroy(&p->notify.changed);
+	pthread_mutex_destroy(&p->notify.lock);
+	free(p);
+}
+
+/** Read min and max of column; returns 0 for an empty table, 1 with the range set, or -1 */
+static int parallel_key_range(qd_context* ctx, qdsqlite_db* conn, const char* table, const char* column,
+                              int64_t* lo, int64_t* hi) {
+	/* A quoted unknown column would silently become a string literal */
+	if (sqlite3_table_column_metadata(conn->handle, NULL, table, column, NULL, NULL, NULL, NULL, NULL) != SQLITE_OK) {
+		set_sqlite_error(ctx, "sqlite::parallel_scan", conn->handle);
+		ctx->error_code = SQLITE_ERR_PREPARE;
+		return -1;
+	}
+
+	/* Separate subqueries so each bound is a single index or rowid seek */
+	char* sql = sqlite3_mprintf("SELECT (SELECT min(\"%w\") FROM \"%w\"), (SELECT max(\"%w\") FROM \"%w\")",
+	                            column, table, column, table);
+	if (!sql) {
+		set_error_msg(ctx, "sqlite::parallel_scan: out of memory");
+		ctx->error_code = SQLITE_ERR_PREPARE;
+		return -1;
+	}
+
+	sqlite3_stmt* stmt = NULL;
+	int rc = sqlite3_prepare_v2(conn->handle, sql, -1, &stmt, NULL);
+	sqlite3_free(sql);
+	if (rc != SQLITE_OK) {
+		set_sqlite_error(ctx, "sqlite::parallel_scan", conn->handle);
+		ctx->error_code = SQLITE_ERR_PREPARE;
+		return -1;
+	}
+
+	rc = sqlite3_step(stmt);
+	if (rc != SQLITE_ROW) {
+		set_sqlite_error(ctx, "sqlite::parallel_scan", conn->handle);
+		ctx->error_code = error_code_for(rc, SQLITE_ERR_STEP);
+		sqlite3_finalize(stmt);
+		return -1;
+	}
+
+	int found = sqlite3_column_type(stmt, 0) != SQLITE_NULL;
+	*lo = sqlite3_column_int64(stmt, 0);
+	*hi = sqlite3_column_int64(stmt, 1);
+	sqlite3_finalize(stmt);
+	return found;
+}
+
+/** Offset of partition i from the range start: the first extra partitions get one more key */
+static uint64_t partition_start(int i, uint64_t step, uint64_t extra) {
+	return (uint64_t)i * step + ((uint64_t)i < extra ? (uint64_t)i : extra);
+}
+
+/**
+ * parallel_scan - Run a range query over partitions of a table in parallel
+ * Stack: (sql:str table:str partition_col:str workers:i64 db_path:str -- handle:ptr)!
+ */
+int usr_sqlite_parallel_scan(qd_context* ctx) {
+	qd_stack_element_t path_elem, workers_elem, column_elem, table_elem, sql_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &path_elem);
+	if (err != QD_STACK_OK || path_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::parallel_scan: expected database path");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &workers_elem);
+	if (err != QD_STACK_OK || workers_elem.type != QD_STACK_TYPE_INT ||
+	    workers_elem.value.i < 1 || workers_elem.value.i > SQLITE_ASYNC_MAX_WORKERS) {
+		qd_string_release(path_elem.value.s);
+		set_error_msg(ctx, "sqlite::parallel_scan: expected worker count from 1 to 64");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &column_elem);
+	if (err != QD_STACK_OK || column_elem.type != QD_STACK_TYPE_STR) {
+		qd_string_release(path_elem.value.s);
+		set_error_msg(ctx, "sqlite::parallel_scan: expected partition column");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &table_elem);
+	if (err != QD_STACK_OK || table_elem.type != QD_STACK_TYPE_STR) {
+		qd_string_release(column_elem.value.s);
+		qd_string_release(path_elem.value.s);
+		set_error_msg(ctx, "sqlite::parallel_scan: expected table name");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &sql_elem);
+	if (err != QD_STACK_OK || sql_elem.type != QD_STACK_TYPE_STR) {
+		qd_string_release(table_elem.value.s);
+		qd_string_release(column_elem.value.s);
+		qd_string_release(path_elem.value.s);
+		set_error_msg(ctx, "sqlite::parallel_scan: expected SQL string");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	const char* path = qd_string_data(path_elem.value.s);
+	int workers = (int)workers_elem.value.i;
+	int code = 0;
+
+	qdsqlite_parallel* p = calloc(1, sizeof(qdsqlite_parallel));
+	if (p) {
+		p->conns = calloc((size_t)workers, sizeof(qdsqlite_db*));
+		p->parts = calloc((size_t)workers, sizeof(qdsqlite_async*));
+		pthread_mutex_init(&p->notify.lock, NULL);
+		pthread_cond_init(&p->notify.changed, NULL);
+	}
+	if (!p || !p->conns || !p->parts) {
+		if (p) parallel_destroy(p);
+		p = NULL;
+		set_error_msg(ctx, "sqlite::parallel_scan: out of memory");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		code = SQLITE_ERR_INVALID_ARG;
+	}
+
+	int64_t lo = 0, hi = 0;
+	int found = 0;
+	if (!code) {
+		code = open_handle(ctx, "sqlite::parallel_scan", path, SQLITE_OPEN_READONLY, NULL,
+		                   find_preset("readonly"), &p->conns[0]);
+	}
+	if (!code) {
+		p->n = 1;
+		found = parallel_key_range(ctx, p->conns[0], qd_string_data(table_elem.value.s),
+		                           qd_string_data(column_elem.value.s), &lo, &hi);
+		if (found < 0) code = ctx->error_code;
+	}
+
+	if (!code && found) {
+		/* Split [lo, hi] into at most workers contiguous, inclusive ranges */
+		uint64_t span = (uint64_t)hi - (uint64_t)lo;
+		int n = span < (uint64_t)workers ? (int)span + 1 : workers;
+		uint64_t step = span / (uint64_t)n, extra = span % (uint64_t)n;
+
+		pthread_once(&async_pool.once, async_pool_start);
+		pthread_mutex_lock(&async_pool.lock);
+		async_pool_grow(n);
+		pthread_mutex_unlock(&async_pool.lock);
+
+		for (int i = 0; i < n && !code; i++) {
+			if (i > 0) {
+				code = open_handle(ctx, "sqlite::parallel_scan", path, SQLITE_OPEN_READONLY, NULL,
+				                   find_preset("readonly"), &p->conns[i]);
+				if (code) break;
+				p->n = i + 1;
+			}
+
+			uint64_t start = partition_start(i, step, extra);
+			uint64_t end = i + 1 < n ? partition_start(i + 1, step, extra) - 1 : span;
+			qdsqlite_batch* params = batch_create(2, 1);
+			qdsqlite_async* a = params ? async_create(p->conns[i], qd_string_data(sql_elem.value.s),
+			                                          qd_string_length(sql_elem.value.s), params,
+			                                          SQLITE_PARALLEL_CHUNK) : NULL;
+			if (!a) {
+				if (params) batch_destroy(params);
+				set_error_msg(ctx, "sqlite::parallel_scan: out of memory");
+				ctx->error_code = SQLITE_ERR_INVALID_ARG;
+				code = SQLITE_ERR_INVALID_ARG;
+				break;
+			}
+			params->types[0] = SQLITE_INTEGER;
+			params->ints[0] = (int64_t)((uint64_t)lo + start);
+			params->types[1] = SQLITE_INTEGER;
+			params->ints[1] = (int64_t)((uint64_t)lo + end);
+			params->rows = 1;
+			params->cells = 2;
+			a->notify = &p->notify;
+			p->parts[i] = a;
+		}
+
+		/* Enqueue only once every partition exists, so a failure leaves nothing running */
+		for (int i = 0; i < n; i++) {
+			if (!code) {
+				async_enqueue(p->parts[i]);
+			} else if (p->parts[i]) {
+				p->parts[i]->finished = 1;  /* never queued; lets parallel_destroy free it */
+			}
+		}
+	}
+
+	qd_string_release(sql_elem.value.s);
+	qd_string_release(table_elem.value.s);
+	qd_string_release(column_elem.value.s);
+	qd_string_release(path_elem.value.s);
+
+	if (code) {
+		if (p) parallel_destroy(p);
+		return code;
+	}
+
+	qd_push_p(ctx, p);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * parallel_next - Take the next batch from whichever partition has one
+ * Stack: (handle:ptr -- batch:ptr rows:i64)!
+ */
+int usr_sqlite_parallel_next(qd_context* ctx) {
+	qd_stack_element_t handle_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &handle_elem);
+	if (err != QD_STACK_OK || handle_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::parallel_next: expected parallel scan handle");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_parallel* p = (qdsqlite_parallel*)handle_elem.value.p;
+	int ncols = 0;
+	for (;;) {
+		pthread_mutex_lock(&p->notify.lock);
+		uint64_t seq = p->notify.seq;
+		pthread_mutex_unlock(&p->notify.lock);
+
+		int running = 0;
+		for (int k = 0; k < p->n; k++) {
+			int i = (p->next + k) % p->n;
+			qdsqlite_async* a = p->parts[i];
+			if (!a) continue;
+
+			pthread_mutex_lock(&a->lock);
+			qdsqlite_batch* b = async_take(a);
+			int finished = a->finished;
+			int code = a->code;
+			if (a->ncols) ncols = a->ncols;
+			pthread_mutex_unlock(&a->lock);
+
+			if (b) {
+				p->next = (i + 1) % p->n;
+				qd_push_p(ctx, b);
+				qd_push_i(ctx, b->rows);
+				qd_push_i(ctx, SQLITE_ERR_OK);
+				return 0;
+			}
+			/* Batches produced before an error are delivered first */
+			if (finished && code != SQLITE_ERR_OK) {
+				set_prefixed_error(ctx, "sqlite::parallel_next", a->message);
+				ctx->error_code = code;
+				return code;
+			}
+			if (!finished) running = 1;
+		}
+
+		if (!running) break;
+
+		pthread_mutex_lock(&p->notify.lock);
+		while (p->notify.seq == seq) pthread_cond_wait(&p->notify.changed, &p->notify.lock);
+		pthread_mutex_unlock(&p->notify.lock);
+	}
+
+	qdsqlite_batch* b = batch_create(ncols, 1);
+	if (!b) {
+		set_error_msg(ctx, "sqlite::parallel_next: out of memory");
+		ctx->error_code = SQLITE_ERR_STEP;
+		return (int){SQLITE_ERR_STEP};
+	}
+
+	qd_push_p(ctx, b);
+	qd_push_i(ctx, 0);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * parallel_free - Cancel running partitions and free the scan and its connections
+ * Stack: (handle:ptr -- )
+ */
+int usr_sqlite_parallel_free(qd_context* ctx) {
+	qd_stack_element_t handle_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &handle_elem);
+	if (err != QD_STACK_OK || handle_elem.type != QD_STACK_TYPE_PTR || !handle_elem.value.p) {
+		return 0;
+	}
+
+	parallel_destroy((qdsqlite_parallel*)handle_elem.value.p);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Library configuration
+ *
+ * sqlite3_config only works before the library initializes, which the
+ * first open does implicitly, so the config_* calls belong at program
+ * startup before any connection exists or other thread runs. The heap
+ * limits and memory counters can be used at any time.
+ * ------------------------------------------------------------------------ */
+
+/** Slab handed to SQLITE_CONFIG_PAGECACHE; lives for the process */
+static void* pagecache_slab;
+
+/** Report a sqlite3_config failure; MISUSE means the library is already initialized */
+static int config_error(qd_context* ctx, const char* prefix, int rc) {
+	char msg[160];
+	if (rc == SQLITE_MISUSE) {
+		snprintf(msg, sizeof(msg), "%s: must be called before the first connection is opened", prefix);
+	} else {
+		snprintf(msg, sizeof(msg), "%s: %s", prefix, sqlite3_errstr(rc));
+	}
+	set_error_msg(ctx, msg);
+	ctx->error_code = SQLITE_ERR_INVALID_ARG;
+	return (int){SQLITE_ERR_INVALID_ARG};
+}
+
+/**
+ * config_pagecache - Give SQLite a preallocated page cache slab
+ * Stack: (page_size:i64 pages:i64 -- )!
+ */
+int usr_sqlite_config_pagecache(qd_context* ctx) {
+	qd_stack_element_t pages_elem, size_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &pages_elem);
+	if (err != QD_STACK_OK || pages_elem.type != QD_STACK_TYPE_INT || pages_elem.value.i <= 0 || pages_elem.value.i > INT32_MAX) {
+		set_error_msg(ctx, "sqlite::config_pagecache: expected positive page count");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &size_elem);
+	int64_t page_size = size_elem.value.i;
+	if (err != QD_STACK_OK || size_elem.type != QD_STACK_TYPE_INT ||
+	    page_size < 512 || page_size > 65536 || (page_size & (page_size - 1)) != 0) {
+		set_error_msg(ctx, "sqlite::config_pagecache: expected page size power of two from 512 to 65536");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	/* Each slot holds a page plus the page cache's per-page header */
+	int hdr = 0;
+	int rc = sqlite3_config(SQLITE_CONFIG_PCACHE_HDRSZ, &hdr);
+	if (rc != SQLITE_OK) return config_error(ctx, "sqlite::config_pagecache", rc);
+
+	size_t slot = (size_t)page_size + (size_t)hdr;
+	void* slab = malloc(slot * (size_t)pages_elem.value.i);
+	if (!slab) {
+		set_error_msg(ctx, "sqlite::config_pagecache: out of memory");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	rc = sqlite3_config(SQLITE_CONFIG_PAGECACHE, slab, (int)slot, (int)pages_elem.value.i);
+	if (rc != SQLITE_OK) {
+		free(slab);
+		return config_error(ctx, "sqlite::config_pagecache", rc);
+	}
+	/* Not initialized yet, so nothing can be using a previous slab */
+	free(pagecache_slab);
+	pagecache_slab = slab;
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * config_lookaside - Set the default lookaside allocator size for new connections
+ * Stack: (slot_size:i64 slots:i64 -- )!
+ */
+int usr_sqlite_config_lookaside(qd_context* ctx) {
+	qd_stack_element_t slots_elem, size_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &slots_elem);
+	if (err != QD_STACK_OK || slots_elem.type != QD_STACK_TYPE_INT || slots_elem.value.i < 0 || slots_elem.value.i > INT32_MAX) {
+		set_error_msg(ctx, "sqlite::config_lookaside: expected slot count");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &size_elem);
+	if (err != QD_STACK_OK || size_elem.type != QD_STACK_TYPE_INT || size_elem.value.i < 0 || size_elem.value.i > 65536) {
+		set_error_msg(ctx, "sqlite::config_lookaside: expected slot size up to 65536");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	int rc = sqlite3_config(SQLITE_CONFIG_LOOKASIDE, (int)size_elem.value.i, (int)slots_elem.value.i);
+	if (rc != SQLITE_OK) return config_error(ctx, "sqlite::config_lookaside", rc);
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * config_malloc - Route SQLite's allocations through native memory methods
+ * Stack: (methods:ptr -- )!
+ */
+int usr_sqlite_config_malloc(qd_context* ctx) {
+	qd_stack_element_t methods_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &methods_elem);
+	if (err != QD_STACK_OK || methods_elem.type != QD_STACK_TYPE_PTR || !methods_elem.value.p) {
+		set_error_msg(ctx, "sqlite::config_malloc: expected sqlite3_mem_methods pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	/* SQLite copies the struct, so it only has to outlive this call */
+	int rc = sqlite3_config(SQLITE_CONFIG_MALLOC, (const sqlite3_mem_methods*)methods_elem.value.p);
+	if (rc != SQLITE_OK) return config_error(ctx, "sqlite::config_malloc", rc);
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * config_memstatus - Enable or disable global memory statistics
+ * Stack: (enabled:i64 -- )!
+ */
+int usr_sqlite_config_memstatus(qd_context* ctx) {
+	qd_stack_element_t enabled_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &enabled_elem);
+	if (err != QD_STACK_OK || enabled_elem.type != QD_STACK_TYPE_INT) {
+		set_error_msg(ctx, "sqlite::config_memstatus: expected integer flag");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	int rc = sqlite3_config(SQLITE_CONFIG_MEMSTATUS, enabled_elem.value.i != 0);
+	if (rc != SQLITE_OK) return config_error(ctx, "sqlite::config_memstatus", rc);
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * db_lookaside - Resize a connection's lookaside allocator
+ * Stack: (slot_size:i64 slots:i64 db:ptr -- )!
+ */
+int usr_sqlite_db_lookaside(qd_context* ctx) {
+	qd_stack_element_t db_elem, slots_elem, size_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::db_lookaside: expected database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &slots_elem);
+	if (err != QD_STACK_OK || slots_elem.type != QD_STACK_TYPE_INT || slots_elem.value.i < 0 || slots_elem.value.i > INT32_MAX) {
+		set_error_msg(ctx, "sqlite::db_lookaside: expected slot count");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &size_elem);
+	if (err != QD_STACK_OK || size_elem.type != QD_STACK_TYPE_INT || size_elem.value.i < 0 || size_elem.value.i > 65536) {
+		set_error_msg(ctx, "sqlite::db_lookaside: expected slot size up to 65536");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	/* SQLite allocates the buffer itself; fails with BUSY while lookaside memory is in use */
+	sqlite3* db = ((qdsqlite_db*)db_elem.value.p)->handle;
+	int rc = sqlite3_db_config(db, SQLITE_DBCONFIG_LOOKASIDE, NULL, (int)size_elem.value.i, (int)slots_elem.value.i);
+	if (rc != SQLITE_OK) {
+		char msg[128];
+		snprintf(msg, sizeof(msg), "sqlite::db_lookaside: %s", sqlite3_errstr(rc));
+		set_error_msg(ctx, msg);
+		ctx->error_code = error_code_for(rc, SQLITE_ERR_INVALID_ARG);
+		return ctx->error_code;
+	}
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * soft_heap_limit - Set the advisory heap limit, returning the previous one
+ * Stack: (bytes:i64 -- previous:i64)
+ */
+int usr_sqlite_soft_heap_limit(qd_context* ctx) {
+	qd_stack_element_t bytes_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &bytes_elem);
+	if (err != QD_STACK_OK || bytes_elem.type != QD_STACK_TYPE_INT) {
+		qd_push_i(ctx, sqlite3_soft_heap_limit64(-1));
+		return 0;
+	}
+
+	qd_push_i(ctx, sqlite3_soft_heap_limit64(bytes_elem.value.i));
+	return 0;
+}
+
+/**
+ * hard_heap_limit - Set the heap limit past which allocations fail, returning the previous one
+ * Stack: (bytes:i64 -- previous:i64)
+ */
+int usr_sqlite_hard_heap_limit(qd_context* ctx) {
+	qd_stack_element_t bytes_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &bytes_elem);
+	if (err != QD_STACK_OK || bytes_elem.type != QD_STACK_TYPE_INT) {
+		qd_push_i(ctx, sqlite3_hard_heap_limit64(-1));
+		return 0;
+	}
+
+	qd_push_i(ctx, sqlite3_hard_heap_limit64(bytes_elem.value.i));
+	return 0;
+}
+
+/**
+ * memory_used - Get bytes allocated by SQLite across all connections
+ * Stack: (reset:i64 -- current:i64 highwater:i64)
+ */
+int usr_sqlite_memory_used(qd_context* ctx) {
+	qd_stack_element_t reset_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &reset_elem);
+	int reset = err == QD_STACK_OK && reset_elem.type == QD_STACK_TYPE_INT && reset_elem.value.i != 0;
+
+	sqlite3_int64 current = 0, highwater = 0;
+	sqlite3_status64(SQLITE_STATUS_MEMORY_USED, &current, &highwater, reset);
+	qd_push_i(ctx, current);
+	qd_push_i(ctx, highwater);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Rebind and step
+ *
+ * One call per iteration for loops that only change some parameters:
+ * reset (keeping the other bindings), bind, and step.
+ * ------------------------------------------------------------------------ */
+
+/** Reset s for a rebind_step; a failed previous step does not block the next one */
+static void rebind_reset(qdsqlite_stmt* s) {
+	s->exhausted = 0;
+	sqlite3_reset(s->handle);
+}
+
+/** Step after a rebind and push has_row, or report the error */
+static int rebind_finish(qd_context* ctx, const char* prefix, qdsqlite_stmt* s) {
+	int rc = stmt_step(s);
+	if (rc == SQLITE_ROW || rc == SQLITE_DONE) {
+		qd_push_i(ctx, rc == SQLITE_ROW);
+		qd_push_i(ctx, SQLITE_ERR_OK);
+		return 0;
+	}
+
+	set_sqlite_error(ctx, prefix, sqlite3_db_handle(s->handle));
+	int code = error_code_for(rc, SQLITE_ERR_STEP);
+	ctx->error_code = code;
+	return code;
+}
+
+static int rebind_bind_error(qd_context* ctx, const char* prefix, qdsqlite_stmt* s) {
+	set_sqlite_error(ctx, prefix, sqlite3_db_handle(s->handle));
+	ctx->error_code = SQLITE_ERR_BIND;
+	return (int){SQLITE_ERR_BIND};
+}
+
+/** Pop the (index stmt) part of a rebind_step_* call */
+static int pop_rebind_target(qd_context* ctx, const char* prefix, qdsqlite_stmt** s, int* index) {
+	qd_stack_element_t stmt_elem, index_elem;
+	char msg[128];
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		snprintf(msg, sizeof(msg), "%s: expected statement pointer", prefix);
+		set_error_msg(ctx, msg);
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &index_elem);
+	if (err != QD_STACK_OK || index_elem.type != QD_STACK_TYPE_INT || index_elem.value.i < 1 || index_elem.value.i > INT32_MAX) {
+		snprintf(msg, sizeof(msg), "%s: expected parameter index", prefix);
+		set_error_msg(ctx, msg);
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	*s = (qdsqlite_stmt*)stmt_elem.value.p;
+	*index = (int)index_elem.value.i;
+	return 0;
+}
+
+/**
+ * rebind_step_int - Reset, bind one integer parameter and step
+ * Stack: (value:i64 index:i64 stmt:ptr -- has_row:i64)!
+ */
+int usr_sqlite_rebind_step_int(qd_context* ctx) {
+	qd_stack_element_t value_elem;
+	qdsqlite_stmt* s;
+	int index;
+
+	int code = pop_rebind_target(ctx, "sqlite::rebind_step_int", &s, &index);
+	if (code) return code;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &value_elem);
+	if (err != QD_STACK_OK || value_elem.type != QD_STACK_TYPE_INT) {
+		set_error_msg(ctx, "sqlite::rebind_step_int: expected integer value");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	rebind_reset(s);
+	if (sqlite3_bind_int64(s->handle, index, value_elem.value.i) != SQLITE_OK) {
+		return rebind_bind_error(ctx, "sqlite::rebind_step_int", s);
+	}
+	return rebind_finish(ctx, "sqlite::rebind_step_int", s);
+}
+
+/**
+ * rebind_step_float - Reset, bind one float parameter and step
+ * Stack: (value:f64 index:i64 stmt:ptr -- has_row:i64)!
+ */
+int usr_sqlite_rebind_step_float(qd_context* ctx) {
+	qd_stack_element_t value_elem;
+	qdsqlite_stmt* s;
+	int index;
+
+	int code = pop_rebind_target(ctx, "sqlite::rebind_step_float", &s, &index);
+	if (code) return code;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &value_elem);
+	if (err != QD_STACK_OK || value_elem.type != QD_STACK_TYPE_FLOAT) {
+		set_error_msg(ctx, "sqlite::rebind_step_float: expected float value");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	rebind_reset(s);
+	if (sqlite3_bind_double(s->handle, index, value_elem.value.f) != SQLITE_OK) {
+		return rebind_bind_error(ctx, "sqlite::rebind_step_float", s);
+	}
+	return rebind_finish(ctx, "sqlite::rebind_step_float", s);
+}
+
+/**
+ * rebind_step_text - Reset, bind one string parameter and step
+ * Stack: (value:str index:i64 stmt:ptr -- has_row:i64)!
+ */
+int usr_sqlite_rebind_step_text(qd_context* ctx) {
+	qd_stack_element_t value_elem;
+	qdsqlite_stmt* s;
+	int index;
+
+	int code = pop_rebind_target(ctx, "sqlite::rebind_step_text", &s, &index);
+	if (code) return code;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &value_elem);
+	if (err != QD_STACK_OK || value_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::rebind_step_text: expected string value");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	rebind_reset(s);
+	int rc = sqlite3_bind_text(s->handle, index, qd_string_data(value_elem.value.s),
+	                           (int)qd_string_length(value_elem.value.s), SQLITE_TRANSIENT);
+	qd_string_release(value_elem.value.s);
+	if (rc != SQLITE_OK) return rebind_bind_error(ctx, "sqlite::rebind_step_text", s);
+	return rebind_finish(ctx, "sqlite::rebind_step_text", s);
+}
+
+/**
+ * rebind_step - Reset, bind a params row to the first parameters and step
+ * Stack: (params:ptr stmt:ptr -- has_row:i64)!
+ */
+int usr_sqlite_rebind_step(qd_context* ctx) {
+	qd_stack_element_t stmt_elem, params_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &stmt_elem);
+	if (err != QD_STACK_OK || stmt_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::rebind_step: expected statement pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &params_elem);
+	qdsqlite_batch* params = (qdsqlite_batch*)params_elem.value.p;
+	if (err != QD_STACK_OK || params_elem.type != QD_STACK_TYPE_PTR || !params || params->rows < 1 ||
+	    params->cells < params->ncols) {
+		set_error_msg(ctx, "sqlite::rebind_step: expected params batch with a complete row");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_stmt* s = (qdsqlite_stmt*)stmt_elem.value.p;
+	if (params->ncols > sqlite3_bind_parameter_count(s->handle)) {
+		set_error_msg(ctx, "sqlite::rebind_step: more params than statement parameters");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	/* The params row is bound directly, so it is copied for bindings that outlive it */
+	rebind_reset(s);
+	for (int col = 0; col < params->ncols; col++) {
+		size_t cell = (size_t)col * (size_t)params->capacity;
+		int rc;
+		switch (params->types[cell]) {
+		case SQLITE_INTEGER:
+			rc = sqlite3_bind_int64(s->handle, col + 1, params->ints[cell]);
+			break;
+		case SQLITE_FLOAT:
+			rc = sqlite3_bind_double(s->handle, col + 1, params->floats[cell]);
+			break;
+		case SQLITE_TEXT:
+			rc = sqlite3_bind_text(s->handle, col + 1, params->bytes + params->ints[cell],
+			                       (int)params->lengths[cell], SQLITE_TRANSIENT);
+			break;
+		case SQLITE_BLOB:
+			rc = sqlite3_bind_blob(s->handle, col + 1, params->bytes + params->ints[cell],
+			                       (int)params->lengths[cell], SQLITE_TRANSIENT);
+			break;
+		default:
+			rc = sqlite3_bind_null(s->handle, col + 1);
+			break;
+		}
+		if (rc != SQLITE_OK) return rebind_bind_error(ctx, "sqlite::rebind_step", s);
+	}
+	return rebind_finish(ctx, "sqlite::rebind_step", s);
+}
+
+/* ------------------------------------------------------------------------
+ * Shared in-memory databases and ATTACH
+ *
+ * "file:NAME?mode=memory&cache=shared" names one in-memory database that
+ * every connection in the process opening the same URI shares. It lives
+ * until its last connection closes, so keep one connection open as the
+ * owner. Shared-cache connections lock per table: a writer holding a
+ * table makes readers of that table fail with ErrLocked until it commits.
+ * ------------------------------------------------------------------------ */
+
+/** Write the shared-memory URI for name into buf; -1 if name is not [A-Za-z0-9_.-]+ */
+static int shared_memory_uri(const char* name, char* buf, size_t cap) {
+	if (!name[0]) return -1;
+	for (const char* c = name; *c; c++) {
+		if (!isalnum((unsigned char)*c) && *c != '_' && *c != '.' && *c != '-') return -1;
+	}
+	int n = snprintf(buf, cap, "file:%s?mode=memory&cache=shared", name);
+	return n < 0 || (size_t)n >= cap ? -1 : 0;
+}
+
+static int detach_database(sqlite3* db, const char* alias) {
+	sqlite3_stmt* stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "DETACH DATABASE ?1", -1, &stmt, NULL);
+	if (rc != SQLITE_OK) return rc;
+	sqlite3_bind_text(stmt, 1, alias, -1, SQLITE_STATIC);
+	rc = sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+	return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+/** ATTACH path AS alias, both bound so neither needs quoting */
+static int attach_database(sqlite3* db, const char* path, const char* alias) {
+	int is_uri = strncmp(path, "file:", 5) == 0;
+	int existed = is_uri && access(path, F_OK) == 0;
+	sqlite3_stmt* stmt = NULL;
+	int rc = sqlite3_prepare_v2(db, "ATTACH DATABASE ?1 AS ?2", -1, &stmt, NULL);
+	if (rc != SQLITE_OK) return rc;
+	sqlite3_bind_text(stmt, 1, path, -1, SQLITE_STATIC);
+	sqlite3_bind_text(stmt, 2, alias, -1, SQLITE_STATIC);
+	rc = sqlite3_step(stmt);
+	sqlite3_finalize(stmt);
+	if (rc != SQLITE_DONE) return rc;
+
+	/*
+	 * Without SQLITE_OPEN_URI on the connection a "file:" path is taken
+	 * literally and silently creates a file by that name. Undo that.
+	 */
+	const char* file = sqlite3_db_filename(db, alias);
+	if (is_uri && file && strstr(file, "file:")) {
+		char* created = existed ? NULL : strdup(file);
+		detach_database(db, alias);
+		if (created) unlink(created);
+		free(created);
+		return SQLITE_CANTOPEN;
+	}
+	return SQLITE_OK;
+}
+
+/** Set the error for a failed attach_database/detach_database */
+static int attach_error(qd_context* ctx, const char* prefix, sqlite3* db, int rc) {
+	if (rc == SQLITE_CANTOPEN && sqlite3_errcode(db) == SQLITE_OK) {
+		char msg[128];
+		snprintf(msg, sizeof(msg), "%s: URI path needs a connection opened with OpenUri", prefix);
+		set_error_msg(ctx, msg);
+	} else {
+		set_sqlite_error(ctx, prefix, db);
+	}
+	int code = error_code_for(rc, SQLITE_ERR_EXEC);
+	ctx->error_code = code;
+	return code;
+}
+
+/**
+ * shared_memory_uri - Build the URI of a named shared in-memory database
+ * Stack: (name:str -- uri:str)!
+ */
+int usr_sqlite_shared_memory_uri(qd_context* ctx) {
+	qd_stack_element_t name_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &name_elem);
+	if (err != QD_STACK_OK || name_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::shared_memory_uri: expected string name");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	char uri[320];
+	int bad = shared_memory_uri(qd_string_data(name_elem.value.s), uri, sizeof(uri));
+	qd_string_release(name_elem.value.s);
+	if (bad) {
+		set_error_msg(ctx, "sqlite::shared_memory_uri: name must be letters, digits, '_', '.' or '-'");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qd_push_s(ctx, uri);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * open_shared_memory - Open (creating if needed) a named shared in-memory database
+ * Stack: (name:str -- db:ptr)!
+ */
+int usr_sqlite_open_shared_memory(qd_context* ctx) {
+	qd_stack_element_t name_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &name_elem);
+	if (err != QD_STACK_OK || name_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::open_shared_memory: expected string name");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	char uri[320];
+	int bad = shared_memory_uri(qd_string_data(name_elem.value.s), uri, sizeof(uri));
+	qd_string_release(name_elem.value.s);
+	if (bad) {
+		set_error_msg(ctx, "sqlite::open_shared_memory: name must be letters, digits, '_', '.' or '-'");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	return open_connection(ctx, "sqlite::open_shared_memory", uri,
+		SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_URI, NULL, NULL);
+}
+
+/**
+ * attach - Attach a database file or URI under an alias
+ * Stack: (path:str alias:str db:ptr -- )!
+ */
+int usr_sqlite_attach(qd_context* ctx) {
+	qd_stack_element_t db_elem, alias_elem, path_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::attach: expected database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &alias_elem);
+	if (err != QD_STACK_OK || alias_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::attach: expected string alias");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &path_elem);
+	if (err != QD_STACK_OK || path_elem.type != QD_STACK_TYPE_STR) {
+		qd_string_release(alias_elem.value.s);
+		set_error_msg(ctx, "sqlite::attach: expected string path");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	sqlite3* db = ((qdsqlite_db*)db_elem.value.p)->handle;
+	int rc = attach_database(db, qd_string_data(path_elem.value.s), qd_string_data(alias_elem.value.s));
+	qd_string_release(path_elem.value.s);
+	qd_string_release(alias_elem.value.s);
+	if (rc != SQLITE_OK) return attach_error(ctx, "sqlite::attach", db, rc);
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * detach - Detach an attached database
+ * Stack: (alias:str db:ptr -- )!
+ */
+int usr_sqlite_detach(qd_context* ctx) {
+	qd_stack_element_t db_elem, alias_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::detach: expected database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &alias_elem);
+	if (err != QD_STACK_OK || alias_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::detach: expected string alias");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	sqlite3* db = ((qdsqlite_db*)db_elem.value.p)->handle;
+	int rc = detach_database(db, qd_string_data(alias_elem.value.s));
+	qd_string_release(alias_elem.value.s);
+	if (rc != SQLITE_OK) return attach_error(ctx, "sqlite::detach", db, rc);
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * attached - Check whether an alias names an attached database
+ * Stack: (alias:str db:ptr -- attached:i64)
+ */
+int usr_sqlite_attached(qd_context* ctx) {
+	qd_stack_element_t db_elem, alias_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	err = qd_stack_pop(ctx->st, &alias_elem);
+	if (err != QD_STACK_OK || alias_elem.type != QD_STACK_TYPE_STR) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	/* -1 means no database by that name; in-memory ones have no filename */
+	sqlite3* db = ((qdsqlite_db*)db_elem.value.p)->handle;
+	int found = sqlite3_db_readonly(db, qd_string_data(alias_elem.value.s)) != -1;
+	qd_string_release(alias_elem.value.s);
+	qd_push_i(ctx, found);
+	return 0;
+}
+
+/**
+ * Run attach (path set) or detach on every pooled connection once all
+ * of them are idle. Holds the pool lock throughout, so no connection is
+ * handed out half-configured.
+ */
+static int pool_attach_all(qd_context* ctx, const char* prefix, qdsqlite_pool* pool,
+	const char* path, const char* alias) {
+	pthread_mutex_lock(&pool->lock);
+	while (pool->writer_busy || pool->nidle < pool->nreaders) {
+		pthread_cond_wait(&pool->all_idle, &pool->lock);
+	}
+
+	int n = pool->nreaders + 1;
+	int done = 0;
+	int rc = SQLITE_OK;
+	sqlite3* failed = NULL;
+	for (; done < n; done++) {
+		sqlite3* db = done == 0 ? pool->writer->handle : pool->readers[done - 1]->handle;
+		rc = path ? attach_database(db, path, alias) : detach_database(db, alias);
+		if (rc != SQLITE_OK) {
+			failed = db;
+			break;
+		}
+	}
+
+	int code = 0;
+	if (failed) {
+		code = attach_error(ctx, prefix, failed, rc);
+		/* Leave every connection as it was */
+		for (int i = 0; path && i < done; i++) {
+			detach_database(i == 0 ? pool->writer->handle : pool->readers[i - 1]->handle, alias);
+		}
+	}
+	pthread_mutex_unlock(&pool->lock);
+	return code;
+}
+
+/**
+ * pool_attach - Attach a database to every connection in a pool
+ * Stack: (path:str alias:str pool:ptr -- )!
+ */
+int usr_sqlite_pool_attach(qd_context* ctx) {
+	qd_stack_element_t pool_elem, alias_elem, path_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &pool_elem);
+	if (err != QD_STACK_OK || pool_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::pool_attach: expected pool pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &alias_elem);
+	if (err != QD_STACK_OK || alias_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::pool_attach: expected string alias");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &path_elem);
+	if (err != QD_STACK_OK || path_elem.type != QD_STACK_TYPE_STR) {
+		qd_string_release(alias_elem.value.s);
+		set_error_msg(ctx, "sqlite::pool_attach: expected string path");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	int code = pool_attach_all(ctx, "sqlite::pool_attach", (qdsqlite_pool*)pool_elem.value.p,
+		qd_string_data(path_elem.value.s), qd_string_data(alias_elem.value.s));
+	qd_string_release(path_elem.value.s);
+	qd_string_release(alias_elem.value.s);
+	if (code) return code;
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * pool_detach - Detach a database from every connection in a pool
+ * Stack: (alias:str pool:ptr -- )!
+ */
+int usr_sqlite_pool_detach(qd_context* ctx) {
+	qd_stack_element_t pool_elem, alias_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &pool_elem);
+	if (err != QD_STACK_OK || pool_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::pool_detach: expected pool pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &alias_elem);
+	if (err != QD_STACK_OK || alias_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::pool_detach: expected string alias");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	int code = pool_attach_all(ctx, "sqlite::pool_detach", (qdsqlite_pool*)pool_elem.value.p,
+		NULL, qd_string_data(alias_elem.value.s));
+	qd_string_release(alias_elem.value.s);
+	if (code) return code;
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * Change feed
+ *
+ * Update, commit, rollback and WAL hooks write change events into a
+ * fixed-size ring that any thread drains in batches. Row changes are
+ * staged per transaction and only published when it commits, so a
+ * rolled-back transaction produces no events. The commit hook runs before
+ * the commit is durable and SQLite has no hook for its outcome, so a
+ * COMMIT that fails afterwards (BUSY, I/O error) has still published its
+ * events. Changes undone by ROLLBACK TO a savepoint are still published.
+ * When the ring is full new events are counted as dropped; a consumer
+ * that sees drops should resync.
+ *
+ * WAL events arrive through the connection's shared WAL hook (see
+ * wal_hook_refresh). An authorizer turns off the truncate optimization
+ * so that DELETE without WHERE reports each row.
+ * ------------------------------------------------------------------------ */
+
+/* Event kinds, matching the Change* constants */
+#define CHANGE_INSERT 1
+#define CHANGE_UPDATE 2
+#define CHANGE_DELETE 3
+#define CHANGE_COMMIT 4
+#define CHANGE_WAL 5
+
+/** Largest ring accepted by change_feed_start */
+#define SQLITE_CHANGE_FEED_MAX (1 << 24)
+
+typedef struct change_event {
+	int kind;
+	int db;     /* index into names */
+	int table;  /* index into names, -1 for commit and WAL events */
+	int64_t value;  /* rowid, commit sequence or WAL pages */
+} change_event;
+
+typedef struct change_feed {
+	pthread_mutex_t lock;
+
+	/* Ring of published events; guarded by lock */
+	change_event* ring;
+	int64_t capacity;
+	int64_t head;   /* oldest event */
+	int64_t count;
+	int64_t dropped;
+	int64_t commits;
+
+	/* Interned schema and table names; append-only, guarded by lock */
+	char** names;
+	int nnames;
+	int names_cap;
+
+	/* Current transaction; only touched from the connection's hooks */
+	change_event* staged;
+	int64_t nstaged;
+	int64_t staged_cap;
+	int64_t staged_dropped;
+} change_feed;
+
+static void change_feed_destroy(change_feed* feed) {
+	for (int i = 0; i < feed->nnames; i++) free(feed->names[i]);
+	free(feed->names);
+	free(feed->ring);
+	free(feed->staged);
+	pthread_mutex_destroy(&feed->lock);
+	free(feed);
+}
+
+/** Index of name in the feed's name table, adding it if new; -1 when out of memory */
+static int change_feed_intern(change_feed* feed, const char* name) {
+	for (int i = feed->nnames - 1; i >= 0; i--) {
+		if (strcmp(feed->names[i], name) == 0) return i;
+	}
+	if (feed->nnames == feed->names_cap) {
+		int cap = feed->names_cap ? feed->names_cap * 2 : 16;
+		char** names = realloc(feed->names, (size_t)cap * sizeof(char*));
+		if (!names) return -1;
+		feed->names = names;
+		feed->names_cap = cap;
+	}
+	char* copy = strdup(name);
+	if (!copy) return -1;
+	feed->names[feed->nnames] = copy;
+	return feed->nnames++;
+}
+
+/** Append to the ring, counting a drop when it is full; call with lock held */
+static void change_feed_publish(change_feed* feed, change_event ev) {
+	if (feed->count == feed->capacity) {
+		feed->dropped++;
+		return;
+	}
+	feed->ring[(feed->head + feed->count) % feed->capacity] = ev;
+	feed->count++;
+}
+
+static void change_feed_update_hook(void* arg, int op, const char* db, const char* table, sqlite3_int64 rowid) {
+	change_feed* feed = (change_feed*)arg;
+
+	/* Staging beyond one ring's worth could never be published anyway */
+	if (feed->nstaged == feed->staged_cap) {
+		int64_t cap = feed->staged_cap ? feed->staged_cap * 2 : 64;
+		if (cap > feed->capacity) cap = feed->capacity;
+		change_event* staged = cap > feed->staged_cap
+			? realloc(feed->staged, (size_t)cap * sizeof(change_event)) : NULL;
+		if (!staged) {
+			feed->staged_dropped++;
+			return;
+		}
+		feed->staged = staged;
+		feed->staged_cap = cap;
+	}
+
+	pthread_mutex_lock(&feed->lock);
+	int db_index = change_feed_intern(feed, db);
+	int table_index = change_feed_intern(feed, table);
+	pthread_mutex_unlock(&feed->lock);
+	if (db_index < 0 || table_index < 0) {
+		feed->staged_dropped++;
+		return;
+	}
+
+	change_event* ev = &feed->staged[feed->nstaged++];
+	ev->kind = op == SQLITE_INSERT ? CHANGE_INSERT : op == SQLITE_DELETE ? CHANGE_DELETE : CHANGE_UPDATE;
+	ev->db = db_index;
+	ev->table = table_index;
+	ev->value = rowid;
+}
+
+static int change_feed_commit_hook(void* arg) {
+	change_feed* feed = (change_feed*)arg;
+
+	pthread_mutex_lock(&feed->lock);
+	for (int64_t i = 0; i < feed->nstaged; i++) {
+		change_feed_publish(feed, feed->staged[i]);
+	}
+	feed->dropped += feed->staged_dropped;
+	change_event ev = {CHANGE_COMMIT, 0, -1, ++feed->commits};
+	change_feed_publish(feed, ev);
+	pthread_mutex_unlock(&feed->lock);
+
+	feed->nstaged = 0;
+	feed->staged_dropped = 0;
+	return 0;
+}
+
+static void change_feed_rollback_hook(void* arg) {
+	change_feed* feed = (change_feed*)arg;
+	feed->nstaged = 0;
+	feed->staged_dropped = 0;
+}
+
+/** Publish a WAL write of pages frames to schema name */
+static void change_feed_wal(change_feed* feed, const char* name, int pages) {
+	pthread_mutex_lock(&feed->lock);
+	int db_index = change_feed_intern(feed, name);
+	if (db_index >= 0) {
+		change_event ev = {CHANGE_WAL, db_index, -1, pages};
+		change_feed_publish(feed, ev);
+	} else {
+		feed->dropped++;
+	}
+	pthread_mutex_unlock(&feed->lock);
+}
+
+/** Deny nothing, but ignore DELETE so it runs row by row through the update hook */
+static int change_feed_authorizer(void* arg, int action, const char* a, const char* b,
+	const char* c, const char* d) {
+	(void)arg; (void)a; (void)b; (void)c; (void)d;
+	return action == SQLITE_DELETE ? SQLITE_IGNORE : SQLITE_OK;
+}
+
+/** Remove the feed's hooks and free it */
+static void change_feed_stop(qdsqlite_db* conn) {
+	if (!conn->feed) return;
+	sqlite3_update_hook(conn->handle, NULL, NULL);
+	sqlite3_commit_hook(conn->handle, NULL, NULL);
+	sqlite3_rollback_hook(conn->handle, NULL, NULL);
+	sqlite3_set_authorizer(conn->handle, NULL, NULL);
+	change_feed_destroy(conn->feed);
+	conn->feed = NULL;
+	wal_hook_refresh(conn);
+}
+
+/**
+ * change_feed_start - Install change hooks feeding a ring of capacity events
+ * Stack: (capacity:i64 db:ptr -- )!
+ */
+int usr_sqlite_change_feed_start(qd_context* ctx) {
+	qd_stack_element_t db_elem, capacity_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::change_feed_start: expected database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &capacity_elem);
+	if (err != QD_STACK_OK || capacity_elem.type != QD_STACK_TYPE_INT ||
+	    capacity_elem.value.i < 1 || capacity_elem.value.i > SQLITE_CHANGE_FEED_MAX) {
+		set_error_msg(ctx, "sqlite::change_feed_start: capacity must be 1..16777216");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_db* conn = (qdsqlite_db*)db_elem.value.p;
+	change_feed* feed = calloc(1, sizeof(change_feed));
+	if (feed) {
+		feed->capacity = capacity_elem.value.i;
+		feed->ring = malloc((size_t)feed->capacity * sizeof(change_event));
+	}
+	if (!feed || !feed->ring) {
+		free(feed);
+		set_error_msg(ctx, "sqlite::change_feed_start: out of memory");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+	pthread_mutex_init(&feed->lock, NULL);
+
+	/* Restarting replaces the old feed and its undrained events */
+	change_feed_stop(conn);
+	conn->feed = feed;
+	sqlite3_set_authorizer(conn->handle, change_feed_authorizer, NULL);
+	sqlite3_update_hook(conn->handle, change_feed_update_hook, feed);
+	sqlite3_commit_hook(conn->handle, change_feed_commit_hook, feed);
+	sqlite3_rollback_hook(conn->handle, change_feed_rollback_hook, feed);
+	wal_hook_refresh(conn);
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * change_feed_stop - Remove change hooks and discard undrained events
+ * Stack: (db:ptr -- )
+ */
+int usr_sqlite_change_feed_stop(qd_context* ctx) {
+	qd_stack_element_t db_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		return 0;
+	}
+
+	change_feed_stop((qdsqlite_db*)db_elem.value.p);
+	return 0;
+}
+
+/**
+ * change_feed_drain - Move up to max events into a new batch
+ * Stack: (max:i64 db:ptr -- batch:ptr rows:i64)!
+ */
+int usr_sqlite_change_feed_drain(qd_context* ctx) {
+	qd_stack_element_t db_elem, max_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::change_feed_drain: expected database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &max_elem);
+	if (err != QD_STACK_OK || max_elem.type != QD_STACK_TYPE_INT || max_elem.value.i < 1) {
+		set_error_msg(ctx, "sqlite::change_feed_drain: expected positive max");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	change_feed* feed = ((qdsqlite_db*)db_elem.value.p)->feed;
+	if (!feed) {
+		set_error_msg(ctx, "sqlite::change_feed_drain: change feed not started");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	/* Size for what is queued now; events published meanwhile wait for the next drain */
+	pthread_mutex_lock(&feed->lock);
+	int64_t max = max_elem.value.i < feed->count ? max_elem.value.i : feed->count;
+	pthread_mutex_unlock(&feed->lock);
+
+	/* Columns: kind, schema, table (NULL for commit/WAL), rowid or value */
+	qdsqlite_batch* b = batch_create(4, max > 0 ? max : 1);
+	if (!b) {
+		set_error_msg(ctx, "sqlite::change_feed_drain: out of memory");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	pthread_mutex_lock(&feed->lock);
+	int64_t n = 0;
+	for (; n < max && feed->count > 0; n++) {
+		change_event ev = feed->ring[feed->head];
+		const char* db_name = feed->names[ev.db];
+		const char* table_name = ev.table >= 0 ? feed->names[ev.table] : NULL;
+		int64_t db_off = batch_append(b, db_name, strlen(db_name));
+		int64_t table_off = table_name ? batch_append(b, table_name, strlen(table_name)) : 0;
+		if (db_off < 0 || table_off < 0) break;
+
+		b->types[n] = SQLITE_INTEGER;
+		b->ints[n] = ev.kind;
+		b->types[b->capacity + n] = SQLITE_TEXT;
+		b->ints[b->capacity + n] = db_off;
+		b->lengths[b->capacity + n] = (int64_t)strlen(db_name);
+		b->types[2 * b->capacity + n] = table_name ? SQLITE_TEXT : SQLITE_NULL;
+		b->ints[2 * b->capacity + n] = table_off;
+		b->lengths[2 * b->capacity + n] = table_name ? (int64_t)strlen(table_name) : 0;
+		b->types[3 * b->capacity + n] = SQLITE_INTEGER;
+		b->ints[3 * b->capacity + n] = ev.value;
+
+		feed->head = (feed->head + 1) % feed->capacity;
+		feed->count--;
+	}
+	pthread_mutex_unlock(&feed->lock);
+	b->rows = n;
+	b->cells = 4 * n;
+
+	qd_push_p(ctx, b);
+	qd_push_i(ctx, n);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * change_feed_dropped - Events lost to a full ring since the last call
+ * Stack: (db:ptr -- dropped:i64)
+ */
+int usr_sqlite_change_feed_dropped(qd_context* ctx) {
+	qd_stack_element_t db_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		qd_push_i(ctx, 0);
+		return 0;
+	}
+
+	change_feed* feed = ((qdsqlite_db*)db_elem.value.p)->feed;
+	int64_t dropped = 0;
+	if (feed) {
+		pthread_mutex_lock(&feed->lock);
+		dropped = feed->dropped;
+		feed->dropped = 0;
+		pthread_mutex_unlock(&feed->lock);
+	}
+	qd_push_i(ctx, dropped);
+	return 0;
+}
+
+/* ------------------------------------------------------------------------
+ * WAL checkpoints
+ *
+ * sqlite3_wal_hook has one slot per connection, and SQLite's own
+ * auto-checkpoint lives in it. While a change feed or a background
+ * checkpointer needs the hook, wal_hook_refresh installs wal_hook_main,
+ * which serves both and keeps checkpointing at the connection's
+ * wal_autocheckpoint pages unless a checkpointer has taken over. When
+ * neither remains, SQLite's auto-checkpoint is put back.
+ * ------------------------------------------------------------------------ */
+
+/**
+ * Background checkpointer: a thread with its own connection to the same
+ * file. The writer's WAL hook only records the frame count and wakes the
+ * thread, so commits never wait for a checkpoint.
+ */
+typedef struct checkpointer {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	sqlite3* db;       /* dedicated connection, used only by the thread */
+	int mode;          /* SQLITE_CHECKPOINT_* */
+	int pages;         /* run when this many new frames are in the WAL; 0 off */
+	int idle_ms;       /* run after this long without commits; 0 off */
+	int stop;
+	int sleeping;      /* waiting with no deadline; hook must signal */
+
+	/* Guarded by lock */
+	int frames;        /* WAL frames at the last commit */
+	int base;          /* frames already checkpointed */
+	int64_t commits;   /* WAL hook calls */
+	int64_t run_commits;
+	int64_t last_write_ns;
+	int64_t last_run_ns;
+	int64_t runs;
+	int64_t busy;
+	int last_log;
+	int last_checkpointed;
+} checkpointer;
+
+static int wal_hook_main(void* arg, sqlite3* db, const char* name, int pages) {
+	qdsqlite_db* conn = (qdsqlite_db*)arg;
+	if (conn->feed) change_feed_wal(conn->feed, name, pages);
+
+	checkpointer* cp = conn->checkpointer;
+	if (!cp) {
+		if (conn->autocheckpoint > 0 && pages >= conn->autocheckpoint) {
+			sqlite3_wal_checkpoint_v2(db, name, SQLITE_CHECKPOINT_PASSIVE, NULL, NULL);
+		}
+		return SQLITE_OK;
+	}
+
+	pthread_mutex_lock(&cp->lock);
+	if (pages < cp->base) cp->base = 0;  /* the WAL was restarted */
+	cp->frames = pages;
+	cp->commits++;
+	cp->last_write_ns = now_ns();
+	if (cp->sleeping || (cp->pages > 0 && cp->frames - cp->base >= cp->pages)) {
+		pthread_cond_signal(&cp->wake);
+	}
+	pthread_mutex_unlock(&cp->lock);
+	return SQLITE_OK;
+}
+
+/** Install or remove wal_hook_main to match the connection's feed and checkpointer */
+static void wal_hook_refresh(qdsqlite_db* conn) {
+	int want = conn->feed || conn->checkpointer;
+	if (want && !conn->wal_hooked) {
+		conn->autocheckpoint = 1000;
+		sqlite3_stmt* stmt = NULL;
+		if (sqlite3_prepare_v2(conn->handle, "PRAGMA wal_autocheckpoint", -1, &stmt, NULL) == SQLITE_OK &&
+		    sqlite3_step(stmt) == SQLITE_ROW) {
+			conn->autocheckpoint = sqlite3_column_int(stmt, 0);
+		}
+		sqlite3_finalize(stmt);
+		sqlite3_wal_hook(conn->handle, wal_hook_main, conn);
+		conn->wal_hooked = 1;
+	} else if (!want && conn->wal_hooked) {
+		sqlite3_wal_autocheckpoint(conn->handle, conn->autocheckpoint);
+		conn->wal_hooked = 0;
+	}
+}
+
+static void* checkpointer_main(void* arg) {
+	checkpointer* cp = (checkpointer*)arg;
+
+	pthread_mutex_lock(&cp->lock);
+	while (!cp->stop) {
+		int64_t now = now_ns();
+		int due = cp->frames - cp->base;
+		int run = 0;
+		int64_t wait_ns = -1;
+
+		if (cp->pages > 0 && due >= cp->pages && cp->commits != cp->run_commits) {
+			run = 1;
+		} else if (cp->idle_ms > 0 && due > 0) {
+			int64_t quiet = cp->last_write_ns > cp->last_run_ns ? cp->last_write_ns : cp->last_run_ns;
+			int64_t left = quiet + (int64_t)cp->idle_ms * 1000000 - now;
+			if (left <= 0) run = 1;
+			else wait_ns = left;
+		}
+
+		if (!run) {
+			if (wait_ns < 0) {
+				cp->sleeping = 1;
+				pthread_cond_wait(&cp->wake, &cp->lock);
+				cp->sleeping = 0;
+			} else {
+				struct timespec deadline;
+				clock_gettime(CLOCK_REALTIME, &deadline);
+				deadline.tv_sec += wait_ns / 1000000000;
+				deadline.tv_nsec += wait_ns % 1000000000;
+				if (deadline.tv_nsec >= 1000000000) {
+					deadline.tv_sec++;
+					deadline.tv_nsec -= 1000000000;
+				}
+				pthread_cond_timedwait(&cp->wake, &cp->lock, &deadline);
+			}
+			continue;
+		}
+
+		cp->run_commits = cp->commits;
+		pthread_mutex_unlock(&cp->lock);
+		int log = -1, done = -1;
+		int rc = sqlite3_wal_checkpoint_v2(cp->db, "main", cp->mode, &log, &done);
+		pthread_mutex_lock(&cp->lock);
+
+		cp->runs++;
+		if ((rc & 0xff) == SQLITE_BUSY) cp->busy++;
+		cp->last_log = log;
+		cp->last_checkpointed = done;
+		cp->last_run_ns = now_ns();
+		/* Frames a reader still pins are retried after the next commit or idle period */
+		if (log >= 0 && cp->commits == cp->run_commits) cp->frames = log;  /* RESTART/TRUNCATE reset it */
+		if (done >= 0 && cp->base <= done) cp->base = done;
+		else if (rc != SQLITE_OK && (rc & 0xff) != SQLITE_BUSY) cp->base = cp->frames;
+	}
+	pthread_mutex_unlock(&cp->lock);
+	return NULL;
+}
+
+/** Stop and join the connection's checkpointer, if any */
+static void checkpointer_stop(qdsqlite_db* conn) {
+	checkpointer* cp = conn->checkpointer;
+	if (!cp) return;
+
+	pthread_mutex_lock(&cp->lock);
+	cp->stop = 1;
+	pthread_cond_signal(&cp->wake);
+	pthread_mutex_unlock(&cp->lock);
+	pthread_join(cp->thread, NULL);
+
+	conn->checkpointer = NULL;
+	wal_hook_refresh(conn);
+	sqlite3_close(cp->db);
+	pthread_cond_destroy(&cp->wake);
+	pthread_mutex_destroy(&cp->lock);
+	free(cp);
+}
+
+/** Pop a checkpoint mode; 1 if valid */
+static int pop_checkpoint_mode(qd_context* ctx, int* mode) {
+	qd_stack_element_t mode_elem;
+	qd_stack_error err = qd_stack_pop(ctx->st, &mode_elem);
+	if (err != QD_STACK_OK || mode_elem.type != QD_STACK_TYPE_INT ||
+	    mode_elem.value.i < SQLITE_CHECKPOINT_PASSIVE || mode_elem.value.i > SQLITE_CHECKPOINT_TRUNCATE) {
+		return 0;
+	}
+	*mode = (int)mode_elem.value.i;
+	return 1;
+}
+
+/**
+ * wal_checkpoint - Checkpoint the WAL of one schema, or all with ""
+ * Stack: (mode:i64 schema:str db:ptr -- log_frames:i64 checkpointed:i64)!
+ */
+int usr_sqlite_wal_checkpoint(qd_context* ctx) {
+	qd_stack_element_t db_elem, schema_elem;
+	int mode;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::wal_checkpoint: expected database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &schema_elem);
+	if (err != QD_STACK_OK || schema_elem.type != QD_STACK_TYPE_STR) {
+		set_error_msg(ctx, "sqlite::wal_checkpoint: expected schema name");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	if (!pop_checkpoint_mode(ctx, &mode)) {
+		qd_string_release(schema_elem.value.s);
+		set_error_msg(ctx, "sqlite::wal_checkpoint: expected Checkpoint* mode");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	sqlite3* db = ((qdsqlite_db*)db_elem.value.p)->handle;
+	const char* schema = qd_string_data(schema_elem.value.s);
+	int log = -1, done = -1;
+	int rc = sqlite3_wal_checkpoint_v2(db, schema[0] ? schema : NULL, mode, &log, &done);
+	qd_string_release(schema_elem.value.s);
+	if (rc != SQLITE_OK) {
+		set_sqlite_error(ctx, "sqlite::wal_checkpoint", db);
+		int code = error_code_for(rc, SQLITE_ERR_EXEC);
+		ctx->error_code = code;
+		return code;
+	}
+
+	qd_push_i(ctx, log);
+	qd_push_i(ctx, done);
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * wal_autocheckpoint - Set the WAL size in pages that triggers a checkpoint on commit
+ * Stack: (pages:i64 db:ptr -- )!
+ */
+int usr_sqlite_wal_autocheckpoint(qd_context* ctx) {
+	qd_stack_element_t db_elem, pages_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::wal_autocheckpoint: expected database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &pages_elem);
+	if (err != QD_STACK_OK || pages_elem.type != QD_STACK_TYPE_INT ||
+	    pages_elem.value.i < 0 || pages_elem.value.i > INT32_MAX) {
+		set_error_msg(ctx, "sqlite::wal_autocheckpoint: expected non-negative page count");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	/* sqlite3_wal_autocheckpoint would replace wal_hook_main, so record it instead */
+	qdsqlite_db* conn = (qdsqlite_db*)db_elem.value.p;
+	if (conn->wal_hooked) {
+		conn->autocheckpoint = (int)pages_elem.value.i;
+	} else {
+		sqlite3_wal_autocheckpoint(conn->handle, (int)pages_elem.value.i);
+	}
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * checkpointer_start - Checkpoint a WAL database from a background thread
+ * Stack: (mode:i64 pages:i64 idle_ms:i64 db:ptr -- )!
+ */
+int usr_sqlite_checkpointer_start(qd_context* ctx) {
+	qd_stack_element_t db_elem, idle_elem, pages_elem;
+	int mode;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		set_error_msg(ctx, "sqlite::checkpointer_start: expected database pointer");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &idle_elem);
+	if (err != QD_STACK_OK || idle_elem.type != QD_STACK_TYPE_INT ||
+	    idle_elem.value.i < 0 || idle_elem.value.i > INT32_MAX) {
+		set_error_msg(ctx, "sqlite::checkpointer_start: expected non-negative idle_ms");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	err = qd_stack_pop(ctx->st, &pages_elem);
+	if (err != QD_STACK_OK || pages_elem.type != QD_STACK_TYPE_INT ||
+	    pages_elem.value.i < 0 || pages_elem.value.i > INT32_MAX) {
+		set_error_msg(ctx, "sqlite::checkpointer_start: expected non-negative page count");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	if (!pop_checkpoint_mode(ctx, &mode)) {
+		set_error_msg(ctx, "sqlite::checkpointer_start: expected Checkpoint* mode");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	if (pages_elem.value.i == 0 && idle_elem.value.i == 0) {
+		set_error_msg(ctx, "sqlite::checkpointer_start: pages and idle_ms are both 0");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	qdsqlite_db* conn = (qdsqlite_db*)db_elem.value.p;
+	const char* path = sqlite3_db_filename(conn->handle, "main");
+	const char* problem = sqlite3_db_readonly(conn->handle, "main") == 0 && path && path[0]
+		? NULL : "sqlite::checkpointer_start: needs a writable file database";
+	if (!problem) {
+		sqlite3_stmt* stmt = NULL;
+		if (sqlite3_prepare_v2(conn->handle, "PRAGMA journal_mode", -1, &stmt, NULL) != SQLITE_OK ||
+		    sqlite3_step(stmt) != SQLITE_ROW ||
+		    sqlite3_stricmp((const char*)sqlite3_column_text(stmt, 0), "wal") != 0) {
+			problem = "sqlite::checkpointer_start: database is not in WAL mode";
+		}
+		sqlite3_finalize(stmt);
+	}
+	if (problem) {
+		set_error_msg(ctx, problem);
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+
+	checkpointer* cp = calloc(1, sizeof(checkpointer));
+	if (!cp) {
+		set_error_msg(ctx, "sqlite::checkpointer_start: out of memory");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+	/* A fresh connection only opens the WAL on its first read */
+	if (sqlite3_open_v2(path, &cp->db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_NOMUTEX, NULL) != SQLITE_OK ||
+	    sqlite3_exec(cp->db, "PRAGMA journal_mode", NULL, NULL, NULL) != SQLITE_OK) {
+		set_sqlite_error(ctx, "sqlite::checkpointer_start", cp->db);
+		ctx->error_code = SQLITE_ERR_OPEN;
+		sqlite3_close(cp->db);
+		free(cp);
+		return (int){SQLITE_ERR_OPEN};
+	}
+	cp->mode = mode;
+	cp->pages = (int)pages_elem.value.i;
+	cp->idle_ms = (int)idle_elem.value.i;
+	pthread_mutex_init(&cp->lock, NULL);
+	pthread_cond_init(&cp->wake, NULL);
+
+	/* Restarting replaces the old checkpointer */
+	checkpointer_stop(conn);
+	if (pthread_create(&cp->thread, NULL, checkpointer_main, cp) != 0) {
+		pthread_cond_destroy(&cp->wake);
+		pthread_mutex_destroy(&cp->lock);
+		sqlite3_close(cp->db);
+		free(cp);
+		set_error_msg(ctx, "sqlite::checkpointer_start: failed to start checkpoint thread");
+		ctx->error_code = SQLITE_ERR_INVALID_ARG;
+		return (int){SQLITE_ERR_INVALID_ARG};
+	}
+	conn->checkpointer = cp;
+	wal_hook_refresh(conn);
+
+	qd_push_i(ctx, SQLITE_ERR_OK);
+	return 0;
+}
+
+/**
+ * checkpointer_stop - Stop the background checkpointer and restore auto-checkpoint
+ * Stack: (db:ptr -- )
+ */
+int usr_sqlite_checkpointer_stop(qd_context* ctx) {
+	qd_stack_element_t db_elem;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err != QD_STACK_OK || db_elem.type != QD_STACK_TYPE_PTR) {
+		return 0;
+	}
+
+	checkpointer_stop((qdsqlite_db*)db_elem.value.p);
+	return 0;
+}
+
+/**
+ * checkpointer_stats - Background checkpoint counters
+ * Stack: (db:ptr -- runs:i64 busy:i64 log_frames:i64 checkpointed:i64)
+ */
+int usr_sqlite_checkpointer_stats(qd_context* ctx) {
+	qd_stack_element_t db_elem;
+	int64_t runs = 0, busy = 0, log = -1, done = -1;
+
+	qd_stack_error err = qd_stack_pop(ctx->st, &db_elem);
+	if (err == QD_STACK_OK && db_elem.type == QD_STACK_TYPE_PTR) {
+		checkpointer* cp = ((qdsqlite_db*)db_elem.value.p)->checkpointer;
+		if (cp) {
+			pthread_mutex_lock(&cp->lock);
+			runs = cp->runs;
+			busy = cp->busy;
+			log = cp->last_log;
+			done = cp->last_checkpointed;
+			pthread_mutex_unlock(&cp->lock);
+		}
+	}
+
+	qd_push_i(ctx, runs);
+	qd_push_i(ctx, busy);
+	qd_push_i(ctx, log);
+	qd_push_i(ctx, done);
 	return 0;
 }